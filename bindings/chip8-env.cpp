@@ -0,0 +1,94 @@
+#include "chip8-env.h"
+#include "vector-env.h"
+#include <string>
+
+static_assert(CHIP8_ENV_OBSERVATION_WORDS == ENV_OBSERVATION_WORDS, "Observation layout must match VectorEnv");
+static_assert(CHIP8_ENV_TERMINATED == ENV_TERMINATED && CHIP8_ENV_TRUNCATED == ENV_TRUNCATED, "Flags must match VectorEnv");
+
+struct Chip8Env {
+    VectorEnv Env;
+};
+
+// Per thread, like errno
+static thread_local std::string LastError;
+
+static bool ToSource(uint32_t value, E_ENV_SOURCE &source) {
+    switch (value) {
+    case CHIP8_ENV_SOURCE_NONE:
+        source = ENV_SOURCE_NONE;
+        return true;
+    case CHIP8_ENV_SOURCE_REGISTER:
+        source = ENV_SOURCE_REGISTER;
+        return true;
+    case CHIP8_ENV_SOURCE_MEMORY:
+        source = ENV_SOURCE_MEMORY;
+        return true;
+    default:
+        return false;
+    }
+}
+
+Chip8Env *chip8_env_create(const char *rom, const char *database, const Chip8EnvConfig *config) {
+    if (!rom || !config) {
+        LastError = "A ROM and a configuration are required";
+        return nullptr;
+    }
+
+    EnvSettings settings;
+    settings.Count = config->Count;
+    settings.FramesPerAction = config->FramesPerAction;
+    settings.InstructionsPerFrame = config->InstructionsPerFrame;
+    settings.MaxFrames = config->MaxFrames;
+    settings.Seed = config->Seed;
+    settings.Threads = config->Threads;
+    settings.RewardIndex = static_cast<uint16_t>(config->RewardIndex);
+    settings.DoneIndex = static_cast<uint16_t>(config->DoneIndex);
+    settings.DoneValue = static_cast<uint8_t>(config->DoneValue);
+    if (!ToSource(config->RewardSource, settings.RewardSource) || !ToSource(config->DoneSource, settings.DoneSource)) {
+        LastError = "Unknown reward or done source";
+        return nullptr;
+    }
+
+    Chip8Env *env = new Chip8Env();
+    if (!env->Env.Create(rom, database ? database : "", settings)) {
+        LastError = env->Env.Error;
+        delete env;
+        return nullptr;
+    }
+    return env;
+}
+
+void chip8_env_destroy(Chip8Env *env) {
+    delete env;
+}
+
+const char *chip8_env_error(void) {
+    return LastError.c_str();
+}
+
+uint32_t chip8_env_count(const Chip8Env *env) {
+    return env ? env->Env.Count() : 0;
+}
+
+uint32_t chip8_env_instructions_per_frame(const Chip8Env *env) {
+    return env ? env->Env.InstructionsPerFrame() : 0;
+}
+
+int chip8_env_reset(Chip8Env *env, uint64_t *observations) {
+    if (!env) {
+        LastError = "No environment";
+        return -1;
+    }
+    env->Env.Reset(observations);
+    return 0;
+}
+
+int chip8_env_step(Chip8Env *env, const uint16_t *actions, uint64_t *observations, float *rewards, uint8_t *flags,
+                   uint64_t *final) {
+    if (!env || !actions) {
+        LastError = "An environment and actions are required";
+        return -1;
+    }
+    env->Env.Step(actions, observations, rewards, flags, final);
+    return 0;
+}
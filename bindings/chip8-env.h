@@ -0,0 +1,68 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// C interface to VectorEnv for reinforcement learning, built as the chip8env
+// shared library and meant for ctypes. All buffers belong to the caller and
+// are written in place, one slot per VM:
+//   actions        uint16   key mask, bit k holds CHIP-8 key k
+//   observations   uint64 x CHIP8_ENV_OBSERVATION_WORDS, bit x of word y is pixel (x, y)
+//   rewards        float    signed change of the reward byte over the step
+//   flags          uint8    CHIP8_ENV_TERMINATED or CHIP8_ENV_TRUNCATED
+// A VM whose episode ends is reset during the same step.
+
+#ifdef _WIN32
+#define CHIP8_ENV_EXPORT __declspec(dllexport)
+#else
+#define CHIP8_ENV_EXPORT __attribute__((visibility("default")))
+#endif
+
+#define CHIP8_ENV_OBSERVATION_WORDS 32
+#define CHIP8_ENV_WIDTH 64
+#define CHIP8_ENV_HEIGHT 32
+
+#define CHIP8_ENV_SOURCE_NONE 0
+#define CHIP8_ENV_SOURCE_REGISTER 1
+#define CHIP8_ENV_SOURCE_MEMORY 2
+
+#define CHIP8_ENV_TERMINATED 0x01
+#define CHIP8_ENV_TRUNCATED 0x02
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct Chip8EnvConfig {
+    uint32_t Count;                 // VMs in the batch
+    uint32_t FramesPerAction;       // Frames run per step with the action's keys held
+    uint32_t InstructionsPerFrame;  // 0 picks the database or default value
+    uint32_t MaxFrames;             // Episode length before truncation, 0 for none
+    uint32_t Seed;
+    uint32_t Threads;               // 0 or 1 steps on the calling thread
+    uint32_t RewardSource;          // CHIP8_ENV_SOURCE_*
+    uint32_t RewardIndex;           // Register 0-F or memory address
+    uint32_t DoneSource;            // Episode ends when this byte equals DoneValue
+    uint32_t DoneIndex;
+    uint32_t DoneValue;
+} Chip8EnvConfig;
+
+typedef struct Chip8Env Chip8Env;
+
+// NULL on failure, chip8_env_error says why. database may be NULL.
+CHIP8_ENV_EXPORT Chip8Env *chip8_env_create(const char *rom, const char *database, const Chip8EnvConfig *config);
+CHIP8_ENV_EXPORT void chip8_env_destroy(Chip8Env *env);
+CHIP8_ENV_EXPORT const char *chip8_env_error(void);
+
+CHIP8_ENV_EXPORT uint32_t chip8_env_count(const Chip8Env *env);
+CHIP8_ENV_EXPORT uint32_t chip8_env_instructions_per_frame(const Chip8Env *env);
+
+// Start every VM on a new episode, observations may be NULL
+CHIP8_ENV_EXPORT int chip8_env_reset(Chip8Env *env, uint64_t *observations);
+// Any buffer but actions may be NULL. final, when given, receives the last
+// observation of every VM that was reset. Returns 0, or -1 on bad arguments.
+CHIP8_ENV_EXPORT int chip8_env_step(Chip8Env *env, const uint16_t *actions, uint64_t *observations, float *rewards,
+                                    uint8_t *flags, uint64_t *final);
+
+#ifdef __cplusplus
+}
+#endif
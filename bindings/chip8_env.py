@@ -0,0 +1,116 @@
+"""ctypes wrapper around the chip8env shared library.
+
+    env = Chip8VectorEnv("data/MAZE.ch8", count=64, frames_per_action=4)
+    obs = env.reset()                      # (count, 32) uint64 packed rows
+    obs, rewards, flags = env.step(actions)  # actions: (count,) uint16 key masks
+
+Buffers are allocated once and written in place by every step, take a copy
+of anything kept across steps. Observations stay packed, bit x of row word
+y is pixel (x, y). With pixels=True they are unpacked into a preallocated
+(count, 32, 64) uint8 buffer instead, which costs a pass over every pixel.
+"""
+import ctypes
+import os
+
+import numpy as np
+
+SOURCE_NONE = 0
+SOURCE_REGISTER = 1
+SOURCE_MEMORY = 2
+
+TERMINATED = 0x01
+TRUNCATED = 0x02
+
+OBSERVATION_WORDS = 32
+
+
+class Chip8EnvConfig(ctypes.Structure):
+    _fields_ = [
+        ("Count", ctypes.c_uint32),
+        ("FramesPerAction", ctypes.c_uint32),
+        ("InstructionsPerFrame", ctypes.c_uint32),
+        ("MaxFrames", ctypes.c_uint32),
+        ("Seed", ctypes.c_uint32),
+        ("Threads", ctypes.c_uint32),
+        ("RewardSource", ctypes.c_uint32),
+        ("RewardIndex", ctypes.c_uint32),
+        ("DoneSource", ctypes.c_uint32),
+        ("DoneIndex", ctypes.c_uint32),
+        ("DoneValue", ctypes.c_uint32),
+    ]
+
+
+def load_library(path=None):
+    path = path or os.environ.get("CHIP8_ENV_LIBRARY", "libchip8env.so")
+    lib = ctypes.CDLL(path)
+    lib.chip8_env_create.restype = ctypes.c_void_p
+    lib.chip8_env_create.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.POINTER(Chip8EnvConfig)]
+    lib.chip8_env_destroy.argtypes = [ctypes.c_void_p]
+    lib.chip8_env_error.restype = ctypes.c_char_p
+    lib.chip8_env_count.restype = ctypes.c_uint32
+    lib.chip8_env_count.argtypes = [ctypes.c_void_p]
+    lib.chip8_env_reset.argtypes = [ctypes.c_void_p, ctypes.c_void_p]
+    lib.chip8_env_step.argtypes = [ctypes.c_void_p] + [ctypes.c_void_p] * 5
+    return lib
+
+
+class Chip8VectorEnv:
+    def __init__(self, rom, count, frames_per_action=1, instructions_per_frame=0, max_frames=0, seed=0,
+                 threads=0, reward=(SOURCE_NONE, 0), done=(SOURCE_NONE, 0, 0), database=None, library=None,
+                 pixels=False):
+        self.lib = load_library(library)
+        config = Chip8EnvConfig(count, frames_per_action, instructions_per_frame, max_frames, seed, threads,
+                                reward[0], reward[1], done[0], done[1], done[2])
+        self.handle = self.lib.chip8_env_create(rom.encode(), database.encode() if database else None,
+                                                ctypes.byref(config))
+        if not self.handle:
+            raise RuntimeError(self.lib.chip8_env_error().decode())
+
+        self.count = count
+        self.packed = np.zeros((count, OBSERVATION_WORDS), dtype=np.uint64)
+        self.final = np.zeros((count, OBSERVATION_WORDS), dtype=np.uint64)
+        self.rewards = np.zeros(count, dtype=np.float32)
+        self.flags = np.zeros(count, dtype=np.uint8)
+
+        self.pixels = None
+        if pixels:
+            self.pixels = np.zeros((count, OBSERVATION_WORDS, 64), dtype=np.uint8)
+            # Full sized operands, numpy buffers anything it has to broadcast
+            self.bits = np.zeros((count, OBSERVATION_WORDS, 64), dtype=np.uint64)
+            self.columns = np.ascontiguousarray(np.broadcast_to(np.arange(64, dtype=np.uint64), self.bits.shape))
+
+    def close(self):
+        if self.handle:
+            self.lib.chip8_env_destroy(self.handle)
+            self.handle = None
+
+    def __del__(self):
+        self.close()
+
+    @staticmethod
+    def unpack(packed):
+        """(n, 32) packed words to newly allocated (n, 32, 64) pixels, bit x of a word is column x"""
+        bits = np.unpackbits(packed.view(np.uint8).reshape(packed.shape[0], OBSERVATION_WORDS, 8),
+                             axis=-1, bitorder="little")
+        return bits
+
+    def observations(self):
+        if self.pixels is None:
+            return self.packed
+        np.copyto(self.bits, self.packed[:, :, np.newaxis])
+        np.right_shift(self.bits, self.columns, out=self.bits)
+        np.bitwise_and(self.bits, np.uint64(1), out=self.bits)
+        np.copyto(self.pixels, self.bits, casting="unsafe")
+        return self.pixels
+
+    def reset(self):
+        self.lib.chip8_env_reset(self.handle, self.packed.ctypes.data)
+        return self.observations()
+
+    def step(self, actions):
+        actions = np.ascontiguousarray(actions, dtype=np.uint16)
+        if actions.shape != (self.count,):
+            raise ValueError("expected %d actions" % self.count)
+        self.lib.chip8_env_step(self.handle, actions.ctypes.data, self.packed.ctypes.data,
+                                self.rewards.ctypes.data, self.flags.ctypes.data, self.final.ctypes.data)
+        return self.observations(), self.rewards, self.flags
@@ -0,0 +1,172 @@
+#include "audio.h"
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+AudioStream::AudioStream() {
+    // 10ms queued ahead plus one callback period keeps us well under 20ms
+    TargetLatency = AUDIO_SAMPLE_RATE / 100;
+    Volume = 8000;
+
+    memset(Pattern, 0x00, 16);
+    Phase = 0.0;
+    Pending = 0.0;
+
+    SetBeeper(440.0f);
+}
+
+void AudioStream::SetBeeper(float frequency) {
+    UsePattern = false;
+    Step = frequency / static_cast<double>(AUDIO_SAMPLE_RATE);
+    Phase = 0.0;
+}
+
+void AudioStream::SetPattern(const uint8_t pattern[16], uint8_t pitch) {
+    UsePattern = true;
+    memcpy(Pattern, pattern, 16);
+    Step = 4000.0 * std::pow(2.0, (pitch - 64) / 48.0) / AUDIO_SAMPLE_RATE;
+}
+
+int16_t AudioStream::NextSample(bool active) {
+    if (!active) {
+        Phase = 0.0;
+        return 0;
+    }
+
+    int16_t sample;
+    if (UsePattern) {
+        uint8_t bit = static_cast<uint8_t>(Phase) & 0x7F;
+        sample = (Pattern[bit >> 3] >> (7 - (bit & 0x07))) & 0x01 ? Volume : -Volume;
+        Phase = std::fmod(Phase + Step, 128.0);
+    }
+    else {
+        sample = Phase < 0.5 ? Volume : -Volume;
+        Phase = std::fmod(Phase + Step, 1.0);
+    }
+    return sample;
+}
+
+void AudioStream::Produce(bool active, double seconds) {
+    Pending += seconds * AUDIO_SAMPLE_RATE;
+    size_t count = static_cast<size_t>(Pending);
+    Pending -= count;
+
+    // Never queue more than the latency target, late time is simply dropped
+    size_t queued = Samples.Size();
+    size_t room = queued < TargetLatency ? TargetLatency - queued : 0;
+    if (count > room)
+        count = room;
+
+    int16_t buffer[AUDIO_PERIOD_FRAMES];
+    while (count > 0) {
+        size_t chunk = count < AUDIO_PERIOD_FRAMES ? count : AUDIO_PERIOD_FRAMES;
+        for (size_t i = 0; i < chunk; ++i) {
+            buffer[i] = NextSample(active);
+        }
+        Samples.Push(buffer, chunk);
+        count -= chunk;
+    }
+}
+
+void AudioStream::Fill(int16_t *out, size_t count) {
+    size_t read = Samples.Pop(out, count);
+    memset(out + read, 0x00, sizeof(int16_t) * (count - read));
+}
+
+NullAudioSink::NullAudioSink() : Running(false) {
+}
+
+NullAudioSink::~NullAudioSink() {
+    NullAudioSink::Stop();
+}
+
+void NullAudioSink::Start(AudioStream &stream) {
+    if (Running)
+        return;
+
+    Running = true;
+    Worker = std::thread(&NullAudioSink::Run, this, &stream);
+}
+
+void NullAudioSink::Stop() {
+    Running = false;
+    if (Worker.joinable())
+        Worker.join();
+}
+
+void NullAudioSink::Consume(const int16_t *samples, size_t count) {
+}
+
+void NullAudioSink::Run(AudioStream *stream) {
+    const auto period = std::chrono::microseconds(1000000LL * AUDIO_PERIOD_FRAMES / AUDIO_SAMPLE_RATE);
+    auto deadline = std::chrono::steady_clock::now();
+
+    int16_t buffer[AUDIO_PERIOD_FRAMES];
+    while (Running) {
+        stream->Fill(buffer, AUDIO_PERIOD_FRAMES);
+        Consume(buffer, AUDIO_PERIOD_FRAMES);
+
+        deadline += period;
+        std::this_thread::sleep_until(deadline);
+    }
+}
+
+WavAudioSink::WavAudioSink(const std::string &filename) : Filename(filename), Written(0) {
+}
+
+WavAudioSink::~WavAudioSink() {
+    WavAudioSink::Stop();
+}
+
+void WavAudioSink::Start(AudioStream &stream) {
+    if (Running)
+        return;
+
+    File.open(Filename.c_str(), std::ios::binary | std::ios::trunc);
+    if (!File) {
+        std::cout << "Could not open audio output file " << Filename << std::endl;
+        return;
+    }
+
+    Written = 0;
+    WriteHeader();
+    NullAudioSink::Start(stream);
+}
+
+void WavAudioSink::Stop() {
+    NullAudioSink::Stop();
+
+    if (File.is_open()) {
+        // Patch the sizes now that we know them
+        File.seekp(0);
+        WriteHeader();
+        File.close();
+    }
+}
+
+void WavAudioSink::Consume(const int16_t *samples, size_t count) {
+    File.write(reinterpret_cast<const char *>(samples), sizeof(int16_t) * count);
+    Written += static_cast<uint32_t>(sizeof(int16_t) * count);
+}
+
+static void WriteLE(std::ofstream &file, uint32_t value, int bytes) {
+    for (int i = 0; i < bytes; ++i) {
+        file.put(static_cast<char>((value >> (i * 8)) & 0xFF));
+    }
+}
+
+void WavAudioSink::WriteHeader() {
+    File.write("RIFF", 4);
+    WriteLE(File, 36 + Written, 4);
+    File.write("WAVEfmt ", 8);
+    WriteLE(File, 16, 4);                           // fmt chunk size
+    WriteLE(File, 1, 2);                            // PCM
+    WriteLE(File, 1, 2);                            // Mono
+    WriteLE(File, AUDIO_SAMPLE_RATE, 4);
+    WriteLE(File, AUDIO_SAMPLE_RATE * 2, 4);        // Byte rate
+    WriteLE(File, 2, 2);                            // Block align
+    WriteLE(File, 16, 2);                           // Bits per sample
+    File.write("data", 4);
+    WriteLE(File, Written, 4);
+}
@@ -0,0 +1,91 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <thread>
+
+#include "ring-buffer.h"
+
+#define AUDIO_SAMPLE_RATE 44100
+#define AUDIO_PERIOD_FRAMES 256
+
+// Sample generator fed by the emulation thread and drained by an audio callback.
+// The emulation side never blocks: when the ring is full samples are dropped.
+class AudioStream {
+public:
+    AudioStream();
+
+    // Emulation thread: generate samples covering `seconds` of emulated time
+    void Produce(bool active, double seconds);
+
+    // Callback thread: fill `count` samples, pads with silence on underrun
+    void Fill(int16_t *out, size_t count);
+
+    // XO-CHIP style 128 bit pattern, played at 4000*2^((pitch-64)/48) bits/s
+    void SetPattern(const uint8_t pattern[16], uint8_t pitch);
+    // Plain square wave beeper
+    void SetBeeper(float frequency);
+
+    // Maximum number of samples queued ahead of the callback
+    size_t TargetLatency;
+    int16_t Volume;
+
+private:
+    int16_t NextSample(bool active);
+
+    RingBuffer<int16_t, 4096> Samples;
+
+    bool UsePattern;
+    uint8_t Pattern[16];
+    double Step;
+    double Phase;
+    double Pending;
+};
+
+// Audio backend, pulls periods from a stream on its own thread like a device callback would
+class AudioSink {
+public:
+    virtual ~AudioSink() {}
+
+    virtual void Start(AudioStream &stream) = 0;
+    virtual void Stop() = 0;
+};
+
+// Discards the samples, keeps the stream draining at the real-time rate
+class NullAudioSink : public AudioSink {
+public:
+    NullAudioSink();
+    ~NullAudioSink();
+
+    void Start(AudioStream &stream) override;
+    void Stop() override;
+
+protected:
+    virtual void Consume(const int16_t *samples, size_t count);
+
+    void Run(AudioStream *stream);
+
+    std::atomic<bool> Running;
+    std::thread Worker;
+};
+
+// Writes the samples to a mono 16 bit PCM wave file
+class WavAudioSink : public NullAudioSink {
+public:
+    WavAudioSink(const std::string &filename);
+    ~WavAudioSink();
+
+    void Start(AudioStream &stream) override;
+    void Stop() override;
+
+protected:
+    void Consume(const int16_t *samples, size_t count) override;
+
+private:
+    void WriteHeader();
+
+    std::string Filename;
+    std::ofstream File;
+    uint32_t Written;
+};
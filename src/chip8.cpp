@@ -1,4 +1,5 @@
 #include "chip8.h"
+#include "latency-probe.h"
 #include <cstring>
 #include <iostream>
 #include "mem.h"
@@ -10,69 +11,143 @@ CHIP8::CHIP8() {
     dist = std::uniform_int_distribution<unsigned short>(0, 255);
 
     // Blank the memory
-    memset(memory, 0x00, 4096);
+    memset(memory, 0x00, sizeof(memory));
 
     // Blank the registers
-    memset(V, 0x00, 15);
-    VF = 0x00;
+    memset(V, 0x00, sizeof(V));
     I = 0x0000;
     PC = 0x0000;
     Opcode = 0x0000;
 
-    // Blank the screen
-    memset(screen, false, 64 * 32);
+    memset(Flags, 0x00, sizeof(Flags));
+    memset(Pattern, 0x00, sizeof(Pattern));
+    Pitch = 64;
+    PatternLoaded = false;
 
     // Blank the stack
-    memset(stack, 0x0000, 24);
+    memset(stack, 0x0000, sizeof(stack));
     SP = 0x00;
 
+    Delay = 0x00;
+    Sound = 0x00;
+    Blocked = false;
+    memset(Keys, false, sizeof(Keys));
+
+    CodeGeneration = 0;
+    DirtyPages = 0;
+    ExtendedDirty = false;
+    ScreenDirty = false;
+    SeedPending = false;
+    PendingSeed = 0;
+    Observed = false;
+    Probe = NULL;
+    LockContended = 0;
+    LockWaitNs = 0;
+
+    UsePredecoded = true;
+
+    // Defaults match the original interpreter
+    Quirks.ShiftUsesVY = true;
+    Quirks.LoadStoreIncrementsI = false;
+    Quirks.JumpUsesVX = false;
+    Quirks.Platform = PLATFORM_CHIP8;
+
     // Set clock speed to 20Hz
     ClockSpeed = 0.002f;
     Elapsed = 0.0f;
+
+    Publish();
 }
 
-void CHIP8::Tick(const double delta) {
+uint32_t CHIP8::Tick(const double delta) {
     Elapsed += delta;
 
     if (Elapsed > ClockSpeed) {
         Elapsed = 0.0f;
 
-        Cycle();
+        return Run(1);
     }
+    return 0;
 }
 
 const CHIP8_INFO CHIP8::GetInfo() const {
     CHIP8_INFO info;
 
-    info.VF = this->VF;
     std::copy_n(this->V, 15, info.V);
+    info.VF = this->V[0xF];
 
     info.I = this->I;
     info.PC = this->PC;
 
     info.Opcode = this->Opcode;
 
+    std::copy_n(this->stack, STACK_SIZE, info.Stack);
+    info.SP = this->SP;
+
+    info.Delay = this->Delay;
+    info.Sound = this->Sound;
+    info.Keys = 0;
+    for (int key = 0; key < 16; ++key) {
+        info.Keys |= this->Keys[key] ? 1 << key : 0;
+    }
+    info.Blocked = this->Blocked;
+
     return info;
 }
 
+std::unique_lock<std::mutex> CHIP8::Lock() {
+    std::unique_lock<std::mutex> lock(DataGuard, std::try_to_lock);
+    if (lock.owns_lock())
+        return lock;
+
+    // Only the contended path pays for the clock
+    const auto before = std::chrono::steady_clock::now();
+    lock.lock();
+    LockContended.fetch_add(1, std::memory_order_relaxed);
+    LockWaitNs.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - before).count(),
+                         std::memory_order_relaxed);
+    return lock;
+}
+
+void CHIP8::Seed(uint32_t seed) {
+    mt.seed(seed);
+    dist.reset();
+    SeedPending = false;
+}
+
+void CHIP8::DeferSeed(uint32_t seed) {
+    // Seeding mt19937 costs more than most instruction batches
+    SeedPending = true;
+    PendingSeed = seed;
+}
+
 void CHIP8::Init() {
 
     // Program memory starts at 0x200
     PC = 0x200;
-    memset(V, 0x00, 15);
-    VF = 0x00;
+    memset(V, 0x00, sizeof(V));
     I = 0x0000;
-    memset(screen, false, 64 * 32);
+    screen.Reset();
     Elapsed = 0.0f;
 
     Delay = 0x00;
     Sound = 0x00;
 
     Blocked = false;
+    memset(Pattern, 0x00, sizeof(Pattern));
+    Pitch = 64;
+    PatternLoaded = false;
 
-    SP = 0;
-    memset(stack, 0x0000, sizeof(uint16_t) * 24);
+    Debug.Reason = BREAK_NONE;
+    Debug.Resuming = false;
+    History.Clear();
 
+    // The program may have been swapped underneath us
+    ++CodeGeneration;
+
+    SP = 0;
+    memset(stack, 0x0000, sizeof(stack));
+    Publish();
 
     // Fill the initial part of the memory
     uint16_t ptr = 0x00;
@@ -92,18 +167,76 @@ void CHIP8::Init() {
     memcpy(&memory[ptr += 0x05], &font_D, FONT_SIZE);
     memcpy(&memory[ptr += 0x05], &font_E, FONT_SIZE);
     memcpy(&memory[ptr += 0x05], &font_F, FONT_SIZE);
+    memcpy(&memory[BIG_FONT_START], big_font, sizeof(big_font));
 }
 
 bool CHIP8::Cycle() {
+    Wake();
     if (Blocked)
         return false;
-    // Read the new operation from the program memory
-   Opcode = (memory[PC] << 8) | memory[PC + 1];
 
-   Delay -= Delay != 0x00 ? 0x01 : 0x00;
-   Sound -= Sound != 0x00 ? 0x01 : 0x00;
+    auto guard = Lock();
+
+    // Stop before anything is mutated, a single flag test while disarmed
+    if (Debug.Armed && CheckDebugger())
+        return false;
+
+    if (History.Enabled)
+        History.Record(*this);
+
+    return Execute();
+}
+
+uint32_t CHIP8::Run(uint32_t count) {
+    Wake();
+
+    uint32_t executed = 0;
+    // Translated code assumes 12 bit addresses, XO-CHIP stays on the other engines
+    if (Compiled.Attached() && Quirks.Platform != PLATFORM_XOCHIP) {
+        executed = Compiled.Run(*this, count);
+    }
+    else if (UsePredecoded) {
+        executed = Engine.Run(*this, count);
+    }
+    else if (!Debug.Armed && !History.Enabled) {
+        // No per instruction hooks, take the lock once for the whole batch
+        auto guard = Lock();
+        while (executed < count && !Blocked && Execute()) {
+            ++executed;
+        }
+    }
+    else {
+        while (executed < count && Cycle()) {
+            ++executed;
+        }
+    }
+
+    // Observers only ever see batch boundaries, headless runs skip the copy
+    if (Observed.load(std::memory_order_relaxed))
+        Publish();
+    return executed;
+}
 
-   std::lock_guard<std::mutex> guard(DataGuard);
+void CHIP8::DrawSprite(uint8_t X, uint8_t Y, uint8_t N) {
+    // Latch the position, DFyn must not move while VF is updated
+    const uint8_t left = V[X], top = V[Y];
+    ScreenDirty = true;
+
+    // Dxy0 is a 16x16 sprite from SUPER-CHIP on
+    const bool wide = N == 0 && Quirks.Platform != PLATFORM_CHIP8;
+    const SpriteHits hits = screen.Draw(left, top, memory, I, AddressMask(), wide ? 16 : N, wide);
+    if (Quirks.Platform != PLATFORM_CHIP8)
+        V[0xF] = hits.Any ? 0x01 : 0x00;
+    else if (hits.Drawn)
+        V[0xF] = hits.Last ? 0x01 : 0x00;
+}
+
+bool CHIP8::Execute() {
+    // Read the new operation from the program memory
+   PC &= MEMORY_MASK;
+   Opcode = (memory[PC] << 8) | memory[(PC + 1) & MEMORY_MASK];
+
+   CountDown();
 
     // Decode the opcode
     switch (Opcode & 0xF000) {
@@ -111,14 +244,43 @@ bool CHIP8::Cycle() {
         {
             switch (Opcode & 0x00FF) {
             case 0xE0:
-                memset(screen, false, sizeof(bool) * 32 * 64);
+                screen.Clear();
+                ScreenDirty = true;
                 //std::cout << "Clearing the display" << std::endl;
                 break;
             case 0xEE:
-                PC = stack[SP--];
+                PC = stack[SP];
+                SP = (SP - 1) & STACK_MASK;
                 //printf("Returning from a subroutine to 0x%02x\n", PC);
                 break;
+            case 0xFB:
+            case 0xFC:
+            case 0xFE:
+            case 0xFF:
+                if (Quirks.Platform == PLATFORM_CHIP8)
+                    return false;
+                if ((Opcode & 0x00FF) == 0xFB)
+                    screen.ScrollRight(4);
+                else if ((Opcode & 0x00FF) == 0xFC)
+                    screen.ScrollLeft(4);
+                else
+                    screen.SetHiRes((Opcode & 0x00FF) == 0xFF);
+                ScreenDirty = true;
+                break;
             default:
+                // 00Cn scrolls down n rows, XO-CHIP 00Dn up. Scrolls are in
+                // pixels of the current resolution.
+                if ((Opcode & 0xFFF0) == 0x00C0 && Quirks.Platform != PLATFORM_CHIP8) {
+                    screen.ScrollDown(Opcode & 0x000F);
+                    ScreenDirty = true;
+                    break;
+                }
+                if ((Opcode & 0xFFF0) == 0x00D0 && Quirks.Platform == PLATFORM_XOCHIP) {
+                    screen.ScrollUp(Opcode & 0x000F);
+                    ScreenDirty = true;
+                    break;
+                }
+                // 00FD exits, like anything unknown
                 //printf("Unknown instruction: 0x%02x\n", Opcode);
                 return false;
             }
@@ -138,7 +300,8 @@ bool CHIP8::Cycle() {
             uint16_t dest = Opcode & 0x0FFF;
             //printf("Calling subroutine at 0x%02x\n", dest);
 
-            stack[++SP] = PC;
+            SP = (SP + 1) & STACK_MASK;
+            stack[SP] = PC;
 
             PC = dest;
             break;
@@ -151,7 +314,7 @@ bool CHIP8::Cycle() {
             //printf("Skip if V[%u](0x%02x)=0x%02x\n", X, V[X], N);
 
             if (V[X] == N) {
-                PC += 4;
+                PC += SkipLength();
             }
             else {
                 PC += 2;
@@ -166,7 +329,7 @@ bool CHIP8::Cycle() {
             //printf("Skip if V[%u](0x%02x)!=0x%02x\n", X, V[X], N);
 
             if (V[X] != N) {
-                PC += 4;
+                PC += SkipLength();
             }
             else {
                 PC += 2;
@@ -178,10 +341,32 @@ bool CHIP8::Cycle() {
             uint8_t X = (Opcode & 0x0F00) >> 8;
             uint8_t Y = (Opcode & 0x00F0) >> 4;
 
+            if (Quirks.Platform == PLATFORM_XOCHIP && (Opcode & 0x000F) != 0x0) {
+                // 5xy2 stores VX to VY at I, 5xy3 loads them, either direction, I stays
+                const int step = X <= Y ? 1 : -1;
+                const uint16_t count = (X <= Y ? Y - X : X - Y) + 1;
+                if ((Opcode & 0x000F) == 0x2) {
+                    for (uint16_t i = 0; i < count; ++i) {
+                        memory[(I + i) & XO_MEMORY_MASK] = V[X + i * step];
+                    }
+                    NotifyWrite(I, count);
+                }
+                else if ((Opcode & 0x000F) == 0x3) {
+                    for (uint16_t i = 0; i < count; ++i) {
+                        V[X + i * step] = memory[(I + i) & XO_MEMORY_MASK];
+                    }
+                }
+                else {
+                    return false;
+                }
+                PC += 2;
+                break;
+            }
+
             //printf("Skip if V[%u](0x%02x)=V[%u](0x%02x)\n", X, V[X], Y, V[Y]);
 
             if (V[X] == V[Y]) {
-                PC += 4;
+                PC += SkipLength();
             }
             else {
                 PC += 2;
@@ -234,29 +419,35 @@ bool CHIP8::Cycle() {
             case 0x04:
                 {
                 uint16_t result = V[X] + V[Y];
-                VF = (result & 0xFF00) ? 0x01 : 0x00;
+                V[0xF] = (result & 0xFF00) ? 0x01 : 0x00;
                 V[X] = result & 0x00FF;
                 //printf("V[%u](0x%02x) += V[%u](0x%02x)\n", X, V[X], Y, V[Y]);
                 break;
                 }
             case 0x05:
-                VF = V[Y] > V[X] ? 0x00 : 0x01;
+                V[0xF] = V[Y] > V[X] ? 0x00 : 0x01;
                 V[X] = V[X] - V[Y];
                 //printf("V[%u](0x%02x) -= V[%u](0x%02x)\n", X, V[X], Y, V[Y]);
                 break;
             case 0x06:
-                VF = V[X] & 0x01;
-                V[X] = V[Y] >> 1;
+                V[0xF] = V[X] & 0x01;
+                V[X] = (Quirks.ShiftUsesVY ? V[Y] : V[X]) >> 1;
                 //printf("V[%u](0x%02x) = V[%u](0x%02x) >> 1\n", X, V[X], Y, V[Y]);
                 break;
             case 0x07:
-                VF = V[Y] < V[X] ? 0x00 : 0x01;
+                V[0xF] = V[Y] < V[X] ? 0x00 : 0x01;
                 V[X] = V[Y] - V[X];
                 //printf("V[%u](0x%02x) = V[%u](0x%02x) - V[%u](0x%02x) \n", X, V[X], Y, V[Y], X, V[X]);
                 break;
             case 0x0E:
-                VF = V[Y] & 0x80;
-                V[X] = V[Y] = V[Y] << 1;
+                if (Quirks.ShiftUsesVY) {
+                    V[0xF] = V[Y] & 0x80;
+                    V[X] = V[Y] = V[Y] << 1;
+                }
+                else {
+                    V[0xF] = V[X] & 0x80;
+                    V[X] = V[X] << 1;
+                }
                 //printf("V[%u](0x%02x) = V[%u](0x%02x) = V[%u](0x%02x) << 1\n", X, V[X], Y, V[Y], Y, V[Y]);
                 break;
             default:
@@ -275,7 +466,7 @@ bool CHIP8::Cycle() {
             //printf("Skip if V[%u](0x%02x)!=V[%u](0x%02x)\n", X, V[X], Y, V[Y]);
 
             if (V[X] != V[Y]) {
-                PC += 4;
+                PC += SkipLength();
             }
             else {
                 PC += 2;
@@ -293,7 +484,8 @@ bool CHIP8::Cycle() {
         }
     case 0xB000:
         {
-            PC = V[0] + (Opcode & 0x0FFF);
+            uint8_t X = Quirks.JumpUsesVX ? (Opcode & 0x0F00) >> 8 : 0;
+            PC = V[X] + (Opcode & 0x0FFF);
 
             //printf("Set I to 0x%02x\n", I);
 
@@ -304,7 +496,7 @@ bool CHIP8::Cycle() {
             uint8_t X = (Opcode & 0x0F00) >> 8;
             uint8_t N = Opcode & 0x00FF;
 
-            V[X] = dist(mt) & N;
+            V[X] = Random() & N;
             PC += 2;
             break;
         }
@@ -314,14 +506,7 @@ bool CHIP8::Cycle() {
             uint8_t Y = (Opcode & 0x00F0) >> 4;
             uint8_t N = Opcode & 0x000F;
 
-            for(uint8_t y = 0; y < N; ++y) {
-                for(uint8_t x = 0; x < 8; ++x) {
-                    if (((memory[I + y] << x) & 0x80)) {
-                        VF = screen[V[X] + x][V[Y] + y] ? 0x01 : 0x00;
-                        screen[V[X] + x][V[Y] + y] = !screen[V[X] + x][V[Y] + y];
-                    }
-                 }
-            }
+            DrawSprite(X, Y, N);
 
             PC += 2;
             break;
@@ -331,19 +516,23 @@ bool CHIP8::Cycle() {
         uint8_t X = (Opcode & 0x0F00) >> 8;
         switch (Opcode & 0x00FF) {
         case 0x9E:
-            if (Keys[V[X]]) {
-                PC += 4;
+            if (Probe)
+                Probe->KeyRead(*this, V[X] & 0x0F, Keys[V[X] & 0x0F]);
+            if (Keys[V[X] & 0x0F]) {
+                PC += SkipLength();
             }
             else {
                 PC += 2;
             }
             break;
         case 0xA1:
-            if (Keys[V[X]]) {
+            if (Probe)
+                Probe->KeyRead(*this, V[X] & 0x0F, Keys[V[X] & 0x0F]);
+            if (Keys[V[X] & 0x0F]) {
                 PC += 2;
             }
             else {
-                PC += 4;
+                PC += SkipLength();
             }
             break;
         }
@@ -353,11 +542,43 @@ bool CHIP8::Cycle() {
     {
         uint8_t X = (Opcode & 0x0F00) >> 8;
         switch (Opcode & 0x00FF) {
+        case 0x00:
+            // XO-CHIP F000 nnnn, I takes the next word
+            if (Opcode != 0xF000 || Quirks.Platform != PLATFORM_XOCHIP)
+                return false;
+            I = (memory[(PC + 2) & MEMORY_MASK] << 8) | memory[(PC + 3) & MEMORY_MASK];
+            PC += 2;
+            break;
+        case 0x01:
+            if (Quirks.Platform != PLATFORM_XOCHIP)
+                return false;
+            screen.Planes = X & ((1 << DISPLAY_PLANES) - 1);
+            ScreenDirty = true;
+            break;
+        case 0x02:
+            if (Opcode != 0xF002 || Quirks.Platform != PLATFORM_XOCHIP)
+                return false;
+            for (uint8_t i = 0; i < 16; ++i) {
+                Pattern[i] = memory[(I + i) & XO_MEMORY_MASK];
+            }
+            PatternLoaded = true;
+            break;
         case 0x07:
             V[X] = Delay;
             break;
         case 0x0A:
+            // Without a key held the instruction runs again once there is one
             Blocked = true;
+            for (uint8_t key = 0; key < 16 && Blocked; ++key) {
+                if (Keys[key]) {
+                    V[X] = key;
+                    Blocked = false;
+                    if (Probe)
+                        Probe->KeyRead(*this, key, true);
+                }
+            }
+            if (Blocked)
+                PC -= 2;
             break;
         case 0x15:
             Delay = V[X];
@@ -367,24 +588,66 @@ bool CHIP8::Cycle() {
             break;
         case 0x1E:
             {
+            // XO-CHIP needs all 16 bits of I to index its data
+            if (Quirks.Platform == PLATFORM_XOCHIP) {
+                I += V[X];
+                break;
+            }
             uint16_t result = I + V[X];
-            VF = (result & 0xFF00) ? 0x01 : 0x00;
+            V[0xF] = (result & 0xFF00) ? 0x01 : 0x00;
             I = result & 0x00FF;
             break;
             }
         case 0x29:
             I = V[X] * 5;
             break;
+        case 0x30:
+            if (Quirks.Platform == PLATFORM_CHIP8)
+                return false;
+            I = BIG_FONT_START + (V[X] & 0x0F) * BIG_FONT_SIZE;
+            break;
         case 0x33:
-            memory[I] = V[X] / 100;
-            memory[I+1] = (V[X] / 10) % 10;
-            memory[I+2] = V[X] % 10;
+            {
+            const uint16_t mask = AddressMask();
+            memory[I & mask] = V[X] / 100;
+            memory[(I + 1) & mask] = (V[X] / 10) % 10;
+            memory[(I + 2) & mask] = V[X] % 10;
+            NotifyWrite(I, 3);
+            break;
+            }
+        case 0x3A:
+            if (Quirks.Platform != PLATFORM_XOCHIP)
+                return false;
+            Pitch = V[X];
             break;
         case 0x55:
-            memcpy(&memory[I], &V, sizeof(uint8_t) * (X + 1));
+            {
+            const uint16_t mask = AddressMask();
+            for (uint8_t i = 0; i <= X; ++i) {
+                memory[(I + i) & mask] = V[i];
+            }
+            NotifyWrite(I, X + 1);
+            I += Quirks.LoadStoreIncrementsI ? X + 1 : 0;
             break;
+            }
         case 0x65:
-            memcpy(&V, &memory[I], sizeof(uint8_t) * (X + 1));
+            {
+            const uint16_t mask = AddressMask();
+            for (uint8_t i = 0; i <= X; ++i) {
+                V[i] = memory[(I + i) & mask];
+            }
+            I += Quirks.LoadStoreIncrementsI ? X + 1 : 0;
+            break;
+            }
+        case 0x75:
+            if (Quirks.Platform == PLATFORM_CHIP8)
+                return false;
+            memcpy(Flags, V, X + 1);
+            break;
+        case 0x85:
+            if (Quirks.Platform == PLATFORM_CHIP8)
+                return false;
+            memcpy(V, Flags, X + 1);
             break;
 
         default:
@@ -403,6 +666,97 @@ bool CHIP8::Cycle() {
     return true;
 }
 
+bool CHIP8::StepBack() {
+    auto guard = Lock();
+    const bool undone = History.Undo(*this);
+    Publish();
+    return undone;
+}
+
+size_t CHIP8::ReverseContinue() {
+    auto guard = Lock();
+
+    // Walk back until we sit on a breakpoint or run out of history
+    size_t steps = 0;
+    while (History.Undo(*this)) {
+        ++steps;
+        if (Debug.Armed && Debug.CheckPC(PC, V))
+            break;
+    }
+    Publish();
+    return steps;
+}
+
+bool CHIP8::CheckDebugger() {
+    if (Debug.Resuming) {
+        Debug.Resuming = false;
+        return false;
+    }
+
+    if (Debug.CheckPC(PC, V))
+        return true;
+
+    if (!Debug.WatchArmed)
+        return false;
+
+    // Only the instructions touching memory through I need a closer look
+    const uint16_t opcode = (memory[PC & MEMORY_MASK] << 8) | memory[(PC + 1) & MEMORY_MASK];
+    const uint8_t X = (opcode & 0x0F00) >> 8;
+    const uint8_t Y = (opcode & 0x00F0) >> 4;
+    const uint16_t mask = AddressMask();
+    const uint16_t address = I & mask;
+    if ((opcode & 0xF000) == 0xD000) {
+        // Every selected plane reads its own sprite, Dxy0 is 16x16 past CHIP-8
+        const bool wide = (opcode & 0x000F) == 0 && Quirks.Platform != PLATFORM_CHIP8;
+        const uint16_t rows = wide ? 16 : opcode & 0x000F;
+        uint16_t planes = 0;
+        for (int plane = 0; plane < DISPLAY_PLANES; ++plane) {
+            planes += (screen.Planes >> plane) & 1;
+        }
+        return Debug.CheckRead(address, rows * (wide ? 2 : 1) * planes, mask);
+    }
+    if (Quirks.Platform == PLATFORM_XOCHIP && (opcode & 0xF00E) == 0x5002) {
+        // 5xy2 and 5xy3 store and load VX to VY in either order
+        const uint16_t length = (X <= Y ? Y - X : X - Y) + 1;
+        if ((opcode & 0x000F) == 0x2)
+            return Debug.CheckWrite(address, length, mask);
+        if ((opcode & 0x000F) == 0x3)
+            return Debug.CheckRead(address, length, mask);
+    }
+    if (Quirks.Platform == PLATFORM_XOCHIP && opcode == 0xF002)
+        return Debug.CheckRead(address, 16, mask);
+
+    switch (opcode & 0xF0FF) {
+    case 0xF033:
+        return Debug.CheckWrite(address, 3, mask);
+    case 0xF055:
+        return Debug.CheckWrite(address, X + 1, mask);
+    case 0xF065:
+        return Debug.CheckRead(address, X + 1, mask);
+    }
+    return false;
+}
+
+void CHIP8::NotifyWrite(uint16_t address, uint16_t length) {
+    const uint16_t mask = AddressMask();
+    bool code = false;
+    for (uint16_t i = 0; i < length; ++i) {
+        const uint16_t target = (address + i) & mask;
+        if (target >= MEMORY_SIZE) {
+            // Never code, PC stays below MEMORY_SIZE
+            ExtendedDirty = true;
+            continue;
+        }
+        DirtyPages |= 1 << (target / PAGE_SIZE);
+        code = code || CodeMap[target];
+    }
+    if (code)
+        ++CodeGeneration;
+}
+
 void CHIP8::ClearMemory() {
-    memset(memory, 0x00, 4096);
+    memset(memory, 0x00, sizeof(memory));
+    ++CodeGeneration;
+    DirtyPages = 0xFFFF;
+    ExtendedDirty = true;
 }
\ No newline at end of file
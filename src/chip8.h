@@ -1,10 +1,21 @@
 #pragma once
+#include <bitset>
 #include <cstdint>
 #include <random>
 #include <chrono>
 
+#include <atomic>
 #include <mutex>
 
+#include "debugger.h"
+#include "display.h"
+#include "undo-log.h"
+#include "predecoded-engine.h"
+#include "compiled-engine.h"
+#include "seq-lock.h"
+
+class LatencyProbe;
+
 struct CHIP8_INFO {
     uint8_t V[15];      // Working registers
     uint8_t VF;         // Flag register
@@ -13,6 +24,29 @@ struct CHIP8_INFO {
     uint16_t PC;        // Program counter
 
     uint16_t Opcode;    // Opcode
+
+    uint16_t Stack[STACK_SIZE]; // Return addresses
+    uint8_t SP;         // Stack pointer
+
+    uint8_t Delay;      // Timers
+    uint8_t Sound;
+    uint16_t Keys;      // Bit k is set while key k is held
+    bool Blocked;       // Waiting in Fx0A
+};
+
+// Instruction sets beyond CHIP-8, each includes the ones before it
+enum E_PLATFORM {
+    PLATFORM_CHIP8,
+    PLATFORM_SCHIP,     // 128x64, scrolling, big font, 16x16 sprites, flag registers
+    PLATFORM_XOCHIP     // Bitplanes, 64K through I, audio patterns, register ranges
+};
+
+// Behaviour that differs between interpreters, selected per ROM
+struct CHIP8_QUIRKS {
+    bool ShiftUsesVY;           // 8xy6/8xyE shift VY into VX rather than VX in place
+    bool LoadStoreIncrementsI;  // Fx55/Fx65 leave I past the last register
+    bool JumpUsesVX;            // Bxnn jumps to xnn + VX instead of nnn + V0
+    uint8_t Platform;           // E_PLATFORM, the instructions that exist at all
 };
 
 enum E_KEYS {
@@ -39,11 +73,25 @@ public:
     CHIP8();
 
     std::mutex DataGuard;
+    // Takes DataGuard, counting the times another thread held it
+    std::unique_lock<std::mutex> Lock();
+    std::atomic<uint64_t> LockContended;
+    std::atomic<uint64_t> LockWaitNs;
 
 
-    void Tick(const double delta);
+    // Returns the number of instructions run
+    uint32_t Tick(const double delta);
     void ClearMemory();
+    // Live state, only for the thread running the machine
     const CHIP8_INFO GetInfo() const;
+    // Coherent copy as of the last instruction batch, from any thread without
+    // taking DataGuard. Batches only publish once someone has asked, so
+    // the first call may see state one batch old.
+    CHIP8_INFO Snapshot() const {
+        Observed.store(true, std::memory_order_relaxed);
+        return Published.Load();
+    }
+    uint32_t SnapshotVersion() const { return Published.Version(); }
 
     double Elapsed;
     float ClockSpeed;
@@ -51,32 +99,119 @@ public:
     uint8_t Delay;
     uint8_t Sound;
 
+    // Fx0A found no key held, the machine stops until one is
     bool Blocked;
 
+    Debugger Debug;
+    UndoLog History;
+
+    PredecodedEngine Engine;
+    bool UsePredecoded;
+    // Takes over from both engines while a translated program is attached
+    CompiledEngine Compiled;
+
+    CHIP8_QUIRKS Quirks;
+
     void Init();
+    // Fixed RNG seed so headless runs are reproducible
+    void Seed(uint32_t seed);
+    // Same, but only paid for on the next Cxkk
+    void DeferSeed(uint32_t seed);
+    // One instruction on the interpreter, Snapshot() only follows Run()
     bool Cycle();
-
-    uint8_t memory[4096];
+    // Execute up to `count` instructions on the selected engine
+    uint32_t Run(uint32_t count);
+
+    // Time travel through the undo log
+    bool StepBack();
+    size_t ReverseContinue();
+
+    // Only XO-CHIP reaches past MEMORY_SIZE
+    uint8_t memory[XO_MEMORY_SIZE];
+    // Range of addresses through I
+    uint16_t AddressMask() const { return Quirks.Platform == PLATFORM_XOCHIP ? XO_MEMORY_MASK : MEMORY_MASK; }
+
+    // Bytes known to hold code, writes there bump CodeGeneration
+    std::bitset<MEMORY_SIZE> CodeMap;
+    uint32_t CodeGeneration;
+    void NotifyWrite(uint16_t address, uint16_t length);
+
+    // What the program wrote since the flags were last cleared, one bit per PAGE_SIZE bytes
+    // of the first MEMORY_SIZE, and one for everything above
+    uint16_t DirtyPages;
+    bool ExtendedDirty;
+    bool ScreenDirty;
+
+    // SUPER-CHIP Fx75/Fx85 flag registers
+    uint8_t Flags[16];
+    // XO-CHIP F002/Fx3A, Pattern is 128 one bit samples
+    uint8_t Pattern[16];
+    uint8_t Pitch;
+    bool PatternLoaded;
 
     
     bool Keys[16];
+    // Instrumented mode, told about every keypad read by Ex9E, ExA1 and Fx0A
+    LatencyProbe *Probe;
 
-    bool screen[64][32];
+    Display screen;
 
 private:
-    uint8_t V[15];
-    uint8_t VF;
+    friend class UndoLog;
+    friend class PredecodedEngine;
+    friend class CompiledEngine;
+    friend class VMRunner;
+
+    bool CheckDebugger();
+    bool Execute();
+    void Publish() { Published.Store(GetInfo()); }
+    // Fx0A runs again once any key is held
+    void Wake() {
+        if (!Blocked)
+            return;
+        for (int key = 0; key < 16; ++key) {
+            if (Keys[key]) {
+                Blocked = false;
+                return;
+            }
+        }
+    }
+    void DrawSprite(uint8_t X, uint8_t Y, uint8_t N);
+    // Skips step over the 4 byte F000 nnnn on XO-CHIP
+    uint16_t SkipLength() const {
+        if (Quirks.Platform == PLATFORM_XOCHIP && memory[(PC + 2) & MEMORY_MASK] == 0xF0 &&
+            memory[(PC + 3) & MEMORY_MASK] == 0x00)
+            return 6;
+        return 4;
+    }
+    uint8_t Random() {
+        if (SeedPending)
+            Seed(PendingSeed);
+        return static_cast<uint8_t>(dist(mt));
+    }
+
+    void CountDown() {
+        Delay -= Delay != 0x00 ? 0x01 : 0x00;
+        Sound -= Sound != 0x00 ? 0x01 : 0x00;
+    }
+
+    uint8_t V[16];      // VF is V[0xF]
 
     uint16_t I;
     uint16_t PC;
 
     uint16_t Opcode;
 
-    uint16_t stack[24];
+    uint16_t stack[STACK_SIZE];
     uint8_t SP;
 
     // Setup for the random number generator
     std::random_device rd;
     std::mt19937 mt;
     std::uniform_int_distribution<unsigned short> dist;
+    bool SeedPending;
+    uint32_t PendingSeed;
+
+    SeqLock<CHIP8_INFO> Published;
+    mutable std::atomic<bool> Observed;
 };
\ No newline at end of file
@@ -0,0 +1,146 @@
+#include "compiled-engine.h"
+#include "chip8.h"
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+CompiledEngine::CompiledEngine() {
+    Program = NULL;
+    CompiledInstructions = 0;
+    InterpretedInstructions = 0;
+    Generation = 0;
+    Validated = false;
+}
+
+bool CompiledEngine::Attach(const CompiledProgram *program) {
+    if (program && program->Version != COMPILED_ABI_VERSION) {
+        Error = "Compiled program was generated for a different engine version";
+        return false;
+    }
+    Program = program;
+    Live.assign(program ? program->BlockCount : 0, 0);
+    Validated = false;
+    if (!program)
+        Library.reset();
+    return true;
+}
+
+bool CompiledEngine::Load(const std::string &filename) {
+#ifdef _WIN32
+    HMODULE module = LoadLibraryA(filename.c_str());
+    if (!module) {
+        Error = "Could not load " + filename;
+        return false;
+    }
+    std::shared_ptr<void> library(module, [](void *handle) { FreeLibrary(static_cast<HMODULE>(handle)); });
+    auto entry = reinterpret_cast<CompiledProgramFn>(GetProcAddress(module, COMPILED_PROGRAM_SYMBOL));
+#else
+    void *handle = dlopen(filename.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (!handle) {
+        Error = "Could not load " + filename + ": " + dlerror();
+        return false;
+    }
+    std::shared_ptr<void> library(handle, [](void *handle) { dlclose(handle); });
+    auto entry = reinterpret_cast<CompiledProgramFn>(dlsym(handle, COMPILED_PROGRAM_SYMBOL));
+#endif
+    if (!entry) {
+        Error = filename + " does not export " COMPILED_PROGRAM_SYMBOL;
+        return false;
+    }
+    if (!Attach(entry()))
+        return false;
+    Library = library;
+    return true;
+}
+
+void CompiledEngine::Validate(CHIP8 &chp) {
+    // A block stays live only while memory still holds the bytes it was built from
+    for (uint16_t i = 0; i < Program->BlockCount; ++i) {
+        const CompiledBlock &block = Program->Blocks[i];
+        const uint16_t offset = block.Start - PROGRAM_START;
+        Live[i] = memcmp(&chp.memory[block.Start], &Program->Image[offset], block.End - block.Start) == 0;
+
+        // Writes over compiled code have to bump CodeGeneration
+        for (uint16_t address = block.Start; address < block.End; ++address) {
+            chp.CodeMap.set(address);
+        }
+    }
+    Generation = chp.CodeGeneration;
+    Validated = true;
+}
+
+void CompiledEngine::Draw(CHIP8 &chp, uint8_t X, uint8_t Y, uint8_t N) {
+    chp.DrawSprite(X, Y, N);
+}
+
+void CompiledEngine::Clear(CHIP8 &chp) {
+    chp.screen.Clear();
+    chp.ScreenDirty = true;
+}
+
+uint8_t CompiledEngine::Random(CHIP8 &chp) {
+    return chp.Random();
+}
+
+void CompiledEngine::NotifyWrite(CHIP8 &chp, uint16_t address, uint16_t length) {
+    chp.NotifyWrite(address, length);
+}
+
+uint32_t CompiledEngine::Run(CHIP8 &chp, uint32_t budget) {
+    // Translated blocks have no per instruction hooks, the predecoded engine
+    // checks breakpoints and records history without leaving its fast path
+    if (chp.Debug.Armed || chp.History.Enabled)
+        return chp.Engine.Run(chp, budget);
+
+    if (chp.Blocked)
+        return 0;
+
+    auto guard = chp.Lock();
+
+    CompiledContext ctx;
+    ctx.V = chp.V;
+    ctx.I = &chp.I;
+    ctx.PC = &chp.PC;
+    ctx.SP = &chp.SP;
+    ctx.Stack = chp.stack;
+    ctx.Memory = chp.memory;
+    ctx.Delay = &chp.Delay;
+    ctx.Sound = &chp.Sound;
+    ctx.Keys = chp.Keys;
+    ctx.ShiftUsesVY = chp.Quirks.ShiftUsesVY;
+    ctx.LoadStoreIncrementsI = chp.Quirks.LoadStoreIncrementsI;
+    ctx.CodeGeneration = &chp.CodeGeneration;
+    ctx.Chip = &chp;
+    ctx.Draw = &CompiledEngine::Draw;
+    ctx.Clear = &CompiledEngine::Clear;
+    ctx.Random = &CompiledEngine::Random;
+    ctx.NotifyWrite = &CompiledEngine::NotifyWrite;
+
+    uint32_t executed = 0;
+    while (executed < budget && !chp.Blocked) {
+        if (!Validated || Generation != chp.CodeGeneration)
+            Validate(chp);
+        ctx.Live = Live.data();
+        ctx.Generation = Generation;
+
+        const uint32_t ran = Program->Run(ctx, budget - executed);
+        CompiledInstructions += ran;
+        executed += ran;
+        if (executed >= budget)
+            break;
+
+        // Whatever the compiled code stopped at goes through the interpreter
+        if (!chp.Execute())
+            break;
+        ++executed;
+        ++InterpretedInstructions;
+    }
+
+    // The next opcode to run, the last one is not tracked in compiled code
+    chp.Opcode = (chp.memory[chp.PC & MEMORY_MASK] << 8) | chp.memory[(chp.PC + 1) & MEMORY_MASK];
+    return executed;
+}
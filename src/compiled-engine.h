@@ -0,0 +1,112 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "mem.h"
+
+class CHIP8;
+
+// Bumped whenever generated code would no longer match this header
+#define COMPILED_ABI_VERSION 2
+
+// What generated code sees of a machine. The engine points it at the core
+// before every call, so the generated module needs no core symbols at all.
+struct CompiledContext {
+    uint8_t *V;
+    uint16_t *I;
+    uint16_t *PC;
+    uint8_t *SP;
+    uint16_t *Stack;
+    uint8_t *Memory;
+    uint8_t *Delay;
+    uint8_t *Sound;
+    const bool *Keys;
+
+    bool ShiftUsesVY;
+    bool LoadStoreIncrementsI;
+
+    const uint8_t *Live;        // Per block, 0 once its bytes were overwritten
+    const uint32_t *CodeGeneration;
+    uint32_t Generation;        // CodeGeneration when the call started
+
+    CHIP8 *Chip;
+    void (*Draw)(CHIP8 &chp, uint8_t X, uint8_t Y, uint8_t N);
+    void (*Clear)(CHIP8 &chp);
+    uint8_t (*Random)(CHIP8 &chp);
+    void (*NotifyWrite)(CHIP8 &chp, uint16_t address, uint16_t length);
+};
+
+// Timers tick once per instruction, generated code batches them up until
+// something reads or writes a timer
+inline void CompiledCountDown(CompiledContext &ctx, uint32_t count) {
+    *ctx.Delay = *ctx.Delay > count ? *ctx.Delay - count : 0;
+    *ctx.Sound = *ctx.Sound > count ? *ctx.Sound - count : 0;
+}
+
+struct CompiledBlock {
+    uint16_t Start;
+    uint16_t End;               // One past the last instruction byte
+};
+
+// Emitted by chip8-translate for one ROM
+struct CompiledProgram {
+    uint32_t Version;           // COMPILED_ABI_VERSION of the generator
+    uint64_t Hash;              // HashProgram of the ROM
+    const uint8_t *Image;       // ROM bytes as loaded at PROGRAM_START
+    uint16_t ImageSize;
+    const CompiledBlock *Blocks;
+    uint16_t BlockCount;
+
+    // Runs compiled blocks from *ctx.PC until the next block does not fit in
+    // `budget`, or execution reaches something only the interpreter handles
+    uint32_t (*Run)(CompiledContext &ctx, uint32_t budget);
+};
+
+// Symbol a shared object built from chip8-translate output exports
+#define COMPILED_PROGRAM_SYMBOL "chip8_compiled_program"
+#ifdef _WIN32
+#define COMPILED_EXPORT __declspec(dllexport)
+#else
+#define COMPILED_EXPORT __attribute__((visibility("default")))
+#endif
+typedef const CompiledProgram *(*CompiledProgramFn)();
+
+// Runs ahead-of-time translated code where the loaded bytes still match
+// what was translated, and the reference interpreter everywhere else:
+// computed jumps, Fx0A, code outside the recovered control flow, and blocks
+// the program has since written over.
+class CompiledEngine {
+public:
+    CompiledEngine();
+
+    // NULL detaches, the core goes back to the other engines
+    bool Attach(const CompiledProgram *program);
+    // Attach the program exported by a shared object
+    bool Load(const std::string &filename);
+    bool Attached() const { return Program != NULL; }
+
+    // Execute up to `budget` instructions, returns how many actually ran
+    uint32_t Run(CHIP8 &chp, uint32_t budget);
+
+    const CompiledProgram *Program;
+    std::string Error;
+
+    uint64_t CompiledInstructions;
+    uint64_t InterpretedInstructions;
+
+private:
+    void Validate(CHIP8 &chp);
+
+    static void Draw(CHIP8 &chp, uint8_t X, uint8_t Y, uint8_t N);
+    static void Clear(CHIP8 &chp);
+    static uint8_t Random(CHIP8 &chp);
+    static void NotifyWrite(CHIP8 &chp, uint16_t address, uint16_t length);
+
+    std::vector<uint8_t> Live;
+    uint32_t Generation;
+    bool Validated;
+
+    std::shared_ptr<void> Library;
+};
@@ -0,0 +1,152 @@
+#include "debugger.h"
+#include <algorithm>
+
+Debugger::Debugger() {
+    ClearAll();
+}
+
+void Debugger::SetBreakpoint(uint16_t address) {
+    address %= MEMORY_SIZE;
+    if (!Unconditional[address]) {
+        Unconditional.set(address);
+        Breakpoints.push_back(address);
+        std::sort(Breakpoints.begin(), Breakpoints.end());
+    }
+    UpdateArmed();
+}
+
+void Debugger::ClearBreakpoint(uint16_t address) {
+    address %= MEMORY_SIZE;
+    Unconditional.reset(address);
+    Breakpoints.erase(std::remove(Breakpoints.begin(), Breakpoints.end(), address), Breakpoints.end());
+    UpdateArmed();
+}
+
+bool Debugger::HasBreakpoint(uint16_t address) const {
+    return Unconditional[address % MEMORY_SIZE];
+}
+
+void Debugger::AddCondition(const BreakCondition &condition) {
+    BreakCondition added = condition;
+    added.Address %= MEMORY_SIZE;
+    added.Register &= 0x0F;
+    Conditions.push_back(added);
+    UpdateArmed();
+}
+
+void Debugger::RemoveCondition(size_t index) {
+    if (index < Conditions.size()) {
+        Conditions.erase(Conditions.begin() + index);
+    }
+    UpdateArmed();
+}
+
+void Debugger::SetWatch(uint16_t address, uint16_t length, bool read, bool write) {
+    for (uint16_t i = 0; i < length; ++i) {
+        uint16_t addr = (address + i) % MEMORY_SIZE;
+        ReadWatch[addr] = read;
+        WriteWatch[addr] = write;
+    }
+    UpdateArmed();
+}
+
+void Debugger::ClearWatch(uint16_t address, uint16_t length) {
+    SetWatch(address, length, false, false);
+}
+
+void Debugger::ClearAll() {
+    Breakpoints.clear();
+    Conditions.clear();
+    Unconditional.reset();
+    ReadWatch.reset();
+    WriteWatch.reset();
+
+    Resuming = false;
+    Reason = BREAK_NONE;
+    HitAddress = 0x0000;
+
+    UpdateArmed();
+}
+
+void Debugger::UpdateArmed() {
+    PCMask = Unconditional;
+    for (const auto &condition : Conditions) {
+        PCMask.set(condition.Address);
+    }
+
+    WatchArmed = ReadWatch.any() || WriteWatch.any();
+    Armed = PCMask.any() || WatchArmed;
+}
+
+void Debugger::Resume() {
+    Reason = BREAK_NONE;
+    Resuming = true;
+}
+
+bool Debugger::CheckPC(uint16_t pc, const uint8_t *V) {
+    pc %= MEMORY_SIZE;
+    if (!PCMask[pc])
+        return false;
+
+    if (Unconditional[pc]) {
+        Reason = BREAK_PC;
+        HitAddress = pc;
+        return true;
+    }
+
+    for (const auto &condition : Conditions) {
+        if (condition.Address != pc)
+            continue;
+
+        uint8_t value = V[condition.Register & 0x0F];
+        bool hit = false;
+        switch (condition.Compare) {
+        case COMPARE_EQ:
+            hit = value == condition.Value;
+            break;
+        case COMPARE_NE:
+            hit = value != condition.Value;
+            break;
+        case COMPARE_LT:
+            hit = value < condition.Value;
+            break;
+        case COMPARE_GT:
+            hit = value > condition.Value;
+            break;
+        }
+
+        if (hit) {
+            Reason = BREAK_CONDITION;
+            HitAddress = pc;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Debugger::CheckRange(const std::bitset<MEMORY_SIZE> &watch, uint16_t address, uint16_t length, uint16_t mask) const {
+    for (uint16_t i = 0; i < length; ++i) {
+        const uint16_t target = (address + i) & mask;
+        if (target < MEMORY_SIZE && watch[target])
+            return true;
+    }
+    return false;
+}
+
+bool Debugger::CheckRead(uint16_t address, uint16_t length, uint16_t mask) {
+    if (!CheckRange(ReadWatch, address, length, mask))
+        return false;
+
+    Reason = BREAK_READ;
+    HitAddress = address;
+    return true;
+}
+
+bool Debugger::CheckWrite(uint16_t address, uint16_t length, uint16_t mask) {
+    if (!CheckRange(WriteWatch, address, length, mask))
+        return false;
+
+    Reason = BREAK_WRITE;
+    HitAddress = address;
+    return true;
+}
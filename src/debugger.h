@@ -0,0 +1,80 @@
+#pragma once
+#include <bitset>
+#include <cstdint>
+#include <vector>
+
+#include "mem.h"
+
+enum E_BREAK {
+    BREAK_NONE,
+    BREAK_PC,
+    BREAK_CONDITION,
+    BREAK_READ,
+    BREAK_WRITE
+};
+
+enum E_COMPARE {
+    COMPARE_EQ,
+    COMPARE_NE,
+    COMPARE_LT,
+    COMPARE_GT
+};
+
+struct BreakCondition {
+    uint16_t Address;   // PC the condition is attached to
+    uint8_t Register;   // V register index, 0xF is VF
+    E_COMPARE Compare;
+    uint8_t Value;
+};
+
+// Breakpoints and watchpoints are kept as one bit per memory address so the
+// interpreter only pays for a bit test, and nothing at all while disarmed.
+class Debugger {
+public:
+    Debugger();
+
+    void SetBreakpoint(uint16_t address);
+    void ClearBreakpoint(uint16_t address);
+    bool HasBreakpoint(uint16_t address) const;
+
+    void AddCondition(const BreakCondition &condition);
+    void RemoveCondition(size_t index);
+
+    void SetWatch(uint16_t address, uint16_t length, bool read, bool write);
+    void ClearWatch(uint16_t address, uint16_t length);
+
+    void ClearAll();
+
+    // Called by the interpreter before executing the instruction at `pc`
+    bool CheckPC(uint16_t pc, const uint8_t *V);
+    // A single bit test, for engines deciding whether `pc` needs CheckPC at all
+    bool Stops(uint16_t pc) const { return PCMask[pc & MEMORY_MASK]; }
+    // Accesses wrap with `mask`, XO-CHIP memory past MEMORY_SIZE is never watched
+    bool CheckRead(uint16_t address, uint16_t length, uint16_t mask);
+    bool CheckWrite(uint16_t address, uint16_t length, uint16_t mask);
+
+    // Let the next instruction run without checks, used to continue from a hit
+    void Resume();
+
+    // Fast path flags, true as soon as anything is set
+    bool Armed;
+    bool WatchArmed;
+    bool Resuming;
+
+    E_BREAK Reason;
+    uint16_t HitAddress;
+
+    std::vector<uint16_t> Breakpoints;
+    std::vector<BreakCondition> Conditions;
+
+    std::bitset<MEMORY_SIZE> ReadWatch;
+    std::bitset<MEMORY_SIZE> WriteWatch;
+
+private:
+    void UpdateArmed();
+    bool CheckRange(const std::bitset<MEMORY_SIZE> &watch, uint16_t address, uint16_t length, uint16_t mask) const;
+
+    // Set for every address with a breakpoint or a condition attached
+    std::bitset<MEMORY_SIZE> PCMask;
+    std::bitset<MEMORY_SIZE> Unconditional;
+};
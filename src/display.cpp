@@ -0,0 +1,158 @@
+#include "display.h"
+#include <cstring>
+
+// Sprite bytes have their leftmost pixel in the top bit, rows the other way round
+struct ReversedBytes {
+    uint8_t Values[256];
+    ReversedBytes() {
+        for (int byte = 0; byte < 256; ++byte) {
+            uint8_t reversed = 0;
+            for (int bit = 0; bit < 8; ++bit) {
+                reversed |= ((byte >> bit) & 1) << (7 - bit);
+            }
+            Values[byte] = reversed;
+        }
+    }
+};
+static const ReversedBytes Reversed;
+
+void Display::Reset() {
+    memset(Rows, 0, sizeof(Rows));
+    HiRes = false;
+    Planes = 0x01;
+}
+
+void Display::SetHiRes(bool hires) {
+    memset(Rows, 0, sizeof(Rows));
+    HiRes = hires;
+}
+
+void Display::Clear() {
+    for (int plane = 0; plane < DISPLAY_PLANES; ++plane) {
+        if (Planes & (1 << plane))
+            memset(Rows[plane], 0, Size() * sizeof(uint64_t));
+    }
+}
+
+void Display::ScrollDown(int rows) {
+    const int height = Height(), words = Words();
+    rows = rows < height ? rows : height;
+    for (int plane = 0; plane < DISPLAY_PLANES; ++plane) {
+        if (!(Planes & (1 << plane)))
+            continue;
+        memmove(Rows[plane] + rows * words, Rows[plane], (height - rows) * words * sizeof(uint64_t));
+        memset(Rows[plane], 0, rows * words * sizeof(uint64_t));
+    }
+}
+
+void Display::ScrollUp(int rows) {
+    const int height = Height(), words = Words();
+    rows = rows < height ? rows : height;
+    for (int plane = 0; plane < DISPLAY_PLANES; ++plane) {
+        if (!(Planes & (1 << plane)))
+            continue;
+        memmove(Rows[plane], Rows[plane] + rows * words, (height - rows) * words * sizeof(uint64_t));
+        memset(Rows[plane] + (height - rows) * words, 0, rows * words * sizeof(uint64_t));
+    }
+}
+
+// Pixel x moves to x + pixels, bits carry from one word into the next
+void Display::ScrollRight(int pixels) {
+    const int height = Height(), words = Words();
+    for (int plane = 0; plane < DISPLAY_PLANES; ++plane) {
+        if (!(Planes & (1 << plane)))
+            continue;
+        for (uint64_t *row = Rows[plane]; row < Rows[plane] + height * words; row += words) {
+            for (int w = words - 1; w > 0; --w) {
+                row[w] = (row[w] << pixels) | (row[w - 1] >> (64 - pixels));
+            }
+            row[0] <<= pixels;
+        }
+    }
+}
+
+void Display::ScrollLeft(int pixels) {
+    const int height = Height(), words = Words();
+    for (int plane = 0; plane < DISPLAY_PLANES; ++plane) {
+        if (!(Planes & (1 << plane)))
+            continue;
+        for (uint64_t *row = Rows[plane]; row < Rows[plane] + height * words; row += words) {
+            for (int w = 0; w < words - 1; ++w) {
+                row[w] = (row[w] >> pixels) | (row[w + 1] << (64 - pixels));
+            }
+            row[words - 1] >>= pixels;
+        }
+    }
+}
+
+SpriteHits Display::Draw(int x, int y, const uint8_t *memory, uint16_t address, uint16_t mask, int rows, bool wide) {
+    const int width = Width(), height = Height(), words = Words();
+    const int span = wide ? 16 : 8;
+    x &= width - 1;
+    y &= height - 1;
+    const int word = x >> 6, shift = x & 63;
+
+    SpriteHits hits = { false, false, false };
+    for (int plane = 0; plane < DISPLAY_PLANES; ++plane) {
+        if (!(Planes & (1 << plane)))
+            continue;
+        for (int row = 0; row < rows; ++row) {
+            // Bit i of line is pixel x + i
+            uint64_t line = Reversed.Values[memory[address & mask]];
+            if (wide)
+                line |= static_cast<uint64_t>(Reversed.Values[memory[(address + 1) & mask]]) << 8;
+            address += wide ? 2 : 1;
+            if (!line)
+                continue;
+
+            uint64_t *out = Rows[plane] + ((y + row) & (height - 1)) * words;
+
+            // The rightmost sprite pixel is drawn last
+            int top = span - 1;
+            while (!(line >> top)) {
+                --top;
+            }
+            const int last = (x + top) & (width - 1);
+            hits.Last = (out[last >> 6] >> (last & 63)) & 1;
+            hits.Drawn = true;
+
+            const uint64_t low = line << shift;
+            hits.Any |= (out[word] & low) != 0;
+            out[word] ^= low;
+            if (shift > 64 - span) {
+                // Spills into the next word, or wraps back to the left edge
+                const uint64_t high = line >> (64 - shift);
+                uint64_t &next = out[(word + 1) & (words - 1)];
+                hits.Any |= (next & high) != 0;
+                next ^= high;
+            }
+        }
+    }
+    return hits;
+}
+
+bool Display::Same(const Display &other) const {
+    return HiRes == other.HiRes && Planes == other.Planes && memcmp(Rows, other.Rows, sizeof(Rows)) == 0;
+}
+
+uint64_t Display::Hash() const {
+    uint64_t hash = 0x9e3779b97f4a7c15ULL;
+    for (int i = 0; i < Size(); ++i) {
+        hash = (hash ^ Rows[0][i]) * 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 32;
+    }
+
+    bool extra = HiRes;
+    for (int i = 0; i < Size() && !extra; ++i) {
+        extra = Rows[1][i] != 0;
+    }
+    if (!extra)
+        return hash;
+
+    hash = (hash ^ (HiRes ? 2 : 1)) * 0xff51afd7ed558ccdULL;
+    for (int i = 0; i < Size(); ++i) {
+        hash = (hash ^ Rows[1][i]) * 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 32;
+    }
+    return hash;
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <cstdint>
+
+#include "mem.h"
+
+// What a sprite draw ran into. CHIP-8 only keeps the collision of the last
+// sprite pixel drawn, SUPER-CHIP and XO-CHIP report any collision.
+struct SpriteHits {
+    bool Drawn;     // At least one sprite pixel was set
+    bool Any;
+    bool Last;
+};
+
+// Packed bitplanes, one bit per pixel in the PackedFrame layout: bit x % 64
+// of word x / 64 of a row is pixel x. Rows are Words() long, so the active
+// part of a plane is always its first Height() * Words() words and a
+// low resolution plane is exactly a 64x32 PackedFrame. Drawing and
+// scrolling work on whole words, 64 pixels at a time.
+struct Display {
+    uint64_t Rows[DISPLAY_PLANES][HIRES_HEIGHT * HIRES_WIDTH / 64];
+    bool HiRes;
+    uint8_t Planes;     // XO-CHIP Fn01, bit p selects plane p for drawing, clearing and scrolling
+
+    Display() { Reset(); }
+
+    int Width() const { return HiRes ? HIRES_WIDTH : SCREEN_WIDTH; }
+    int Height() const { return HiRes ? HIRES_HEIGHT : SCREEN_HEIGHT; }
+    int Words() const { return HiRes ? HIRES_WIDTH / 64 : 1; }
+    // Active words of one plane
+    int Size() const { return Height() * Words(); }
+
+    bool Pixel(int x, int y, int plane = 0) const {
+        x &= Width() - 1;
+        y &= Height() - 1;
+        return (Rows[plane][y * Words() + (x >> 6)] >> (x & 63)) & 1;
+    }
+    // Index into an XO-CHIP palette, bit p set when plane p is lit
+    uint8_t Colour(int x, int y) const { return Pixel(x, y, 0) | (Pixel(x, y, 1) << 1); }
+
+    // Low resolution, plane 0 selected, everything blank
+    void Reset();
+    // Switching resolution blanks every plane
+    void SetHiRes(bool hires);
+    // Selected planes only, same for the scrolls. Horizontal scrolls take
+    // 1 to 63 pixels.
+    void Clear();
+    void ScrollDown(int rows);
+    void ScrollUp(int rows);
+    void ScrollRight(int pixels);
+    void ScrollLeft(int pixels);
+
+    // XORs `rows` rows of an 8 pixel wide sprite, or 16 pixels if `wide`,
+    // into every selected plane. Each plane takes the next rows of sprite
+    // data from memory. Sprites wrap around the edges.
+    SpriteHits Draw(int x, int y, const uint8_t *memory, uint16_t address, uint16_t mask, int rows, bool wide);
+
+    // Same contents, ignoring padding
+    bool Same(const Display &other) const;
+    // Equals PackedFrame::Hash for a plain low resolution screen, so
+    // hashes taken before there were other modes still match
+    uint64_t Hash() const;
+};
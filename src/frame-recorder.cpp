@@ -0,0 +1,494 @@
+#include "frame-recorder.h"
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+#define FRAME_BYTES (VIDEO_HEIGHT * 8)
+
+// Every other bit of x, lit if either of a pixel pair was
+static uint64_t Halve(uint64_t x) {
+    x = (x | (x >> 1)) & 0x5555555555555555ULL;
+    x = (x | (x >> 1)) & 0x3333333333333333ULL;
+    x = (x | (x >> 2)) & 0x0F0F0F0F0F0F0F0FULL;
+    x = (x | (x >> 4)) & 0x00FF00FF00FF00FFULL;
+    x = (x | (x >> 8)) & 0x0000FFFF0000FFFFULL;
+    x = (x | (x >> 16)) & 0x00000000FFFFFFFFULL;
+    return x;
+}
+
+void PackedFrame::Pack(const Display &screen) {
+    if (!screen.HiRes) {
+        for (int y = 0; y < VIDEO_HEIGHT; ++y) {
+            Rows[y] = screen.Rows[0][y] | screen.Rows[1][y];
+        }
+        return;
+    }
+
+    for (int y = 0; y < VIDEO_HEIGHT; ++y) {
+        uint64_t left = 0, right = 0;
+        for (int plane = 0; plane < DISPLAY_PLANES; ++plane) {
+            const uint64_t *pair = &screen.Rows[plane][y * 4];
+            left |= pair[0] | pair[2];
+            right |= pair[1] | pair[3];
+        }
+        Rows[y] = Halve(left) | (Halve(right) << 32);
+    }
+}
+
+uint64_t PackedFrame::Hash() const {
+    // Cheap word-wise mix, only used to spot unchanged frames
+    uint64_t hash = 0x9e3779b97f4a7c15ULL;
+    for (int y = 0; y < VIDEO_HEIGHT; ++y) {
+        hash = (hash ^ Rows[y]) * 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 32;
+    }
+    return hash;
+}
+
+static void ToBytes(const PackedFrame &frame, uint8_t *bytes) {
+    for (int y = 0; y < VIDEO_HEIGHT; ++y) {
+        for (int i = 0; i < 8; ++i) {
+            bytes[y * 8 + i] = static_cast<uint8_t>(frame.Rows[y] >> (i * 8));
+        }
+    }
+}
+
+static void FromBytes(const uint8_t *bytes, PackedFrame &frame) {
+    for (int y = 0; y < VIDEO_HEIGHT; ++y) {
+        uint64_t row = 0;
+        for (int i = 0; i < 8; ++i) {
+            row |= static_cast<uint64_t>(bytes[y * 8 + i]) << (i * 8);
+        }
+        frame.Rows[y] = row;
+    }
+}
+
+static void PutVarint(std::vector<uint8_t> &out, uint32_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+static bool GetVarint(std::istream &in, uint32_t &value) {
+    value = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        int byte = in.get();
+        if (byte == EOF)
+            return false;
+        value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+FrameRecorder::FrameRecorder() : Frames(0), Written(0), Dropped(0), Running(false), LastHash(0), HaveLast(false), PreviousIndex(0) {
+}
+
+FrameRecorder::~FrameRecorder() {
+    Stop();
+}
+
+bool FrameRecorder::Start(const std::string &filename) {
+    Stop();
+
+    File.open(filename.c_str(), std::ios::binary | std::ios::trunc);
+    if (!File) {
+        std::cout << "Could not open video file " << filename << std::endl;
+        return false;
+    }
+    const uint8_t header[8] = { 'C', '8', 'V', '1', VIDEO_WIDTH, VIDEO_HEIGHT, VIDEO_FPS, 0 };
+    File.write(reinterpret_cast<const char *>(header), sizeof(header));
+
+    Frames = 0;
+    Written = 0;
+    Dropped = 0;
+    HaveLast = false;
+    memset(&Previous, 0, sizeof(Previous));
+    PreviousIndex = 0;
+    Queue.Clear();
+
+    Running = true;
+    Worker = std::thread(&FrameRecorder::Run, this);
+    return true;
+}
+
+void FrameRecorder::Stop() {
+    if (!Running)
+        return;
+
+    Running = false;
+    if (Worker.joinable())
+        Worker.join();
+
+    // End record, carries how long the last frame stayed on screen
+    Record.clear();
+    PutVarint(Record, Frames - PreviousIndex);
+    PutVarint(Record, 0);
+    File.write(reinterpret_cast<const char *>(Record.data()), Record.size());
+    File.close();
+}
+
+void FrameRecorder::Capture(const Display &screen) {
+    if (!Running)
+        return;
+
+    PackedFrame frame;
+    frame.Pack(screen);
+    frame.Index = Frames++;
+
+    const uint64_t hash = frame.Hash();
+    if (HaveLast && hash == LastHash)
+        return;
+
+    // A full queue costs a frame rather than stalling emulation. The hash is
+    // left alone so the next frame is pushed even if it matches this one.
+    if (!Queue.Push(frame)) {
+        ++Dropped;
+        return;
+    }
+    LastHash = hash;
+    HaveLast = true;
+}
+
+void FrameRecorder::Run() {
+    PackedFrame batch[32];
+    while (true) {
+        const bool running = Running;
+        size_t count = Queue.Pop(batch, 32);
+        for (size_t i = 0; i < count; ++i) {
+            Write(batch[i]);
+        }
+
+        if (count == 0) {
+            // Drained after Stop, nothing more can arrive
+            if (!running)
+                break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+    }
+    File.flush();
+}
+
+void FrameRecorder::Write(const PackedFrame &frame) {
+    uint8_t current[FRAME_BYTES], previous[FRAME_BYTES], delta[FRAME_BYTES];
+    ToBytes(frame, current);
+    ToBytes(Previous, previous);
+    for (int i = 0; i < FRAME_BYTES; ++i) {
+        delta[i] = current[i] ^ previous[i];
+    }
+
+    // Runs of unchanged bytes, then literals until at least two unchanged bytes follow
+    std::vector<uint8_t> payload;
+    int i = 0;
+    while (i < FRAME_BYTES) {
+        int zeros = 0;
+        while (i + zeros < FRAME_BYTES && delta[i + zeros] == 0) {
+            ++zeros;
+        }
+        i += zeros;
+
+        int literals = 0;
+        while (i + literals < FRAME_BYTES && (delta[i + literals] != 0 ||
+               (i + literals + 1 < FRAME_BYTES && delta[i + literals + 1] != 0))) {
+            ++literals;
+        }
+        PutVarint(payload, zeros);
+        PutVarint(payload, literals);
+        payload.insert(payload.end(), delta + i, delta + i + literals);
+        i += literals;
+    }
+
+    Record.clear();
+    PutVarint(Record, frame.Index - PreviousIndex);
+    PutVarint(Record, static_cast<uint32_t>(payload.size()));
+    Record.insert(Record.end(), payload.begin(), payload.end());
+    File.write(reinterpret_cast<const char *>(Record.data()), Record.size());
+
+    Previous = frame;
+    PreviousIndex = frame.Index;
+    ++Written;
+}
+
+bool FrameStream::Open(const std::string &filename) {
+    File.open(filename.c_str(), std::ios::binary);
+    if (!File) {
+        Error = "Could not open video file " + filename;
+        return false;
+    }
+
+    uint8_t header[8];
+    if (!File.read(reinterpret_cast<char *>(header), sizeof(header)) || memcmp(header, "C8V1", 4) != 0 ||
+        header[4] != VIDEO_WIDTH || header[5] != VIDEO_HEIGHT) {
+        Error = "Not a CHIP-8 video file " + filename;
+        return false;
+    }
+
+    memset(&Pending, 0, sizeof(Pending));
+    uint32_t delta;
+    bool end;
+    HavePending = ReadRecord(delta, Pending, end) && !end;
+    return true;
+}
+
+bool FrameStream::ReadRecord(uint32_t &delta, PackedFrame &frame, bool &end) {
+    uint32_t size;
+    if (!GetVarint(File, delta) || !GetVarint(File, size))
+        return false;
+
+    end = size == 0;
+    if (end)
+        return true;
+
+    std::vector<uint8_t> payload(size);
+    if (!File.read(reinterpret_cast<char *>(payload.data()), size))
+        return false;
+
+    uint8_t bytes[FRAME_BYTES];
+    ToBytes(frame, bytes);
+
+    size_t in = 0;
+    int out = 0;
+    while (out < FRAME_BYTES && in < payload.size()) {
+        uint32_t zeros = 0, literals = 0;
+        for (uint32_t *value : { &zeros, &literals }) {
+            *value = 0;
+            for (int shift = 0; in < payload.size(); shift += 7) {
+                uint8_t byte = payload[in++];
+                *value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+                if (!(byte & 0x80))
+                    break;
+            }
+        }
+        if (out + zeros + literals > FRAME_BYTES || in + literals > payload.size()) {
+            Error = "Corrupt frame record";
+            return false;
+        }
+        out += zeros;
+        for (uint32_t i = 0; i < literals; ++i) {
+            bytes[out++] ^= payload[in++];
+        }
+    }
+
+    FromBytes(bytes, frame);
+    frame.Index += delta;
+    return true;
+}
+
+bool FrameStream::Next(PackedFrame &frame, uint32_t &duration) {
+    if (!HavePending)
+        return false;
+
+    frame = Pending;
+
+    uint32_t delta;
+    bool end;
+    if (!ReadRecord(delta, Pending, end)) {
+        // Truncated recording, show the last frame once
+        duration = 1;
+        HavePending = false;
+        return true;
+    }
+
+    duration = delta;
+    HavePending = !end;
+    return true;
+}
+
+bool ExportY4M(const std::string &input, const std::string &output, int scale, E_SCALER filter) {
+    FrameStream stream;
+    if (!stream.Open(input)) {
+        std::cout << stream.Error << std::endl;
+        return false;
+    }
+
+    std::ofstream file(output.c_str(), std::ios::binary | std::ios::trunc);
+    if (!file) {
+        std::cout << "Could not open " << output << std::endl;
+        return false;
+    }
+
+    // Studio range grey, the luma is the red channel
+    FrameScaler scaler(filter, scale);
+    scaler.On = PackRGBA(235, 235, 235);
+    scaler.Off = PackRGBA(16, 16, 16);
+    const int width = scaler.Width(), height = scaler.Height();
+    file << "YUV4MPEG2 W" << width << " H" << height << " F" << VIDEO_FPS << ":1 Ip A1:1 Cmono\n";
+
+    // Y4M has no frame durations, held frames are written again
+    std::vector<uint32_t> rgba(width * height);
+    std::vector<uint8_t> luma(width * height);
+    PackedFrame frame;
+    uint32_t duration;
+    while (stream.Next(frame, duration)) {
+        scaler.Scale(frame, rgba.data());
+        for (size_t i = 0; i < luma.size(); ++i) {
+            luma[i] = static_cast<uint8_t>(rgba[i]);
+        }
+        for (uint32_t i = 0; i < duration; ++i) {
+            file << "FRAME\n";
+            file.write(reinterpret_cast<const char *>(luma.data()), luma.size());
+        }
+    }
+    return static_cast<bool>(file);
+}
+
+// Variable length code writer for the GIF LZW stream, packed LSB first into
+// 255 byte sub-blocks
+class GifCodeWriter {
+public:
+    GifCodeWriter(std::ofstream &file) : File(file), Bits(0), Count(0) {}
+
+    void Write(uint32_t code, int size) {
+        Bits |= code << Count;
+        Count += size;
+        while (Count >= 8) {
+            Put(static_cast<uint8_t>(Bits));
+            Bits >>= 8;
+            Count -= 8;
+        }
+    }
+
+    void Finish() {
+        if (Count > 0)
+            Put(static_cast<uint8_t>(Bits));
+        Flush();
+        File.put(0);
+    }
+
+private:
+    void Put(uint8_t byte) {
+        Block.push_back(byte);
+        if (Block.size() == 255)
+            Flush();
+    }
+
+    void Flush() {
+        if (Block.empty())
+            return;
+        File.put(static_cast<char>(Block.size()));
+        File.write(reinterpret_cast<const char *>(Block.data()), Block.size());
+        Block.clear();
+    }
+
+    std::ofstream &File;
+    std::vector<uint8_t> Block;
+    uint32_t Bits;
+    int Count;
+};
+
+static void WriteLE16(std::ofstream &file, int value) {
+    file.put(static_cast<char>(value & 0xFF));
+    file.put(static_cast<char>((value >> 8) & 0xFF));
+}
+
+static void WriteGifImage(std::ofstream &file, const std::vector<uint8_t> &pixels) {
+    // Two colours, but GIF needs a minimum code size of 2
+    const int minimum = 2;
+    const uint32_t clear = 1 << minimum;
+    file.put(minimum);
+
+    GifCodeWriter writer(file);
+    std::vector<uint16_t> next(4096 * 4);
+    int size = minimum + 1;
+    uint32_t last = clear + 1;
+    int current = -1;
+
+    writer.Write(clear, size);
+    for (uint8_t pixel : pixels) {
+        if (current < 0) {
+            current = pixel;
+            continue;
+        }
+        uint16_t &child = next[current * 4 + pixel];
+        if (child) {
+            current = child;
+            continue;
+        }
+
+        writer.Write(current, size);
+        child = static_cast<uint16_t>(++last);
+        if (last >= (1u << size))
+            ++size;
+        if (last == 4095) {
+            writer.Write(clear, size);
+            std::fill(next.begin(), next.end(), 0);
+            size = minimum + 1;
+            last = clear + 1;
+        }
+        current = pixel;
+    }
+    writer.Write(current, size);
+    writer.Write(clear, size);
+    writer.Write(clear + 1, minimum + 1);
+    writer.Finish();
+}
+
+bool ExportGIF(const std::string &input, const std::string &output, int scale, E_SCALER filter) {
+    FrameStream stream;
+    if (!stream.Open(input)) {
+        std::cout << stream.Error << std::endl;
+        return false;
+    }
+
+    std::ofstream file(output.c_str(), std::ios::binary | std::ios::trunc);
+    if (!file) {
+        std::cout << "Could not open " << output << std::endl;
+        return false;
+    }
+
+    // Phosphor fades get four grey levels, as many as the code size allows
+    FrameScaler scaler(filter, scale);
+    const bool greys = filter == SCALER_PHOSPHOR;
+    const int width = scaler.Width(), height = scaler.Height();
+    file.write("GIF89a", 6);
+    WriteLE16(file, width);
+    WriteLE16(file, height);
+    file.put(static_cast<char>(greys ? 0x81 : 0x80));   // Global colour table of four or two entries
+    file.put(0);
+    file.put(0);
+    const uint8_t palette[12] = { 0x00, 0x00, 0x00, 0xFF, 0xFF, 0xFF, 0x55, 0x55, 0x55, 0xAA, 0xAA, 0xAA };
+    const uint8_t fade[4] = { 0, 2, 3, 1 };
+    file.write(reinterpret_cast<const char *>(palette), greys ? 12 : 6);
+
+    // Loop forever
+    file.write("\x21\xFF\x0BNETSCAPE2.0\x03\x01\x00\x00\x00", 19);
+
+    std::vector<uint32_t> rgba(width * height);
+    std::vector<uint8_t> pixels(width * height);
+    PackedFrame frame;
+    uint32_t duration;
+    uint64_t elapsed = 0, shown = 0;
+    while (stream.Next(frame, duration)) {
+        // Delays are in centiseconds, carry the rounding so the total stays exact
+        elapsed += duration;
+        uint64_t delay = elapsed * 100 / VIDEO_FPS - shown;
+        shown += delay;
+        if (delay > 0xFFFF)
+            delay = 0xFFFF;
+
+        scaler.Scale(frame, rgba.data());
+        for (size_t i = 0; i < pixels.size(); ++i) {
+            const uint8_t level = static_cast<uint8_t>(rgba[i]);
+            pixels[i] = greys ? fade[level >> 6] : level >> 7;
+        }
+
+        file.write("\x21\xF9\x04\x00", 4);
+        WriteLE16(file, static_cast<int>(delay));
+        file.put(0);
+        file.put(0);
+
+        file.put(0x2C);
+        WriteLE16(file, 0);
+        WriteLE16(file, 0);
+        WriteLE16(file, width);
+        WriteLE16(file, height);
+        file.put(0);
+        WriteGifImage(file, pixels);
+    }
+
+    file.put(0x3B);
+    return static_cast<bool>(file);
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include "display.h"
+#include "ring-buffer.h"
+#include "scaler.h"
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define VIDEO_WIDTH 64
+#define VIDEO_HEIGHT 32
+#define VIDEO_FPS 60
+
+// One 64x32 frame, a bit per pixel. Bit x of Rows[y] is pixel (x, y).
+struct PackedFrame {
+    uint64_t Rows[VIDEO_HEIGHT];
+    uint32_t Index;     // Emulated frame number
+
+    // Planes are merged, high resolution is reduced 2x2 to fit
+    void Pack(const Display &screen);
+    bool Pixel(int x, int y) const { return (Rows[y] >> x) & 1; }
+    uint64_t Hash() const;
+};
+
+// Lossless frame stream (.c8v):
+//   header   "C8V1", width, height, frames per second   (4 x uint8 after the tag)
+//   records  varint frames since the previous record, varint payload size, payload
+// The payload is the XOR against the previous frame, run length coded as
+// varint zero bytes, varint literal bytes, literals, until all 256 bytes are
+// covered. A record with an empty payload ends the stream.
+class FrameRecorder {
+public:
+    FrameRecorder();
+    ~FrameRecorder();
+
+    bool Start(const std::string &filename);
+    void Stop();
+    bool Recording() const { return Running; }
+
+    // Emulation thread, called once per emulated frame. Never blocks, frames
+    // identical to the previous one are only counted.
+    void Capture(const Display &screen);
+
+    std::atomic<uint32_t> Frames;
+    std::atomic<uint32_t> Written;
+    std::atomic<uint32_t> Dropped;
+
+private:
+    void Run();
+    void Write(const PackedFrame &frame);
+
+    RingBuffer<PackedFrame, 256> Queue;
+    std::atomic<bool> Running;
+    std::thread Worker;
+    std::ofstream File;
+
+    // Producer side
+    uint64_t LastHash;
+    bool HaveLast;
+
+    // Worker side
+    PackedFrame Previous;
+    uint32_t PreviousIndex;
+    std::vector<uint8_t> Record;
+};
+
+// Decodes a stream written by FrameRecorder
+class FrameStream {
+public:
+    bool Open(const std::string &filename);
+
+    // Duration is in emulated frames, false at the end of the stream
+    bool Next(PackedFrame &frame, uint32_t &duration);
+
+    std::string Error;
+
+private:
+    bool ReadRecord(uint32_t &delta, PackedFrame &frame, bool &end);
+
+    std::ifstream File;
+    PackedFrame Pending;
+    bool HavePending;
+};
+
+bool ExportY4M(const std::string &input, const std::string &output, int scale, E_SCALER filter = SCALER_NEAREST);
+bool ExportGIF(const std::string &input, const std::string &output, int scale, E_SCALER filter = SCALER_NEAREST);
@@ -0,0 +1,70 @@
+#include "hazard.h"
+#include "chip8.h"
+
+const char *HazardName(E_HAZARD hazard) {
+    switch (hazard) {
+    case HAZARD_FETCH: return "fetch";
+    case HAZARD_STACK_OVERFLOW: return "stack-overflow";
+    case HAZARD_STACK_UNDERFLOW: return "stack-underflow";
+    case HAZARD_MEMORY: return "memory";
+    case HAZARD_SCREEN: return "screen";
+    case HAZARD_KEY: return "key";
+    default: return "none";
+    }
+}
+
+// Mirrors the accesses made by CHIP8::Execute and DrawSprite
+E_HAZARD PredictHazard(const CHIP8 &chp) {
+    const CHIP8_INFO info = chp.GetInfo();
+    const uint16_t pc = info.PC & MEMORY_MASK;
+    if (pc + 1 >= MEMORY_SIZE)
+        return HAZARD_FETCH;
+
+    const uint16_t opcode = (chp.memory[pc] << 8) | chp.memory[pc + 1];
+    const uint8_t X = (opcode & 0x0F00) >> 8;
+    const uint8_t Y = (opcode & 0x00F0) >> 4;
+    const uint8_t N = opcode & 0x000F;
+    const uint8_t VX = X == 0xF ? info.VF : info.V[X];
+    const uint8_t VY = Y == 0xF ? info.VF : info.V[Y];
+    const uint16_t I = info.I & MEMORY_MASK;
+
+    switch (opcode & 0xF000) {
+    case 0x0000:
+        if ((opcode & 0x00FF) == 0xEE && info.SP == 0)
+            return HAZARD_STACK_UNDERFLOW;
+        break;
+    case 0x2000:
+        if (info.SP == STACK_MASK)
+            return HAZARD_STACK_OVERFLOW;
+        break;
+    case 0xD000:
+        for (uint8_t y = 0; y < N; ++y) {
+            if (I + y >= MEMORY_SIZE)
+                return HAZARD_MEMORY;
+            const uint8_t row = chp.memory[I + y];
+            for (uint8_t x = 0; x < 8; ++x) {
+                if (((row << x) & 0x80) && (VX + x >= SCREEN_WIDTH || VY + y >= SCREEN_HEIGHT))
+                    return HAZARD_SCREEN;
+            }
+        }
+        break;
+    case 0xE000:
+        if (((opcode & 0x00FF) == 0x9E || (opcode & 0x00FF) == 0xA1) && VX > 0xF)
+            return HAZARD_KEY;
+        break;
+    case 0xF000:
+        switch (opcode & 0x00FF) {
+        case 0x33:
+            if (I + 2 >= MEMORY_SIZE)
+                return HAZARD_MEMORY;
+            break;
+        case 0x55:
+        case 0x65:
+            if (I + X >= MEMORY_SIZE)
+                return HAZARD_MEMORY;
+            break;
+        }
+        break;
+    }
+    return HAZARD_NONE;
+}
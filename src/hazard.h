@@ -0,0 +1,21 @@
+#pragma once
+#include <cstdint>
+
+class CHIP8;
+
+enum E_HAZARD {
+    HAZARD_NONE,
+    HAZARD_FETCH,           // Instruction straddles the end of memory
+    HAZARD_STACK_OVERFLOW,  // CALL with the stack full
+    HAZARD_STACK_UNDERFLOW, // RET with nothing on the stack
+    HAZARD_MEMORY,          // Access through I wraps past the end of memory
+    HAZARD_SCREEN,          // Sprite pixel wraps around the screen edge
+    HAZARD_KEY              // Key index above F
+};
+
+const char *HazardName(E_HAZARD hazard);
+
+// The core masks every index into range, so no instruction can reach outside
+// the machine. This reports the next instruction when it only stays in range
+// thanks to that masking, which for most ROMs points at a bug worth a look.
+E_HAZARD PredictHazard(const CHIP8 &chp);
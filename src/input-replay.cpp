@@ -0,0 +1,46 @@
+#include "input-replay.h"
+#include "chip8.h"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+InputReplay::InputReplay() : Cursor(0) {
+}
+
+bool InputReplay::Load(const std::string &filename) {
+    Events.clear();
+    Cursor = 0;
+
+    std::ifstream file(filename.c_str());
+    if (!file)
+        return false;
+
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        std::stringstream fields(line);
+        InputEvent event;
+        unsigned int key, pressed;
+        if (!(fields >> event.Frame >> std::hex >> key >> std::dec >> pressed) || key > 0xF)
+            continue;
+
+        event.Key = static_cast<uint8_t>(key);
+        event.Pressed = pressed != 0;
+        Events.push_back(event);
+    }
+
+    // Keep file order for events on the same frame
+    std::stable_sort(Events.begin(), Events.end(), [](const InputEvent &a, const InputEvent &b) {
+        return a.Frame < b.Frame;
+    });
+    return true;
+}
+
+void InputReplay::Apply(uint32_t frame, CHIP8 &chp) {
+    while (Cursor < Events.size() && Events[Cursor].Frame <= frame) {
+        chp.Keys[Events[Cursor].Key] = Events[Cursor].Pressed;
+        ++Cursor;
+    }
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class CHIP8;
+
+struct InputEvent {
+    uint32_t Frame;
+    uint8_t Key;
+    bool Pressed;
+};
+
+// Scripted key presses for headless runs, one event per line:
+//   <frame> <key 0-F> <1 pressed | 0 released>
+class InputReplay {
+public:
+    InputReplay();
+
+    bool Load(const std::string &filename);
+    void Rewind() { Cursor = 0; }
+
+    // Apply every event up to and including `frame`, frames must not go backwards
+    void Apply(uint32_t frame, CHIP8 &chp);
+
+    std::vector<InputEvent> Events;
+
+private:
+    size_t Cursor;
+};
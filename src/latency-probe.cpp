@@ -0,0 +1,139 @@
+#include "latency-probe.h"
+#include "chip8.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+
+double LatencyMs(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to) {
+    return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+LatencyProbe::LatencyProbe() : Cycles(0) {
+    memset(Dropped, 0, sizeof(Dropped));
+}
+
+void LatencyProbe::KeyEvent(uint8_t key, bool pressed) {
+    std::lock_guard<std::mutex> lock(Guard);
+
+    // A newer event for the same key supersedes one the program never read
+    for (auto it = Pending.begin(); it != Pending.end(); ++it) {
+        if (it->Key == key && it->Stage == LATENCY_READ) {
+            ++Dropped[LATENCY_READ];
+            Pending.erase(it);
+            break;
+        }
+    }
+
+    LatencySample sample;
+    sample.Key = key;
+    sample.Pressed = pressed;
+    sample.Cycle = 0;
+    sample.Input = std::chrono::steady_clock::now();
+    sample.Stage = LATENCY_READ;
+    Pending.push_back(sample);
+}
+
+void LatencyProbe::KeyRead(const CHIP8 &chp, uint8_t key, bool state) {
+    std::lock_guard<std::mutex> lock(Guard);
+    for (auto &sample : Pending) {
+        if (sample.Stage != LATENCY_READ || sample.Key != key || sample.Pressed != state)
+            continue;
+        sample.Read = std::chrono::steady_clock::now();
+        sample.Cycle = Cycles;
+        sample.Baseline.Pack(chp.screen);
+        sample.Stage = LATENCY_CHANGE;
+    }
+}
+
+void LatencyProbe::AfterRun(const CHIP8 &chp, uint32_t executed) {
+    const auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(Guard);
+    Cycles += executed;
+
+    bool packed = false;
+    PackedFrame screen;
+    for (auto &sample : Pending) {
+        if (sample.Stage != LATENCY_CHANGE)
+            continue;
+        // Only packed while something is waiting on it
+        if (!packed) {
+            screen.Pack(chp.screen);
+            packed = true;
+        }
+        if (memcmp(screen.Rows, sample.Baseline.Rows, sizeof(screen.Rows)) != 0) {
+            sample.Changed = now;
+            sample.Stage = LATENCY_SHOW;
+        }
+    }
+    Expire(now);
+}
+
+void LatencyProbe::ScreenRead() {
+    std::lock_guard<std::mutex> lock(Guard);
+    LastScreenRead = std::chrono::steady_clock::now();
+}
+
+void LatencyProbe::Presented() {
+    const auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(Guard);
+    for (auto it = Pending.begin(); it != Pending.end();) {
+        // The swapped frame only shows changes made before the GUI read the screen
+        if (it->Stage == LATENCY_SHOW && it->Changed <= LastScreenRead) {
+            it->Shown = now;
+            it->Stage = LATENCY_DONE;
+            Done.push_back(*it);
+            it = Pending.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+}
+
+void LatencyProbe::Expire(std::chrono::steady_clock::time_point now) {
+    const auto timeout = std::chrono::milliseconds(LATENCY_TIMEOUT_MS);
+    for (auto it = Pending.begin(); it != Pending.end();) {
+        const auto since = it->Stage == LATENCY_READ ? it->Input : it->Read;
+        if (it->Stage != LATENCY_SHOW && now - since > timeout) {
+            ++Dropped[it->Stage];
+            it = Pending.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+}
+
+void LatencyProbe::Clear() {
+    std::lock_guard<std::mutex> lock(Guard);
+    Pending.clear();
+    Done.clear();
+    memset(Dropped, 0, sizeof(Dropped));
+}
+
+size_t LatencyProbe::Count() const {
+    std::lock_guard<std::mutex> lock(Guard);
+    return Done.size();
+}
+
+std::vector<LatencySample> LatencyProbe::Completed() const {
+    std::lock_guard<std::mutex> lock(Guard);
+    return Done;
+}
+
+bool LatencyProbe::ExportCSV(const std::string &filename) const {
+    const std::vector<LatencySample> samples = Completed();
+    std::ofstream file(filename.c_str(), std::ios::trunc);
+    if (!file)
+        return false;
+
+    file << "key,pressed,cycle,input_to_read_ms,read_to_change_ms,change_to_swap_ms,total_ms\n";
+    file << std::fixed << std::setprecision(3);
+    for (const auto &sample : samples) {
+        file << std::hex << std::uppercase << unsigned(sample.Key) << std::dec << ',' << (sample.Pressed ? 1 : 0) << ','
+             << sample.Cycle << ',' << LatencyMs(sample.Input, sample.Read) << ',' << LatencyMs(sample.Read, sample.Changed)
+             << ',' << LatencyMs(sample.Changed, sample.Shown) << ',' << LatencyMs(sample.Input, sample.Shown) << '\n';
+    }
+    return static_cast<bool>(file);
+}
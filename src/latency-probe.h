@@ -0,0 +1,76 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "frame-recorder.h"
+
+class CHIP8;
+
+// Gives up on a key event that went this long without reaching the next stage
+#define LATENCY_TIMEOUT_MS 2000
+
+enum E_LATENCY_STAGE {
+    LATENCY_READ,       // Waiting for the program to read the key
+    LATENCY_CHANGE,     // Waiting for the screen to change
+    LATENCY_SHOW,       // Waiting for a swap that shows the change
+    LATENCY_DONE
+};
+
+struct LatencySample {
+    uint8_t Key;
+    bool Pressed;
+    uint64_t Cycle;     // Instructions run before the one that read the key
+
+    std::chrono::steady_clock::time_point Input;    // key_callback
+    std::chrono::steady_clock::time_point Read;     // Ex9E, ExA1 or Fx0A saw the new state
+    std::chrono::steady_clock::time_point Changed;  // First screen change after the read
+    std::chrono::steady_clock::time_point Shown;    // glfwSwapBuffers of a frame with the change
+
+    E_LATENCY_STAGE Stage;
+    PackedFrame Baseline;   // Screen as it was when the key was read
+};
+
+// Follows every key event from the host callback to the swap that shows
+// its effect. Each stage is stamped on the thread that sees it:
+//   GUI          KeyEvent, ScreenRead, Presented
+//   emulation    KeyRead (from inside the interpreter), AfterRun
+// Reads are only reported by the interpreter and the predecoded engine's
+// fallback path, translated programs do not call back.
+class LatencyProbe {
+public:
+    LatencyProbe();
+
+    void KeyEvent(uint8_t key, bool pressed);
+    void KeyRead(const CHIP8 &chp, uint8_t key, bool state);
+    // After every batch, with the number of instructions it ran
+    void AfterRun(const CHIP8 &chp, uint32_t executed);
+    // Right before the GUI copies the screen for drawing
+    void ScreenRead();
+    // Right after glfwSwapBuffers
+    void Presented();
+
+    void Clear();
+    size_t Count() const;
+    std::vector<LatencySample> Completed() const;
+    bool ExportCSV(const std::string &filename) const;
+
+    uint32_t Unread() const { return Dropped[LATENCY_READ]; }
+    uint32_t Invisible() const { return Dropped[LATENCY_CHANGE]; }
+
+private:
+    void Expire(std::chrono::steady_clock::time_point now);
+
+    mutable std::mutex Guard;
+    std::vector<LatencySample> Pending;
+    std::vector<LatencySample> Done;
+    uint32_t Dropped[LATENCY_DONE];
+
+    uint64_t Cycles;
+    std::chrono::steady_clock::time_point LastScreenRead;
+};
+
+// Milliseconds between two stamps of a completed sample
+double LatencyMs(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to);
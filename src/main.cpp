@@ -2,6 +2,16 @@
 #include <GL/gl3w.h>
 #include "chip8.h"
 #include "program-reader.h"
+#include "audio.h"
+#include "frame-recorder.h"
+#include "latency-probe.h"
+#include "program-analysis.h"
+#include "rom-database.h"
+#include "rom-library.h"
+#include "rom-archive.h"
+#include "scaler.h"
+#include "session.h"
+#include "translation-cache.h"
 #include <iostream>
 
 #include <GLFW/glfw3.h>
@@ -12,27 +22,153 @@
 #include "imgui_memory_editor.h"
 
 #include <thread>
-#include <filesystem>
+#include <atomic>
+#include <algorithm>
 #include <map>
+#include <memory>
+#include <cstdlib>
+#include <cstring>
+#include <cfloat>
+#include <cmath>
+#include <cctype>
 
-static MemoryEditor mem_edit_1;
+// Every session is emulated on the pool, this thread only draws
+static SessionPool Pool;
 
-static uint8_t PrevV[15];
+// GUI frames the phosphor keeps fading after the last change, 0.6^12 is below one step of 255
+#define PHOSPHOR_FRAMES 12
 
-static bool FreeRunning = false;
+// Inputs of the Debugger window
+struct DebuggerForm {
+    char Address[8];
+    char Value[8];
+    int Register;
+    int Compare;
+    int Length;
+    bool WatchRead;
+    bool WatchWrite;
+};
 
+// One line of the Disassembly window, either a block label or an instruction
+struct DisassemblyLine {
+    uint16_t Address;
+    bool Label;
+    std::string Text;
+};
 
-void ShowRegisterWindow(bool *open, const CHIP8_INFO &info) {
-    ImGui::Begin("Registers", open);
+// What the render thread keeps per session. Windows are told apart by the
+// session id, and the screen texture is only redone when the session
+// published a new frame or the phosphor is still fading.
+struct SessionView {
+    explicit SessionView(const std::shared_ptr<Session> &owner)
+        : Owner(owner), Phosphor(SCALER_PHOSPHOR, 1), PhosphorHiRes(SCALER_PHOSPHOR, 1, HIRES_WIDTH, HIRES_HEIGHT) {
+        ShowScreen = ShowRegisters = ShowMemory = ShowControls = true;
+        ShowDebugger = ShowDisassembly = false;
+        Closing = false;
+        Turbo = false;
+        TurboMultiplier = 0.0f;
+        memset(PrevV, 0, sizeof(PrevV));
+        Follow = true;
+        strcpy(Form.Address, "200");
+        strcpy(Form.Value, "00");
+        Form.Register = 0;
+        Form.Compare = 0;
+        Form.Length = 1;
+        Form.WatchRead = false;
+        Form.WatchWrite = true;
+
+        Version = 0;
+        Fading = 0;
+        glGenTextures(1, &Texture);
+        glBindTexture(GL_TEXTURE_2D, Texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        TextureWidth = 0;
+    }
+    ~SessionView() { glDeleteTextures(1, &Texture); }
+
+    std::shared_ptr<Session> Owner;
+
+    bool ShowScreen, ShowRegisters, ShowMemory, ShowControls, ShowDebugger, ShowDisassembly;
+    bool Closing;
+
+    // Fast-forward runs the session at TurboMultiplier times real time, 0 for uncapped
+    bool Turbo;
+    float TurboMultiplier;
+
+    uint8_t PrevV[15];
+    MemoryEditor Memory;
+    ProgramAnalysis Analysis;
+    // Formatted once per analysis, the window only draws the lines in view
+    std::vector<DisassemblyLine> Listing;
+    std::map<uint16_t, size_t> ListingLines;
+    bool Follow;
+    DebuggerForm Form;
+
+    Display Screen;
+    uint32_t Version;
+    int Fading;
+    // Pixels fade out over a few GUI frames instead of vanishing, hides flicker.
+    // One scaler per resolution, each keeps its own fades.
+    FrameScaler Phosphor;
+    FrameScaler PhosphorHiRes;
+    uint32_t Pixels[HIRES_WIDTH * HIRES_HEIGHT];
+    GLuint Texture;
+    int TextureWidth;
+};
+
+static std::vector<std::unique_ptr<SessionView> > Views;
+
+// Instrumented mode, the probe is attached to one session while measuring
+static LatencyProbe Latency;
+static std::atomic<bool> MeasureLatency(false);
+static std::shared_ptr<Session> Probed;
+
+// Keys and sound go to the session whose windows were used last
+static std::mutex FocusGuard;
+static std::shared_ptr<Session> Focused;
+
+static std::shared_ptr<Session> FocusedSession() {
+    std::lock_guard<std::mutex> guard(FocusGuard);
+    return Focused;
+}
+
+static void Focus(const std::shared_ptr<Session> &session) {
+    std::lock_guard<std::mutex> guard(FocusGuard);
+    Focused = session;
+}
+
+// "<title> [<id>] <window>", with the id alone keeping ImGui state across loads
+static std::string WindowTitle(const SessionView &view, const char *window) {
+    char title[160];
+    snprintf(title, sizeof(title), "%s [%u] %s###%s%u", view.Owner->Title.c_str(), view.Owner->Id, window, window, view.Owner->Id);
+    return title;
+}
+
+// Starts a window of one session, any of them in focus focuses the session
+static bool BeginSessionWindow(const SessionView &view, const char *window, bool *open) {
+    const bool visible = ImGui::Begin(WindowTitle(view, window).c_str(), open);
+    if (ImGui::IsWindowFocused() && FocusedSession() != view.Owner)
+        Focus(view.Owner);
+    return visible;
+}
+
+void ShowRegisterWindow(SessionView &view, const CHIP8_INFO &info) {
+    if (!BeginSessionWindow(view, "Registers", &view.ShowRegisters)) {
+        ImGui::End();
+        return;
+    }
 
     ImGui::Text("Current location: 0x%02x", info.PC);
     ImGui::Text("Current opcode: 0x%02x", info.Opcode);
     ImGui::Text("VF: 0x%02x", info.VF);
+    ImGui::Text("I: 0x%03x  SP: %u  DT: %u  ST: %u  Keys: %04x%s", info.I, info.SP, info.Delay, info.Sound, info.Keys,
+                info.Blocked ? "  (waiting for a key)" : "");
     ImGui::Columns(15, "vregisters", true);
     ImGui::Separator();
     for (uint8_t i = 0; i < 15; ++i) {
         char label[32];
-        if (info.V[i] != PrevV[i]) {
+        if (info.V[i] != view.PrevV[i]) {
             ImGui::PushStyleColor(ImGuiCol_Text, (ImVec4)ImColor::HSV(0.0f, 1.0f, 1.0f));
 
             sprintf(label, "V%u\n0x%02x", i, info.V[i]);
@@ -51,81 +187,759 @@ void ShowRegisterWindow(bool *open, const CHIP8_INFO &info) {
     ImGui::End();
 }
 
-static bool PrevScreen[64][32];
+// Turns the last copied frame into texels, returns false when nothing moved
+static bool PaintScreen(SessionView &view, bool changed) {
+    if (changed)
+        view.Fading = PHOSPHOR_FRAMES;
+    else if (view.Fading == 0)
+        return false;
+    else
+        --view.Fading;
 
-void ShowScreen(bool *open, const CHIP8 &chp) {
-    ImGui::Begin("Screen", open);
-    ImDrawList* draw_list = ImGui::GetWindowDrawList();
     static ImVec4 black = ImVec4(0.1f, 0.1f, 0.1f, 1.0f);
     static ImVec4 white = ImVec4(0.1f, 0.1f, 0.1f, 0.2f);
-    const ImVec2 p = ImGui::GetCursorScreenPos();
-
-    double width = 10.0f;
-
-    for (int y = 0; y < 32; ++y) {
-        for (int x = 0; x < 64; ++x) {
-            draw_list->AddRectFilled(
-                ImVec2(p.x + x * (width), p.y + y * (width)),
-                ImVec2(p.x + x * (width)+8.0f, p.y + y * (width)+8.0f),
-                ImColor(chp.screen[x][y] ? black : ImColor(PrevScreen[x][y] ? black : white)),
-                0.0f
-            );
+    // XO-CHIP colours for plane 1 alone and both planes
+    static ImVec4 second = ImVec4(0.8f, 0.3f, 0.1f, 1.0f);
+    static ImVec4 both = ImVec4(0.9f, 0.8f, 0.2f, 1.0f);
+    const Display &screen = view.Screen;
+
+    uint64_t rows[HIRES_HEIGHT * HIRES_WIDTH / 64];
+    bool colour = false;
+    for (int i = 0; i < screen.Size(); ++i) {
+        rows[i] = screen.Rows[0][i] | screen.Rows[1][i];
+        colour |= screen.Rows[1][i] != 0;
+    }
+
+    // Fades only for plain monochrome programs
+    if (colour) {
+        const ImU32 palette[4] = { ImColor(white), ImColor(black), ImColor(second), ImColor(both) };
+        for (int y = 0; y < screen.Height(); ++y) {
+            for (int x = 0; x < screen.Width(); ++x) {
+                view.Pixels[y * screen.Width() + x] = palette[screen.Colour(x, y)];
+            }
         }
+        view.Fading = 0;
     }
+    else {
+        FrameScaler &phosphor = screen.HiRes ? view.PhosphorHiRes : view.Phosphor;
+        phosphor.On = ImColor(black);
+        phosphor.Off = ImColor(white);
+        phosphor.Scale(rows, view.Pixels);
+    }
+    return true;
+}
+
+void ShowScreen(SessionView &view) {
+    ImGui::SetNextWindowPos(ImVec2(40.0f + 30.0f * view.Owner->Id, 40.0f + 30.0f * view.Owner->Id), ImGuiCond_FirstUseEver);
+    if (!BeginSessionWindow(view, "Screen", &view.ShowScreen)) {
+        ImGui::End();
+        return;
+    }
+
+    if (MeasureLatency && view.Owner == Probed)
+        Latency.ScreenRead();
+    // Nothing is copied or uploaded unless the session published a new frame
+    const bool changed = view.Owner->CopyFrame(view.Screen, view.Version);
+    if (PaintScreen(view, changed)) {
+        glBindTexture(GL_TEXTURE_2D, view.Texture);
+        if (view.TextureWidth != view.Screen.Width()) {
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, view.Screen.Width(), view.Screen.Height(), 0, GL_RGBA, GL_UNSIGNED_BYTE, view.Pixels);
+            view.TextureWidth = view.Screen.Width();
+        }
+        else {
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, view.Screen.Width(), view.Screen.Height(), GL_RGBA, GL_UNSIGNED_BYTE, view.Pixels);
+        }
+    }
+
+    // The window keeps its size, high resolution pixels are half as big
+    ImGui::Image(reinterpret_cast<ImTextureID>(static_cast<intptr_t>(view.Texture)), ImVec2(SCREEN_WIDTH * 10.0f, SCREEN_HEIGHT * 10.0f));
     ImGui::End();
 }
 
-CHIP8 chp;
+// Performance window, rolling samples shown as histograms
+#define PERF_SAMPLES 120
+#define PERF_RATE_INTERVAL 0.1     // Seconds per emulation rate sample
+
+struct PerfSeries {
+    float Values[PERF_SAMPLES];
+    int Offset;
+
+    PerfSeries() : Offset(0) { memset(Values, 0, sizeof(Values)); }
+
+    void Add(float value) {
+        Values[Offset] = value;
+        Offset = (Offset + 1) % PERF_SAMPLES;
+    }
+    float Last() const { return Values[(Offset + PERF_SAMPLES - 1) % PERF_SAMPLES]; }
+    float Average() const {
+        float sum = 0.0f;
+        for (float value : Values) {
+            sum += value;
+        }
+        return sum / PERF_SAMPLES;
+    }
+    float Peak() const { return *std::max_element(Values, Values + PERF_SAMPLES); }
+
+    void Plot(const char *label, const char *format) const {
+        char overlay[64], text[96];
+        snprintf(overlay, sizeof(overlay), format, Last());
+        snprintf(text, sizeof(text), "%s  (avg %.4g, peak %.4g)", overlay, Average(), Peak());
+        ImGui::PlotHistogram(label, Values, PERF_SAMPLES, Offset, text, 0.0f, std::max(Peak(), 1e-3f) * 1.1f, ImVec2(0, 40));
+    }
+};
+
+// GUI frame time is split by the window that spent it
+enum E_PERF_WINDOW {
+    PERF_REGISTERS,
+    PERF_SCREEN,
+    PERF_DEBUGGER,
+    PERF_DISASSEMBLY,
+    PERF_MEMORY,
+    PERF_DEMO,
+    PERF_CONTROLS,
+    PERF_RENDER,
+    PERF_WINDOW_COUNT
+};
+
+static const char *PerfWindowNames[PERF_WINDOW_COUNT] = {
+    "Registers", "ShowScreen", "Debugger", "Disassembly", "MemoryEditor", "ShowDemoWindow", "Controls and menus", "Render and swap"
+};
+
+static double PerfWindowMs[PERF_WINDOW_COUNT];
+static double PerfGuardWaitMs = 0.0;
+
+static PerfSeries PerfWindowSeries[PERF_WINDOW_COUNT];
+static PerfSeries PerfGuiFrame;
+static PerfSeries PerfGuardWait;
+static PerfSeries PerfInstructionRate;
+static PerfSeries PerfFrameRate;
+static PerfSeries PerfBusy;
+
+static double MillisecondsSince(std::chrono::high_resolution_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+// Adds the time until the end of the scope to a window's share of the GUI frame
+class PerfScope {
+public:
+    explicit PerfScope(E_PERF_WINDOW window) : Window(window), Start(std::chrono::high_resolution_clock::now()) {}
+    ~PerfScope() { PerfWindowMs[Window] += MillisecondsSince(Start); }
+
+private:
+    E_PERF_WINDOW Window;
+    std::chrono::high_resolution_clock::time_point Start;
+};
+
+// DataGuard taken from the GUI thread, waiting on a worker is measured
+class GuiGuard {
+public:
+    explicit GuiGuard(std::mutex &mutex) : Lock(mutex, std::defer_lock) {
+        const auto before = std::chrono::high_resolution_clock::now();
+        Lock.lock();
+        PerfGuardWaitMs += MillisecondsSince(before);
+    }
+
+private:
+    std::unique_lock<std::mutex> Lock;
+};
+
+static void WriteMemory(uint8_t *data, size_t off, uint8_t d) {
+    for (const auto &view : Views) {
+        CHIP8 &chp = view->Owner->Machine;
+        if (chp.memory == data) {
+            // The worker keeps code maps and dirty pages in step with memory
+            SessionClaim claim(*view->Owner);
+            data[off] = d;
+            chp.NotifyWrite(static_cast<uint16_t>(off), 1);
+        }
+    }
+}
+
+// With the DataGuard held, memory is read while formatting
+static void BuildListing(SessionView &view, const CHIP8 &chp) {
+    const ProgramAnalysis &Analysis = view.Analysis;
+    view.Listing.clear();
+    view.ListingLines.clear();
+
+    std::string text;
+    char line[64];
+    for (const auto &entry : Analysis.Blocks) {
+        const BasicBlock &block = entry.second;
+        snprintf(line, sizeof(line), Analysis.Functions.count(block.Start) ? "sub_%03x:" : "block_%03x:", block.Start);
+        view.Listing.push_back({ block.Start, true, line });
 
-void CHIP8Loop() {
-    auto start = std::chrono::high_resolution_clock::now();
-    while (true) {
-        if (FreeRunning) {
-            std::chrono::duration<float> temp = std::chrono::high_resolution_clock::now() - start;
-            chp.Tick(temp.count());
+        for (uint16_t address = block.Start; address < block.End; address += Analysis.Length(chp.memory, address)) {
+            const uint16_t opcode = (chp.memory[address] << 8) | chp.memory[address + 1];
+            Disassemble(opcode, text, chp.Quirks);
+            snprintf(line, sizeof(line), "0x%03x  %04x  %s", address, opcode, text.c_str());
+            view.ListingLines[address] = view.Listing.size();
+            view.Listing.push_back({ address, false, line });
         }
+    }
+}
+
+void ShowDisassemblyWindow(SessionView &view, const CHIP8_INFO &info) {
+    if (!BeginSessionWindow(view, "Disassembly", &view.ShowDisassembly)) {
+        ImGui::End();
+        return;
+    }
+
+    CHIP8 &chp = view.Owner->Machine;
+    ProgramAnalysis &Analysis = view.Analysis;
+    {
+        // Only a stale analysis reads memory, the worker is held up just for that
+        GuiGuard guard(chp.DataGuard);
+        if (Analysis.IsStale(chp)) {
+            Analysis.Analyze(chp);
+            BuildListing(view, chp);
+        }
+    }
+
+    ImGui::Checkbox("Follow PC", &view.Follow);
+    ImGui::SameLine();
+    ImGui::Text("%u blocks, %u subroutines", (unsigned)Analysis.Blocks.size(), (unsigned)Analysis.Functions.size());
+    ImGui::Separator();
+
+    ImGui::BeginChild("listing");
+    const float height = ImGui::GetTextLineHeightWithSpacing();
+    const auto current = view.ListingLines.find(info.PC);
+    if (view.Follow && view.Owner->Running && current != view.ListingLines.end()) {
+        ImGui::SetScrollFromPosY(ImGui::GetCursorStartPos().y + current->second * height);
+    }
+
+    ImGuiListClipper clipper(static_cast<int>(view.Listing.size()), height);
+    while (clipper.Step()) {
+        for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; ++i) {
+            const DisassemblyLine &line = view.Listing[i];
+            if (line.Label) {
+                ImGui::TextDisabled("%s", line.Text.c_str());
+                continue;
+            }
+
+            // Breakpoints are only ever changed from this thread
+            char text[80];
+            snprintf(text, sizeof(text), "%s %s", chp.Debug.HasBreakpoint(line.Address) ? "*" : " ", line.Text.c_str());
+            if (ImGui::Selectable(text, line.Address == info.PC)) {
+                // Clicking a line toggles a breakpoint on it
+                GuiGuard guard(chp.DataGuard);
+                if (chp.Debug.HasBreakpoint(line.Address))
+                    chp.Debug.ClearBreakpoint(line.Address);
+                else
+                    chp.Debug.SetBreakpoint(line.Address);
+            }
+        }
+    }
+    ImGui::EndChild();
+
+    ImGui::End();
+}
+
+void ShowDebuggerWindow(SessionView &view) {
+    static const char *reasons[] = { "None", "Breakpoint", "Condition", "Read watch", "Write watch" };
+    static const char *compares[] = { "==", "!=", "<", ">" };
+    DebuggerForm &form = view.Form;
+
+    if (!BeginSessionWindow(view, "Debugger", &view.ShowDebugger)) {
+        ImGui::End();
+        return;
+    }
+
+    CHIP8 &chp = view.Owner->Machine;
+    GuiGuard guard(chp.DataGuard);
+    Debugger &debug = chp.Debug;
+
+    ImGui::Text("Stopped by: %s at 0x%03x", reasons[debug.Reason], debug.HitAddress);
+    ImGui::Separator();
+
+    ImGui::InputText("Address", form.Address, sizeof(form.Address), ImGuiInputTextFlags_CharsHexadecimal);
+    uint16_t addr = static_cast<uint16_t>(strtoul(form.Address, NULL, 16));
+
+    if (ImGui::Button("Add breakpoint")) {
+        debug.SetBreakpoint(addr);
+    }
+
+    ImGui::Combo("Register", &form.Register, "V0\0V1\0V2\0V3\0V4\0V5\0V6\0V7\0V8\0V9\0VA\0VB\0VC\0VD\0VE\0VF\0\0");
+    ImGui::Combo("Compare", &form.Compare, compares, 4);
+    ImGui::InputText("Value", form.Value, sizeof(form.Value), ImGuiInputTextFlags_CharsHexadecimal);
+    if (ImGui::Button("Add condition")) {
+        BreakCondition condition;
+        condition.Address = addr;
+        condition.Register = static_cast<uint8_t>(form.Register);
+        condition.Compare = static_cast<E_COMPARE>(form.Compare);
+        condition.Value = static_cast<uint8_t>(strtoul(form.Value, NULL, 16));
+        debug.AddCondition(condition);
+    }
+
+    ImGui::InputInt("Length", &form.Length);
+    ImGui::Checkbox("Read", &form.WatchRead);
+    ImGui::SameLine();
+    ImGui::Checkbox("Write", &form.WatchWrite);
+    ImGui::SameLine();
+    if (ImGui::Button("Add watch") && form.Length > 0) {
+        debug.SetWatch(addr, static_cast<uint16_t>(form.Length), form.WatchRead, form.WatchWrite);
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Clear watch") && form.Length > 0) {
+        debug.ClearWatch(addr, static_cast<uint16_t>(form.Length));
+    }
+
+    ImGui::Separator();
+    for (size_t i = 0; i < debug.Breakpoints.size(); ++i) {
+        uint16_t bp = debug.Breakpoints[i];
+        ImGui::PushID(static_cast<int>(bp));
+        if (ImGui::SmallButton("x")) {
+            debug.ClearBreakpoint(bp);
+            ImGui::PopID();
+            break;
+        }
+        ImGui::SameLine();
+        ImGui::Text("Break at 0x%03x", bp);
+        ImGui::PopID();
+    }
+    for (size_t i = 0; i < debug.Conditions.size(); ++i) {
+        const BreakCondition &condition = debug.Conditions[i];
+        ImGui::PushID(static_cast<int>(MEMORY_SIZE + i));
+        if (ImGui::SmallButton("x")) {
+            debug.RemoveCondition(i);
+            ImGui::PopID();
+            break;
+        }
+        ImGui::SameLine();
+        ImGui::Text("Break at 0x%03x if V%X %s 0x%02x", condition.Address, condition.Register, compares[condition.Compare], condition.Value);
+        ImGui::PopID();
+    }
+    if (debug.WatchArmed) {
+        ImGui::Text("%u read / %u write watched bytes", (unsigned)debug.ReadWatch.count(), (unsigned)debug.WriteWatch.count());
+    }
+    if (ImGui::Button("Clear all")) {
+        debug.ClearAll();
+    }
+
+    ImGui::End();
+}
+
+
+void ShowMemoryWindow(SessionView &view, const CHIP8_INFO &info) {
+    CHIP8 &chp = view.Owner->Machine;
+    view.Memory.HighlightMin = info.PC;
+    view.Memory.HighlightMax = info.PC + 2;
+    view.Memory.HighlightColor = IM_COL32(255, 0, 0, 90);
+    view.Memory.DrawWindow(WindowTitle(view, "Memory").c_str(), chp.memory, chp.AddressMask() + 1, 0x0000);
+    view.ShowMemory = view.Memory.Open;
+}
+
+static AudioStream Audio;
+static std::unique_ptr<AudioSink> AudioOut;
+static bool RecordAudio = false;
+
+static std::atomic<bool> Quit(false);
+
+// XO-CHIP programs bring their own waveform, switch back to the beeper for the rest
+static void FollowPattern(const uint8_t next[16], uint8_t nextPitch, bool nextLoaded) {
+    static bool loaded = false;
+    static uint8_t pattern[16];
+    static uint8_t pitch;
+
+    if (!nextLoaded) {
+        if (loaded)
+            Audio.SetBeeper(440.0f);
+        loaded = false;
+        return;
+    }
+    if (loaded && pitch == nextPitch && memcmp(pattern, next, sizeof(pattern)) == 0)
+        return;
+    memcpy(pattern, next, sizeof(pattern));
+    pitch = nextPitch;
+    loaded = true;
+    Audio.SetPattern(pattern, pitch);
+}
+
+// Keeps the audio ring topped up, only the focused session is heard
+void AudioLoop() {
+    auto last = std::chrono::high_resolution_clock::now();
+    while (!Quit) {
+        auto now = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double> frame = now - last;
+        last = now;
+
+        bool active = false;
+        const auto session = FocusedSession();
+        if (session) {
+            uint8_t sound, pattern[16], pitch;
+            bool loaded;
+            session->CopyAudio(sound, pattern, pitch, loaded);
+            FollowPattern(pattern, pitch, loaded);
+            // Sound would only be a buzz when fast forwarding
+            active = session->Running && session->Speed == 1.0f && sound != 0x00;
+        }
+        // This never blocks
+        Audio.Produce(active, frame.count());
+
         std::this_thread::sleep_for(std::chrono::microseconds(200));
     }
 }
 
-static std::map<int, E_KEYS> KeyMapping;
+// Decoded tables survive restarts and closed sessions, keyed by ROM hash
+static TranslationCache Cache("cache");
+
+void ShowControlsWindow(SessionView &view, const CHIP8_INFO &info) {
+    static const char *platforms = "CHIP-8\0SUPER-CHIP\0XO-CHIP\0\0";
+    Session &session = *view.Owner;
+    CHIP8 &chp = session.Machine;
+
+    ImGui::SetNextWindowPos(ImVec2(720.0f + 30.0f * session.Id, 40.0f + 30.0f * session.Id), ImGuiCond_FirstUseEver);
+    if (!BeginSessionWindow(view, "Controls", &view.ShowControls)) {
+        ImGui::End();
+        return;
+    }
+
+    // Widgets edit copies, the session is only claimed to apply a change.
+    // An untouched Controls window never waits on the worker.
+    if (ImGui::Button("Step")) {
+        for (uint8_t i = 0; i < 15; ++i) {
+            view.PrevV[i] = info.V[i];
+        }
+        SessionClaim claim(session);
+        chp.Debug.Resume();
+        // A batch of one, so the Registers window sees the step through Snapshot()
+        chp.Run(1);
+        session.Publish();
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Step back") && !session.Running) {
+        SessionClaim claim(session);
+        chp.StepBack();
+        session.Publish();
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Reverse") && !session.Running) {
+        SessionClaim claim(session);
+        chp.ReverseContinue();
+        session.Publish();
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Pause")) {
+        session.Running = false;
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Run")) {
+        SessionClaim claim(session);
+        chp.Debug.Resume();
+        session.Running = true;
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Restart")) {
+        SessionClaim claim(session);
+        session.Restart();
+    }
+    float clock = chp.ClockSpeed;
+    if (ImGui::SliderFloat("Clock Speed", &clock, 0.0f, 0.4f, "%.8f")) {
+        SessionClaim claim(session);
+        chp.ClockSpeed = clock;
+    }
+    ImGui::Checkbox("Fast forward", &view.Turbo);
+    ImGui::SameLine();
+    ImGui::Text("%.1fx", session.Achieved.load());
+    ImGui::SliderFloat("Speed", &view.TurboMultiplier, 0.0f, 100.0f, view.TurboMultiplier > 0.0f ? "%.0fx" : "uncapped");
+    session.Speed = view.Turbo ? view.TurboMultiplier : 1.0f;
+
+    // Quirk profiles can be compared side by side, changes apply from the next instruction
+    CHIP8_QUIRKS quirks = chp.Quirks;
+    int platform = quirks.Platform;
+    bool changed = false;
+    if (ImGui::Combo("Platform", &platform, platforms)) {
+        quirks.Platform = static_cast<uint8_t>(platform);
+        changed = true;
+    }
+    changed |= ImGui::Checkbox("Shift uses VY", &quirks.ShiftUsesVY);
+    ImGui::SameLine();
+    changed |= ImGui::Checkbox("Load/store moves I", &quirks.LoadStoreIncrementsI);
+    ImGui::SameLine();
+    changed |= ImGui::Checkbox("Jump uses VX", &quirks.JumpUsesVX);
+    if (changed) {
+        SessionClaim claim(session);
+        chp.Quirks = quirks;
+    }
+
+    bool predecoded = chp.UsePredecoded;
+    if (ImGui::Checkbox("Predecoded engine", &predecoded)) {
+        SessionClaim claim(session);
+        chp.UsePredecoded = predecoded;
+    }
+    ImGui::SameLine();
+    ImGui::Text("%.1f%% fused", chp.Engine.Dispatches ? 100.0 * chp.Engine.FusedDispatches / chp.Engine.Dispatches : 0.0);
+    bool history = chp.History.Enabled;
+    if (ImGui::Checkbox("Record history", &history)) {
+        // Nothing was logged while it was off, older steps can't be undone across the gap
+        SessionClaim claim(session);
+        auto guard = chp.Lock();
+        chp.History.Clear();
+        chp.History.Enabled = history;
+    }
+    ImGui::SameLine();
+    ImGui::Text("%u steps, %.1f MB", (unsigned)chp.History.Steps(), chp.History.Bytes() / (1024.0 * 1024.0));
+    bool recording = session.Video.Recording();
+    if (ImGui::Checkbox("Record video", &recording)) {
+        // The worker captures into the recorder
+        SessionClaim claim(session);
+        if (recording) {
+            char file[64];
+            snprintf(file, sizeof(file), "chip8-video-%u.c8v", session.Id);
+            session.Video.Start(file);
+        }
+        else {
+            session.Video.Stop();
+        }
+    }
+    if (session.Video.Recording()) {
+        ImGui::SameLine();
+        ImGui::Text("%u frames, %u stored, %u dropped", (unsigned)session.Video.Frames, (unsigned)session.Video.Written, (unsigned)session.Video.Dropped);
+    }
+
+    ImGui::Checkbox("Screen", &view.ShowScreen);
+    ImGui::SameLine();
+    ImGui::Checkbox("Registers", &view.ShowRegisters);
+    ImGui::SameLine();
+    ImGui::Checkbox("Memory", &view.ShowMemory);
+    ImGui::SameLine();
+    ImGui::Checkbox("Debugger", &view.ShowDebugger);
+    ImGui::SameLine();
+    ImGui::Checkbox("Disassembly", &view.ShowDisassembly);
+    if (ImGui::Button("Close session")) {
+        view.Closing = true;
+    }
+    ImGui::End();
+}
+
+// Once per GUI frame, emulation rates are averaged over PERF_RATE_INTERVAL
+static void SamplePerformance() {
+    static auto last = std::chrono::high_resolution_clock::now();
+    static auto window = last;
+    static uint64_t instructions = 0, frames = 0, sleep = 0;
+
+    PerfGuiFrame.Add(static_cast<float>(MillisecondsSince(last)));
+    last = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < PERF_WINDOW_COUNT; ++i) {
+        PerfWindowSeries[i].Add(static_cast<float>(PerfWindowMs[i]));
+        PerfWindowMs[i] = 0.0;
+    }
+    PerfGuardWait.Add(static_cast<float>(PerfGuardWaitMs));
+    PerfGuardWaitMs = 0.0;
+
+    const double span = MillisecondsSince(window) / 1000.0;
+    if (span < PERF_RATE_INTERVAL)
+        return;
+    window = last;
+
+    // Summed over the sessions alive now, a closed one can make the totals shrink
+    uint64_t nowInstructions = 0, nowFrames = 0;
+    for (const auto &session : *Pool.Snapshot()) {
+        nowInstructions += session->Instructions;
+        nowFrames += session->Frames;
+    }
+    const uint64_t nowSleep = Pool.SleepNs;
+    PerfInstructionRate.Add(static_cast<float>(nowInstructions > instructions ? (nowInstructions - instructions) / span : 0.0));
+    PerfFrameRate.Add(static_cast<float>(nowFrames > frames ? (nowFrames - frames) / span : 0.0));
+    PerfBusy.Add(static_cast<float>(std::max(0.0, 100.0 * (1.0 - (nowSleep - sleep) / (span * 1e9 * Pool.Threads())))));
+    instructions = nowInstructions;
+    frames = nowFrames;
+    sleep = nowSleep;
+}
+
+void ShowPerformanceWindow(bool *open) {
+    ImGui::Begin("Performance", open);
+
+    ImGui::Text("Emulation workers (%u), %u sessions", Pool.Threads(), (unsigned)Views.size());
+    PerfInstructionRate.Plot("Instructions/s", "%.0f");
+    PerfFrameRate.Plot("Frames/s", "%.1f");
+    PerfBusy.Plot("Busy %", "%.1f%% busy");
+    ImGui::Separator();
+
+    ImGui::Text("GUI thread, %.1f fps", 1000.0f / std::max(PerfGuiFrame.Average(), 1e-3f));
+    PerfGuiFrame.Plot("Frame ms", "%.2f ms");
+    PerfGuardWait.Plot("DataGuard wait ms", "%.3f ms");
+    if (ImGui::CollapsingHeader("Frame time by window")) {
+        for (int i = 0; i < PERF_WINDOW_COUNT; ++i) {
+            PerfWindowSeries[i].Plot(PerfWindowNames[i], "%.3f ms");
+        }
+    }
+    ImGui::End();
+}
+
+static void ShowPercentiles(const char *label, std::vector<double> values) {
+    if (values.empty()) {
+        ImGui::Text("%-22s no samples", label);
+        return;
+    }
+    std::sort(values.begin(), values.end());
+    auto at = [&](double q) { return values[std::min(values.size() - 1, static_cast<size_t>(q * values.size()))]; };
+    ImGui::Text("%-22s p50 %6.1f  p90 %6.1f  p99 %6.1f  max %6.1f ms", label, at(0.5), at(0.9), at(0.99), values.back());
+}
+
+// The probe follows one session, the one in focus when measuring started
+static void AttachProbe(const std::shared_ptr<Session> &session) {
+    if (Probed) {
+        SessionClaim claim(*Probed);
+        Probed->Machine.Probe = NULL;
+    }
+    Probed = session;
+    if (Probed) {
+        SessionClaim claim(*Probed);
+        Probed->Machine.Probe = &Latency;
+    }
+    MeasureLatency = Probed.get() != NULL;
+}
+
+void ShowLatencyWindow(bool *open) {
+    static std::vector<LatencySample> samples;
+
+    ImGui::Begin("Latency", open);
+
+    bool measure = MeasureLatency;
+    if (ImGui::Checkbox("Measure input latency", &measure)) {
+        AttachProbe(measure ? FocusedSession() : std::shared_ptr<Session>());
+    }
+    if (Probed) {
+        ImGui::SameLine();
+        ImGui::Text("%s [%u]", Probed->Title.c_str(), Probed->Id);
+    }
+    if (ImGui::Button("Clear")) {
+        Latency.Clear();
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Export CSV") && !Latency.ExportCSV("chip8-latency.csv")) {
+        std::cout << "Could not write chip8-latency.csv" << std::endl;
+    }
+
+    // Copied only when new samples came in
+    if (Latency.Count() != samples.size())
+        samples = Latency.Completed();
+    ImGui::Text("%u complete, %u never read, %u read without a visible change", (unsigned)samples.size(),
+                Latency.Unread(), Latency.Invisible());
+    ImGui::Separator();
+
+    std::vector<double> read, change, show, total;
+    float buckets[50] = {};
+    for (const auto &sample : samples) {
+        read.push_back(LatencyMs(sample.Input, sample.Read));
+        change.push_back(LatencyMs(sample.Read, sample.Changed));
+        show.push_back(LatencyMs(sample.Changed, sample.Shown));
+        total.push_back(LatencyMs(sample.Input, sample.Shown));
+        buckets[std::min(49, static_cast<int>(total.back() / 2.0))] += 1.0f;
+    }
+    ShowPercentiles("Key to read", read);
+    ShowPercentiles("Read to screen change", change);
+    ShowPercentiles("Change to swap", show);
+    ShowPercentiles("Key to swap", total);
+    ImGui::PlotHistogram("Key to swap, 2 ms buckets", buckets, 50, 0, NULL, 0.0f, FLT_MAX, ImVec2(0, 80));
+    ImGui::End();
+}
+
+// Host keys for CHIP-8 keys 0 to F, GLFW letter and digit codes are their ASCII values
+static const std::string DefaultKeymap = "x123azeqsdwc4rfv";
+
+// CHIP-8 key for a GLFW key under the session's keymap, -1 when unmapped
+static int MapKey(const Session &session, int key) {
+    const std::string &keys = session.Settings.Keymap.empty() ? DefaultKeymap : session.Settings.Keymap;
+    for (size_t i = 0; i < keys.size() && i < 16; ++i) {
+        if (toupper(keys[i]) == key)
+            return static_cast<int>(i);
+    }
+    return -1;
+}
 
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
 {
-    if (action == GLFW_PRESS || action == GLFW_RELEASE) {
-        chp.Keys[KeyMapping[key]] = action;
+    if (action != GLFW_PRESS && action != GLFW_RELEASE)
+        return;
+    // Only the session in focus hears the keyboard
+    const auto session = FocusedSession();
+    if (!session)
+        return;
+    const int mapped = MapKey(*session, key);
+    if (mapped < 0)
+        return;
+    // Stamped before the machine can see the key
+    if (MeasureLatency && session == Probed)
+        Latency.KeyEvent(static_cast<uint8_t>(mapped), action == GLFW_PRESS);
+    session->Machine.Keys[mapped] = action;
+}
+
+static RomDatabase Database;
+static RomLibrary Library("rom-index.txt");
+
+static RomArchive Archive;
+
+static SessionView &NewSession() {
+    const auto session = Pool.Add();
+    session->Machine.History.Enabled = true;
+    Views.emplace_back(new SessionView(session));
+    Views.back()->Memory.WriteFn = &WriteMemory;
+    Focus(session);
+    return *Views.back();
+}
+
+// Into the session in focus, a first one is made when there is none
+static std::shared_ptr<Session> TargetSession() {
+    const auto session = FocusedSession();
+    return session ? session : NewSession().Owner;
+}
+
+static void LoadProgram(const std::string &path) {
+    const auto session = TargetSession();
+    SessionClaim claim(*session);
+    if (!session->Load(path, Database, &Cache)) {
+        std::cout << "Could not load " << path << std::endl;
+        return;
+    }
+    Library.MarkPlayed(path);
+}
+
+static void LoadProgram(const ArchiveEntry &entry) {
+    const auto session = TargetSession();
+    SessionClaim claim(*session);
+    if (!session->Load(Archive, entry, Database, &Cache)) {
+        std::cout << "Could not load " << Archive.Name(entry) << std::endl;
+    }
+}
+
+// Same program and quirks in a fresh session, handy to compare profiles side by side
+static void DuplicateSession() {
+    const auto source = FocusedSession();
+    SessionView &view = NewSession();
+    if (!source)
+        return;
+    SessionClaim claim(*source);
+    SessionClaim target(*view.Owner);
+    view.Owner->Load(*source, &Cache);
+}
+
+static void CloseSession(SessionView &view) {
+    const auto session = view.Owner;
+    if (session == Probed)
+        AttachProbe(std::shared_ptr<Session>());
+    Pool.Remove(session->Id);
+    {
+        SessionClaim claim(*session);
+        Cache.Store(session->Hash, session->Machine);
+        session->Video.Stop();
     }
+    if (FocusedSession() == session)
+        Focus(Views.size() > 1 ? (Views[0].get() == &view ? Views[1] : Views[0])->Owner : std::shared_ptr<Session>());
 }
 
 int main(void)
 {
-    KeyMapping[GLFW_KEY_X] = E_KEYS::KEY_0;
-    KeyMapping[GLFW_KEY_1] = E_KEYS::KEY_1;
-    KeyMapping[GLFW_KEY_2] = E_KEYS::KEY_2;
-    KeyMapping[GLFW_KEY_3] = E_KEYS::KEY_3;
-    KeyMapping[GLFW_KEY_A] = E_KEYS::KEY_4;
-    KeyMapping[GLFW_KEY_Z] = E_KEYS::KEY_5;
-    KeyMapping[GLFW_KEY_E] = E_KEYS::KEY_6;
-    KeyMapping[GLFW_KEY_Q] = E_KEYS::KEY_7;
-    KeyMapping[GLFW_KEY_S] = E_KEYS::KEY_8;
-    KeyMapping[GLFW_KEY_D] = E_KEYS::KEY_9;
-    KeyMapping[GLFW_KEY_W] = E_KEYS::KEY_A;
-    KeyMapping[GLFW_KEY_C] = E_KEYS::KEY_B;
-    KeyMapping[GLFW_KEY_4] = E_KEYS::KEY_C;
-    KeyMapping[GLFW_KEY_R] = E_KEYS::KEY_D;
-    KeyMapping[GLFW_KEY_F] = E_KEYS::KEY_E;
-    KeyMapping[GLFW_KEY_V] = E_KEYS::KEY_F;
+    Database.Load("roms.db");
+    Library.AddDirectory("./GAMES");
+    Library.Start();
+    // Optional, the packed corpus shows up in the File menu when present
+    Archive.Open("roms.c8pk");
 
     // CHIP8 chip8;
     
     // chip8.Init();
     // while (chip8.Cycle()){}
-    ProgramReader pr;
-    pr.Load("PONG.ch8");
-    for (uint16_t i = 0; i < pr.Program.size(); ++i) {
-        chp.memory[0x200+i] = pr.Program[i];
-    }
-    chp.Init();
 
     //GLFWwindow* window;
 
@@ -170,22 +984,25 @@ int main(void)
     //ImGui::StyleColorsClassic();
 
     bool show_demo_window = true;
-    bool show_another_window = true;
+    bool show_performance_window = true;
+    bool show_latency_window = false;
     ImVec4 clear_color = ImVec4(0.1f, 0.55f, 0.60f, 1.00f);
     auto start = std::chrono::system_clock::now();
 
-    std::thread t(&CHIP8Loop);
+    // Textures need the GL context, so sessions come after it
+    Pool.Start();
+    LoadProgram("PONG.ch8");
+
+    AudioOut.reset(new NullAudioSink());
+    AudioOut->Start(Audio);
+
+    std::thread t(&AudioLoop);
 
     glfwSetKeyCallback(window, key_callback);
 
     /* Loop until the user closes the window */
     while (!glfwWindowShouldClose(window))
     {
-
-
-        auto info = chp.GetInfo();
-
-
         // Poll and handle events (inputs, window resize, etc.)
         // You can read the io.WantCaptureMouse, io.WantCaptureKeyboard flags to tell if dear imgui wants to use your inputs.
         // - When io.WantCaptureMouse is true, do not dispatch mouse input data to your main application.
@@ -198,80 +1015,143 @@ int main(void)
         ImGui_ImplGlfw_NewFrame();
         ImGui::NewFrame();
 
-        {
-            chp.DataGuard.lock();
-            if (show_another_window) {
-                ShowRegisterWindow(&show_another_window, info);
-            }
+        for (const auto &entry : Views) {
+            SessionView &view = *entry;
 
+            // Consistent without DataGuard, the worker is never held up
+            const CHIP8_INFO info = view.Owner->Machine.Snapshot();
 
-            if (show_another_window) {
-                ShowScreen(&show_another_window, chp);
+            if (view.ShowRegisters) {
+                PerfScope perf(PERF_REGISTERS);
+                ShowRegisterWindow(view, info);
+            }
+            if (view.ShowScreen) {
+                PerfScope perf(PERF_SCREEN);
+                ShowScreen(view);
+            }
+            if (view.ShowDebugger) {
+                PerfScope perf(PERF_DEBUGGER);
+                ShowDebuggerWindow(view);
+            }
+            if (view.ShowDisassembly) {
+                PerfScope perf(PERF_DISASSEMBLY);
+                ShowDisassemblyWindow(view, info);
+            }
+            if (view.ShowMemory) {
+                PerfScope perf(PERF_MEMORY);
+                ShowMemoryWindow(view, info);
+            }
+            if (view.ShowControls) {
+                PerfScope perf(PERF_CONTROLS);
+                ShowControlsWindow(view, info);
             }
-            chp.DataGuard.unlock();
         }
 
-        ImGui::ShowDemoWindow(&show_demo_window);
-        mem_edit_1.HighlightMin = info.PC;
-        mem_edit_1.HighlightMax = info.PC + 2;
-        mem_edit_1.HighlightColor = IM_COL32(255, 0, 0, 90);
-        mem_edit_1.DrawWindow("Memory Editor", chp.memory, 4096, 0x0000);
-
-        ImGui::Begin("Controls");
-        if (ImGui::Button("Step")) {
-            for (uint8_t i = 0; i < 15; ++i) {
-                PrevV[i] = info.V[i];
+        // Closed sessions leave once none of their windows is being drawn
+        for (size_t i = 0; i < Views.size();) {
+            if (Views[i]->Closing) {
+                CloseSession(*Views[i]);
+                Views.erase(Views.begin() + i);
+            }
+            else {
+                ++i;
             }
-            chp.Cycle();
         }
-        ImGui::SameLine();
-        if (ImGui::Button("Pause")) {
-            FreeRunning = false;
+
+        {
+            PerfScope perf(PERF_DEMO);
+            ImGui::ShowDemoWindow(&show_demo_window);
         }
-        ImGui::SameLine();
-        if (ImGui::Button("Run")) {
-            FreeRunning = true;
+        if (show_performance_window) {
+            ShowPerformanceWindow(&show_performance_window);
         }
-        ImGui::SameLine();
-        if (ImGui::Button("Restart")) {
-            chp.Init();
+        if (show_latency_window) {
+            ShowLatencyWindow(&show_latency_window);
+        }
+
+        const auto controls = std::chrono::high_resolution_clock::now();
+        ImGui::Begin("Controls");
+        if (ImGui::Checkbox("Record audio", &RecordAudio)) {
+            AudioOut->Stop();
+            if (RecordAudio) {
+                AudioOut.reset(new WavAudioSink("chip8-audio.wav"));
+            }
+            else {
+                AudioOut.reset(new NullAudioSink());
+            }
+            AudioOut->Start(Audio);
         }
-        ImGui::SliderFloat("Clock Speed", &chp.ClockSpeed, 0.0f, 0.4f, "%.8f");
+        ImGui::Checkbox("Performance", &show_performance_window);
+        ImGui::SameLine();
+        ImGui::Checkbox("Latency", &show_latency_window);
         ImGui::End();
 
         if (ImGui::BeginMainMenuBar())
         {
             if (ImGui::BeginMenu("File"))
             {
-                std::string path = "./GAMES";
-                for (auto & p : std::experimental::filesystem::directory_iterator(path)) {
-                    auto path = p.path();
-                    if (ImGui::MenuItem(path.string().c_str())) {
-                        chp.ClearMemory();
-                        pr.Load(path.string());
-                        for (uint16_t i = 0; i < pr.Program.size(); ++i) {
-                            chp.memory[0x200 + i] = pr.Program[i];
+                // Served from the library index, no filesystem access here
+                auto roms = Library.Snapshot();
+                std::vector<const RomEntry *> recent;
+                for (const auto &rom : *roms) {
+                    if (rom.LastPlayed != 0)
+                        recent.push_back(&rom);
+                }
+                std::sort(recent.begin(), recent.end(), [](const RomEntry *a, const RomEntry *b) {
+                    return a->LastPlayed > b->LastPlayed;
+                });
+                if (ImGui::BeginMenu("Recent", !recent.empty())) {
+                    for (size_t i = 0; i < recent.size() && i < 10; ++i) {
+                        if (ImGui::MenuItem(recent[i]->Title.c_str())) {
+                            LoadProgram(recent[i]->Path);
+                        }
+                    }
+                    ImGui::EndMenu();
+                }
+                for (const auto &rom : *roms) {
+                    if (ImGui::MenuItem(rom.Title.c_str(), rom.Path.c_str())) {
+                        LoadProgram(rom.Path);
+                    }
+                }
+                if (ImGui::BeginMenu("Archive", Archive.Count() > 0)) {
+                    for (size_t i = 0; i < Archive.Count(); ++i) {
+                        const ArchiveEntry &entry = Archive.Entry(i);
+                        if (ImGui::MenuItem(Archive.Name(entry))) {
+                            LoadProgram(entry);
                         }
-                        chp.Init();
                     }
+                    ImGui::EndMenu();
                 }
+                if (ImGui::MenuItem("Rescan library")) {
+                    Library.Rescan();
+                }
+                ImGui::Separator();
 
                 if (ImGui::MenuItem("PONG")) {
-                    chp.ClearMemory();
-                    pr.Load("PONG.ch8");
-                    for (uint16_t i = 0; i < pr.Program.size(); ++i) {
-                        chp.memory[0x200 + i] = pr.Program[i];
-                    }
-                    chp.Init();
+                    LoadProgram("PONG.ch8");
                 }
 
                 if (ImGui::MenuItem("MAZE")) {
-                    chp.ClearMemory();
-                    pr.Load("MAZE.ch8");
-                    for (uint16_t i = 0; i < pr.Program.size(); ++i) {
-                        chp.memory[0x200 + i] = pr.Program[i];
+                    LoadProgram("MAZE.ch8");
+                }
+                ImGui::EndMenu();
+            }
+            if (ImGui::BeginMenu("Session"))
+            {
+                // Loads from the File menu go to the session in focus
+                if (ImGui::MenuItem("New session")) {
+                    NewSession();
+                }
+                if (ImGui::MenuItem("Duplicate session", NULL, false, FocusedSession().get() != NULL)) {
+                    DuplicateSession();
+                }
+                ImGui::Separator();
+                for (const auto &view : Views) {
+                    char label[160];
+                    snprintf(label, sizeof(label), "%s [%u]", view->Owner->Title.c_str(), view->Owner->Id);
+                    if (ImGui::MenuItem(label, NULL, FocusedSession() == view->Owner)) {
+                        Focus(view->Owner);
                     }
-                    chp.Init();
                 }
                 ImGui::EndMenu();
             }
@@ -287,8 +1167,10 @@ int main(void)
             }
             ImGui::EndMainMenuBar();
         }
+        PerfWindowMs[PERF_CONTROLS] += MillisecondsSince(controls);
 
         // Rendering
+        const auto render = std::chrono::high_resolution_clock::now();
         ImGui::Render();
         int display_w, display_h;
         glfwMakeContextCurrent(window);
@@ -300,10 +1182,28 @@ int main(void)
 
         glfwMakeContextCurrent(window);
         glfwSwapBuffers(window);
+        PerfWindowMs[PERF_RENDER] += MillisecondsSince(render);
+        if (MeasureLatency)
+            Latency.Presented();
+
+        SamplePerformance();
     }
 
+    Quit = true;
     t.join();
 
+    AttachProbe(std::shared_ptr<Session>());
+    Pool.Stop();
+    for (const auto &view : Views) {
+        Cache.Store(view->Owner->Hash, view->Owner->Machine);
+        view->Owner->Video.Stop();
+    }
+    // Textures go before the context does
+    Views.clear();
+    Library.Stop();
+
+    AudioOut->Stop();
+
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
     ImGui::DestroyContext();
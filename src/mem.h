@@ -1,3 +1,5 @@
+#pragma once
+
 #include <cstdint>
 
 #define FONT_SIZE 5 * sizeof(uint8_t)
@@ -18,3 +20,47 @@ const uint8_t font_C[] = { 0xF0, 0x80, 0x80, 0x80, 0xF0 };
 const uint8_t font_D[] = { 0xE0, 0x90, 0x90, 0x90, 0xE0 };
 const uint8_t font_E[] = { 0xF0, 0x80, 0xF0, 0x80, 0xF0 };
 const uint8_t font_F[] = { 0xF0, 0x80, 0xF0, 0x80, 0x80 };
+
+// SUPER-CHIP 8x10 digits for Fx30, XO-CHIP adds A to F
+#define BIG_FONT_SIZE 10
+#define BIG_FONT_START 0x50
+const uint8_t big_font[16 * BIG_FONT_SIZE] = {
+    0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF,
+    0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF,
+    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF,
+    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF,
+    0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03,
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF,
+    0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18,
+    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF,
+    0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3,
+    0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC,
+    0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C,
+    0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC,
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0
+};
+
+#define MEMORY_SIZE 4096
+#define PROGRAM_START 0x200
+
+// Every access is masked into range instead of bounds checked, so no
+// program can reach outside the machine. Sizes must stay powers of two.
+#define MEMORY_MASK (MEMORY_SIZE - 1)
+// XO-CHIP reaches 64K through I, code stays in the first MEMORY_SIZE bytes
+#define XO_MEMORY_SIZE 65536
+#define XO_MEMORY_MASK (XO_MEMORY_SIZE - 1)
+#define STACK_SIZE 32
+#define STACK_MASK (STACK_SIZE - 1)
+#define SCREEN_WIDTH 64
+#define SCREEN_HEIGHT 32
+// SUPER-CHIP high resolution, XO-CHIP draws it in two bitplanes
+#define HIRES_WIDTH 128
+#define HIRES_HEIGHT 64
+#define DISPLAY_PLANES 2
+
+// Granularity of copy-on-write memory in forked VM states
+#define PAGE_SIZE 256
+#define PAGE_COUNT (MEMORY_SIZE / PAGE_SIZE)
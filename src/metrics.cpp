@@ -0,0 +1,299 @@
+#include "metrics.h"
+#include "chip8.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#ifndef _WIN32
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+MetricsInstance::MetricsInstance() : Instructions(0), IdleSkipped(0), Frames(0), Loads(0), LoadNs(0), Machine(NULL) {
+}
+
+MetricsExporter::MetricsExporter() : NextId(0), UseSocket(false), Socket(-1), IntervalMs(1000), Running(false) {
+    memset(&Retired, 0, sizeof(Retired));
+}
+
+MetricsExporter::~MetricsExporter() {
+    Stop();
+}
+
+bool MetricsExporter::Start(const std::string &target, uint32_t intervalMs) {
+    Stop();
+    Error.clear();
+    IntervalMs = std::max(intervalMs, 10u);
+    UseSocket = target.compare(0, 5, "unix:") == 0;
+    Target = UseSocket ? target.substr(5) : target;
+
+    if (UseSocket) {
+#ifdef _WIN32
+        Error = "Unix sockets are not supported on this platform, export to a file instead";
+        return false;
+#else
+        sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (Target.empty() || Target.size() >= sizeof(address.sun_path)) {
+            Error = "Socket path is empty or too long: " + Target;
+            return false;
+        }
+        strncpy(address.sun_path, Target.c_str(), sizeof(address.sun_path) - 1);
+
+        Socket = socket(AF_UNIX, SOCK_STREAM, 0);
+        // A previous run may have left its socket behind
+        unlink(Target.c_str());
+        if (Socket < 0 || bind(Socket, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || listen(Socket, 8) != 0) {
+            Error = "Could not listen on " + Target + ": " + strerror(errno);
+            if (Socket >= 0)
+                close(Socket);
+            Socket = -1;
+            return false;
+        }
+#endif
+    }
+
+    Running = true;
+    Worker = std::thread(&MetricsExporter::Run, this);
+    return true;
+}
+
+void MetricsExporter::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(Guard);
+        if (!Running)
+            return;
+        Running = false;
+    }
+    Wake.notify_all();
+    Worker.join();
+
+#ifndef _WIN32
+    if (Socket >= 0) {
+        close(Socket);
+        unlink(Target.c_str());
+        Socket = -1;
+    }
+#endif
+}
+
+void MetricsExporter::Add(MetricsInstance &instance, const std::string &label) {
+    const auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(Guard);
+    Tracked tracked;
+    tracked.Instance = &instance;
+    tracked.Id = NextId++;
+    tracked.Label = label;
+    tracked.LastInstructions = instance.Instructions.load(std::memory_order_relaxed);
+    tracked.LastSample = now;
+    tracked.LastProgress = now;
+    tracked.Speed = 0.0;
+    Instances.push_back(tracked);
+}
+
+void MetricsExporter::SetLabel(MetricsInstance &instance, const std::string &label) {
+    std::lock_guard<std::mutex> lock(Guard);
+    for (auto &tracked : Instances) {
+        if (tracked.Instance == &instance)
+            tracked.Label = label;
+    }
+}
+
+void MetricsExporter::Remove(MetricsInstance &instance) {
+    std::lock_guard<std::mutex> lock(Guard);
+    for (auto it = Instances.begin(); it != Instances.end(); ++it) {
+        if (it->Instance == &instance) {
+            Accumulate(Retired, instance);
+            Instances.erase(it);
+            return;
+        }
+    }
+}
+
+void MetricsExporter::Accumulate(Totals &totals, const MetricsInstance &instance) {
+    totals.Instructions += instance.Instructions.load(std::memory_order_relaxed);
+    totals.IdleSkipped += instance.IdleSkipped.load(std::memory_order_relaxed);
+    totals.Frames += instance.Frames.load(std::memory_order_relaxed);
+    totals.Loads += instance.Loads.load(std::memory_order_relaxed);
+    totals.LoadNs += instance.LoadNs.load(std::memory_order_relaxed);
+    if (instance.Machine) {
+        totals.LockContended += instance.Machine->LockContended.load(std::memory_order_relaxed);
+        totals.LockWaitNs += instance.Machine->LockWaitNs.load(std::memory_order_relaxed);
+    }
+}
+
+void MetricsExporter::Sample() {
+    const auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(Guard);
+    for (auto &tracked : Instances) {
+        const uint64_t instructions = tracked.Instance->Instructions.load(std::memory_order_relaxed);
+        const std::chrono::duration<double> span = now - tracked.LastSample;
+        if (span.count() > 0.0)
+            tracked.Speed = (instructions - tracked.LastInstructions) / span.count();
+        if (instructions != tracked.LastInstructions)
+            tracked.LastProgress = now;
+        tracked.LastInstructions = instructions;
+        tracked.LastSample = now;
+    }
+}
+
+static std::string Escape(const std::string &value) {
+    std::string escaped;
+    for (char c : value) {
+        if (c == '\\' || c == '"' || c == '\n')
+            escaped += '\\';
+        escaped += c == '\n' ? 'n' : c;
+    }
+    return escaped;
+}
+
+static void Header(std::string &out, const char *name, const char *type, const char *help) {
+    out += std::string("# HELP ") + name + " " + help + "\n# TYPE " + name + " " + type + "\n";
+}
+
+static void Value(std::string &out, const char *name, const std::string &labels, double value) {
+    char number[32];
+    snprintf(number, sizeof(number), "%.15g", value);
+    out += name;
+    out += labels;
+    out += ' ';
+    out += number;
+    out += '\n';
+}
+
+std::string MetricsExporter::Render() {
+    const auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(Guard);
+
+    Totals totals = Retired;
+    for (const auto &tracked : Instances) {
+        Accumulate(totals, *tracked.Instance);
+    }
+
+    std::string out;
+    Header(out, "chip8_instances", "gauge", "VM instances currently registered");
+    Value(out, "chip8_instances", "", static_cast<double>(Instances.size()));
+    Header(out, "chip8_instructions_total", "counter", "Instructions executed by all instances");
+    Value(out, "chip8_instructions_total", "", static_cast<double>(totals.Instructions));
+    Header(out, "chip8_idle_skipped_total", "counter", "Instructions not run because the program was waiting");
+    Value(out, "chip8_idle_skipped_total", "", static_cast<double>(totals.IdleSkipped));
+    Header(out, "chip8_frames_total", "counter", "Frames emulated by all instances");
+    Value(out, "chip8_frames_total", "", static_cast<double>(totals.Frames));
+    Header(out, "chip8_loads_total", "counter", "Programs loaded");
+    Value(out, "chip8_loads_total", "", static_cast<double>(totals.Loads));
+    Header(out, "chip8_load_seconds_total", "counter", "Time spent loading programs");
+    Value(out, "chip8_load_seconds_total", "", totals.LoadNs / 1e9);
+    Header(out, "chip8_lock_contended_total", "counter", "DataGuard acquisitions that had to wait");
+    Value(out, "chip8_lock_contended_total", "", static_cast<double>(totals.LockContended));
+    Header(out, "chip8_lock_wait_seconds_total", "counter", "Time spent waiting for DataGuard");
+    Value(out, "chip8_lock_wait_seconds_total", "", totals.LockWaitNs / 1e9);
+
+    // Per instance series, labelled with a stable id and the current ROM
+    std::vector<std::string> labels;
+    for (const auto &tracked : Instances) {
+        labels.push_back("{instance=\"" + std::to_string(tracked.Id) + "\",rom=\"" + Escape(tracked.Label) + "\"}");
+    }
+    Header(out, "chip8_instance_instructions_total", "counter", "Instructions executed by the instance");
+    for (size_t i = 0; i < Instances.size(); ++i) {
+        Value(out, "chip8_instance_instructions_total", labels[i], static_cast<double>(Instances[i].Instance->Instructions.load(std::memory_order_relaxed)));
+    }
+    Header(out, "chip8_instance_frames_total", "counter", "Frames emulated by the instance");
+    for (size_t i = 0; i < Instances.size(); ++i) {
+        Value(out, "chip8_instance_frames_total", labels[i], static_cast<double>(Instances[i].Instance->Frames.load(std::memory_order_relaxed)));
+    }
+    Header(out, "chip8_instance_speed_ips", "gauge", "Instructions per second over the last interval");
+    for (size_t i = 0; i < Instances.size(); ++i) {
+        Value(out, "chip8_instance_speed_ips", labels[i], Instances[i].Speed);
+    }
+    Header(out, "chip8_instance_stalled_seconds", "gauge", "Time since the instance last executed an instruction");
+    for (size_t i = 0; i < Instances.size(); ++i) {
+        const std::chrono::duration<double> stalled = now - Instances[i].LastProgress;
+        Value(out, "chip8_instance_stalled_seconds", labels[i], stalled.count());
+    }
+    return out;
+}
+
+bool MetricsExporter::WriteFile(const std::string &text) {
+    // Scrapers must never see a half written file
+    const std::string temporary = Target + ".tmp";
+    {
+        std::ofstream file(temporary.c_str(), std::ios::trunc);
+        file << text;
+        if (!file)
+            return false;
+    }
+    return rename(temporary.c_str(), Target.c_str()) == 0;
+}
+
+void MetricsExporter::Serve(uint32_t timeoutMs) {
+#ifndef _WIN32
+    pollfd listening = { Socket, POLLIN, 0 };
+    if (poll(&listening, 1, static_cast<int>(timeoutMs)) <= 0)
+        return;
+    const int client = accept(Socket, NULL, NULL);
+    if (client < 0)
+        return;
+
+    // Anything sent is taken as a scrape, plain HTTP clients get a response they understand
+    pollfd request = { client, POLLIN, 0 };
+    char discard[1024];
+    if (poll(&request, 1, 100) > 0 && recv(client, discard, sizeof(discard), 0) < 0) {
+        close(client);
+        return;
+    }
+
+    const std::string body = Render();
+    const std::string response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+                                 std::to_string(body.size()) + "\r\n\r\n" + body;
+    size_t sent = 0;
+    while (sent < response.size()) {
+        const ssize_t written = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+        if (written <= 0)
+            break;
+        sent += written;
+    }
+    close(client);
+#endif
+}
+
+void MetricsExporter::Run() {
+    auto next = std::chrono::steady_clock::now();
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(Guard);
+            if (!Running)
+                break;
+        }
+
+        const auto now = std::chrono::steady_clock::now();
+        if (now >= next) {
+            Sample();
+            if (!UseSocket && !WriteFile(Render()))
+                std::cout << "Could not write metrics to " << Target << std::endl;
+            next = now + std::chrono::milliseconds(IntervalMs);
+        }
+
+        // Short waits keep Stop responsive while a socket is being served
+        const int64_t due = std::chrono::duration_cast<std::chrono::milliseconds>(next - std::chrono::steady_clock::now()).count();
+        const uint32_t wait = static_cast<uint32_t>(std::max<int64_t>(1, std::min<int64_t>(100, due + 1)));
+        if (UseSocket) {
+            Serve(wait);
+        }
+        else {
+            std::unique_lock<std::mutex> lock(Guard);
+            Wake.wait_for(lock, std::chrono::milliseconds(wait), [&] { return !Running; });
+        }
+    }
+
+    // Leave the final counts behind for whoever reads the file after the run
+    if (!UseSocket) {
+        Sample();
+        WriteFile(Render());
+    }
+}
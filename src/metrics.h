@@ -0,0 +1,112 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class CHIP8;
+
+// Counters of one VM, bumped only by the thread running it. Single writer,
+// so a bump is a plain load and store rather than a locked add; the
+// exporter reads them from its own thread.
+class MetricsInstance {
+public:
+    MetricsInstance();
+
+    // After every Run, instructions the machine did not take count as idle
+    void Ran(uint32_t executed, uint32_t requested) {
+        Bump(Instructions, executed);
+        Bump(IdleSkipped, requested - executed);
+    }
+    void Frame() { Bump(Frames, 1); }
+    void Loaded(std::chrono::steady_clock::duration took) {
+        Bump(Loads, 1);
+        Bump(LoadNs, std::chrono::duration_cast<std::chrono::nanoseconds>(took).count());
+    }
+
+    std::atomic<uint64_t> Instructions;
+    std::atomic<uint64_t> IdleSkipped;
+    std::atomic<uint64_t> Frames;
+    std::atomic<uint64_t> Loads;
+    std::atomic<uint64_t> LoadNs;
+
+    // Lock contention is read from the machine, may be NULL
+    const CHIP8 *Machine;
+
+private:
+    static void Bump(std::atomic<uint64_t> &counter, uint64_t amount) {
+        counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+};
+
+// Publishes the counters of every registered instance as Prometheus text,
+// either rewritten into a file every interval or served on a Unix socket
+// to whoever connects:
+//   --metrics chip8.prom          node exporter textfile collector
+//   --metrics unix:/run/chip8.sock    curl --unix-socket /run/chip8.sock http://x/metrics
+// Per instance speed and the time since it last made progress are worked
+// out here, once per interval, so stuck VMs stand out without a debugger.
+class MetricsExporter {
+public:
+    MetricsExporter();
+    ~MetricsExporter();
+
+    bool Start(const std::string &target, uint32_t intervalMs = 1000);
+    void Stop();
+
+    // Labels are set off the hot path, typically once per ROM
+    void Add(MetricsInstance &instance, const std::string &label);
+    void SetLabel(MetricsInstance &instance, const std::string &label);
+    void Remove(MetricsInstance &instance);
+
+    // Current text, any thread
+    std::string Render();
+
+    std::string Error;
+
+private:
+    struct Tracked {
+        MetricsInstance *Instance;
+        uint32_t Id;
+        std::string Label;
+        uint64_t LastInstructions;
+        std::chrono::steady_clock::time_point LastSample;
+        std::chrono::steady_clock::time_point LastProgress;
+        double Speed;
+    };
+
+    // Totals of instances that were removed, keeps the farm counters monotonic
+    struct Totals {
+        uint64_t Instructions;
+        uint64_t IdleSkipped;
+        uint64_t Frames;
+        uint64_t Loads;
+        uint64_t LoadNs;
+        uint64_t LockContended;
+        uint64_t LockWaitNs;
+    };
+
+    void Run();
+    void Sample();
+    bool WriteFile(const std::string &text);
+    void Serve(uint32_t timeoutMs);
+    static void Accumulate(Totals &totals, const MetricsInstance &instance);
+
+    std::mutex Guard;
+    std::vector<Tracked> Instances;
+    Totals Retired;
+    uint32_t NextId;
+
+    std::string Target;
+    bool UseSocket;
+    int Socket;
+    uint32_t IntervalMs;
+
+    std::thread Worker;
+    std::condition_variable Wake;
+    bool Running;
+};
@@ -0,0 +1,362 @@
+#include "predecoded-engine.h"
+#include "chip8.h"
+
+static uint16_t ReadOpcode(const uint8_t *memory, uint16_t address) {
+    return (memory[address & MEMORY_MASK] << 8) | memory[(address + 1) & MEMORY_MASK];
+}
+
+PredecodedEngine::PredecodedEngine() {
+    Fusion = true;
+    Dispatches = 0;
+    FusedDispatches = 0;
+    Generation = 0;
+}
+
+void PredecodedEngine::Invalidate() {
+    Valid.reset();
+}
+
+DecodedOp PredecodedEngine::DecodeAt(const uint8_t *memory, uint16_t pc) const {
+    DecodedOp op;
+    op.Op = OP_FALLBACK;
+    op.NN2 = 0;
+
+    const uint16_t opcode = ReadOpcode(memory, pc);
+    op.X = (opcode & 0x0F00) >> 8;
+    op.Y = (opcode & 0x00F0) >> 4;
+    op.N = opcode & 0x000F;
+    op.NN = opcode & 0x00FF;
+    op.NNN = opcode & 0x0FFF;
+
+    switch (opcode & 0xF000) {
+    case 0x0000:
+        if (opcode == 0x00EE)
+            op.Op = OP_RET;
+        break;
+    case 0x1000:
+        op.Op = OP_JP;
+        break;
+    case 0x2000:
+        op.Op = OP_CALL;
+        break;
+    case 0x3000:
+        op.Op = OP_SE_IMM;
+        break;
+    case 0x4000:
+        op.Op = OP_SNE_IMM;
+        break;
+    case 0x5000:
+        if (op.N == 0x00)
+            op.Op = OP_SE_REG;
+        break;
+    case 0x6000:
+        op.Op = OP_LD_IMM;
+        break;
+    case 0x7000:
+        op.Op = OP_ADD_IMM;
+        break;
+    case 0x8000:
+        if (op.N == 0x00)
+            op.Op = OP_LD_REG;
+        break;
+    case 0x9000:
+        op.Op = OP_SNE_REG;
+        break;
+    case 0xA000:
+        op.Op = OP_LD_I;
+        break;
+    case 0xD000:
+        op.Op = OP_DRW;
+        break;
+    case 0xF000:
+        if (op.NN == 0x07)
+            op.Op = OP_LD_DT;
+        break;
+    }
+
+    // XO-CHIP skips step over all of F000 nnnn, the interpreter knows how far
+    const bool skip = op.Op == OP_SE_IMM || op.Op == OP_SNE_IMM || op.Op == OP_SE_REG || op.Op == OP_SNE_REG;
+    if (skip && ReadOpcode(memory, pc + 2) == 0xF000)
+        op.Op = OP_FALLBACK;
+    return op;
+}
+
+DecodedOp PredecodedEngine::Fuse(const uint8_t *memory, uint16_t pc, const DecodedOp &first) const {
+    if (pc + 3 >= MEMORY_SIZE)
+        return first;
+
+    const DecodedOp second = DecodeAt(memory, pc + 2);
+    DecodedOp fused = first;
+
+    if (first.Op == OP_LD_I && second.Op == OP_DRW) {
+        fused.Op = OP_LD_I_DRW;
+        fused.X = second.X;
+        fused.Y = second.Y;
+        fused.N = second.N;
+        return fused;
+    }
+    if (first.Op == OP_LD_IMM && second.Op == OP_LD_IMM) {
+        fused.Op = OP_LD_IMM2;
+        fused.Y = second.X;
+        fused.NN2 = second.NN;
+        return fused;
+    }
+
+    if (pc + 5 >= MEMORY_SIZE)
+        return first;
+
+    const DecodedOp third = DecodeAt(memory, pc + 4);
+    if (first.Op == OP_ADD_IMM && (second.Op == OP_SE_IMM || second.Op == OP_SNE_IMM) &&
+        second.X == first.X && third.Op == OP_JP) {
+        fused.Op = second.Op == OP_SE_IMM ? OP_ADD_SE_JP : OP_ADD_SNE_JP;
+        fused.NN2 = second.NN;
+        fused.NNN = third.NNN;
+        return fused;
+    }
+    if (first.Op == OP_LD_DT && second.Op == OP_SE_IMM && second.X == first.X && second.NN == 0x00 &&
+        third.Op == OP_JP && third.NNN == pc) {
+        fused.Op = OP_WAIT_DT;
+        return fused;
+    }
+    return first;
+}
+
+const DecodedOp &PredecodedEngine::Decode(CHIP8 &chp, uint16_t pc) {
+    if (!Valid[pc]) {
+        DecodedOp op = DecodeAt(chp.memory, pc);
+        if (Fusion)
+            op = Fuse(chp.memory, pc, op);
+
+        Ops[pc] = op;
+        Valid.set(pc);
+
+        // Ask the core to report writes over anything we decoded, fused ops read 6 bytes
+        for (uint16_t i = 0; i < 6; ++i) {
+            chp.CodeMap.set((pc + i) & MEMORY_MASK);
+        }
+    }
+    return Ops[pc];
+}
+
+uint32_t PredecodedEngine::Run(CHIP8 &chp, uint32_t budget) {
+    if (chp.Blocked)
+        return 0;
+
+    auto guard = chp.Lock();
+
+    // Both stay on the fast path, an armed debugger costs a bit test per dispatch
+    const bool armed = chp.Debug.Armed;
+    const bool record = chp.History.Enabled;
+
+    uint32_t executed = 0;
+    uint16_t last = chp.PC;
+    while (executed < budget && !chp.Blocked) {
+        if (Generation != chp.CodeGeneration) {
+            Invalidate();
+            Generation = chp.CodeGeneration;
+        }
+
+        const uint16_t pc = chp.PC &= MEMORY_MASK;
+        const DecodedOp &op = Decode(chp, pc);
+        const uint32_t remaining = budget - executed;
+        uint8_t *V = chp.V;
+        last = pc;
+        ++Dispatches;
+
+        // Fused ops run as single instructions when they would step over a
+        // breakpoint, or a watched sprite read behind Annn
+        uint8_t kind = op.Op;
+        if (kind >= OP_LD_I_DRW) {
+            const uint32_t span = kind >= OP_ADD_SE_JP ? 3 : 2;
+            if (remaining < span)
+                kind = OP_FALLBACK;
+            else if (armed && (chp.Debug.Stops(pc + 2) || (span == 3 && chp.Debug.Stops(pc + 4)) ||
+                               (kind == OP_LD_I_DRW && chp.Debug.WatchArmed)))
+                kind = OP_FALLBACK;
+        }
+
+        if (armed) {
+            const bool access = chp.Debug.WatchArmed && (kind == OP_DRW || kind == OP_FALLBACK);
+            if ((chp.Debug.Resuming || chp.Debug.Stops(pc) || access) && chp.CheckDebugger())
+                break;
+        }
+        // Fused handlers record each of their instructions themselves
+        if (record && kind < OP_LD_I_DRW)
+            chp.History.Record(chp);
+
+        switch (kind) {
+        case OP_JP:
+            chp.CountDown();
+            chp.PC = op.NNN;
+            executed += 1;
+            break;
+        case OP_CALL:
+            chp.CountDown();
+            chp.SP = (chp.SP + 1) & STACK_MASK;
+            chp.stack[chp.SP] = chp.PC;
+            chp.PC = op.NNN;
+            executed += 1;
+            break;
+        case OP_RET:
+            chp.CountDown();
+            chp.PC = chp.stack[chp.SP];
+            chp.SP = (chp.SP - 1) & STACK_MASK;
+            chp.PC += 2;
+            executed += 1;
+            break;
+        case OP_SE_IMM:
+            chp.CountDown();
+            chp.PC += V[op.X] == op.NN ? 4 : 2;
+            executed += 1;
+            break;
+        case OP_SNE_IMM:
+            chp.CountDown();
+            chp.PC += V[op.X] != op.NN ? 4 : 2;
+            executed += 1;
+            break;
+        case OP_SE_REG:
+            chp.CountDown();
+            chp.PC += V[op.X] == V[op.Y] ? 4 : 2;
+            executed += 1;
+            break;
+        case OP_SNE_REG:
+            chp.CountDown();
+            chp.PC += V[op.X] != V[op.Y] ? 4 : 2;
+            executed += 1;
+            break;
+        case OP_LD_IMM:
+            chp.CountDown();
+            V[op.X] = op.NN;
+            chp.PC += 2;
+            executed += 1;
+            break;
+        case OP_ADD_IMM:
+            chp.CountDown();
+            V[op.X] += op.NN;
+            chp.PC += 2;
+            executed += 1;
+            break;
+        case OP_LD_REG:
+            chp.CountDown();
+            V[op.X] = V[op.Y];
+            chp.PC += 2;
+            executed += 1;
+            break;
+        case OP_LD_I:
+            chp.CountDown();
+            chp.I = op.NNN;
+            chp.PC += 2;
+            executed += 1;
+            break;
+        case OP_DRW:
+            chp.CountDown();
+            chp.DrawSprite(op.X, op.Y, op.N);
+            chp.PC += 2;
+            executed += 1;
+            break;
+        case OP_LD_DT:
+            chp.CountDown();
+            V[op.X] = chp.Delay;
+            chp.PC += 2;
+            executed += 1;
+            break;
+
+        // PC moves on between the fused instructions so history sees each of them
+        case OP_LD_I_DRW:
+            ++FusedDispatches;
+            if (record)
+                chp.History.Record(chp);
+            chp.CountDown();
+            chp.I = op.NNN;
+            chp.PC += 2;
+            if (record)
+                chp.History.Record(chp);
+            chp.CountDown();
+            chp.DrawSprite(op.X, op.Y, op.N);
+            chp.PC += 2;
+            executed += 2;
+            break;
+        case OP_LD_IMM2:
+            ++FusedDispatches;
+            if (record)
+                chp.History.Record(chp);
+            chp.CountDown();
+            V[op.X] = op.NN;
+            chp.PC += 2;
+            if (record)
+                chp.History.Record(chp);
+            chp.CountDown();
+            V[op.Y] = op.NN2;
+            chp.PC += 2;
+            executed += 2;
+            break;
+        case OP_ADD_SE_JP:
+        case OP_ADD_SNE_JP:
+            {
+                ++FusedDispatches;
+                if (record)
+                    chp.History.Record(chp);
+                chp.CountDown();
+                V[op.X] += op.NN;
+                chp.PC += 2;
+                if (record)
+                    chp.History.Record(chp);
+                chp.CountDown();
+                const bool skip = (V[op.X] == op.NN2) == (op.Op == OP_ADD_SE_JP);
+                if (skip) {
+                    chp.PC += 4;
+                    executed += 2;
+                }
+                else {
+                    chp.PC += 2;
+                    if (record)
+                        chp.History.Record(chp);
+                    chp.CountDown();
+                    chp.PC = op.NNN;
+                    executed += 3;
+                }
+                break;
+            }
+        case OP_WAIT_DT:
+            {
+                ++FusedDispatches;
+                // Spin the whole wait loop here, no dispatch per iteration
+                uint32_t left = remaining;
+                while (left >= 3) {
+                    if (record)
+                        chp.History.Record(chp);
+                    chp.CountDown();
+                    V[op.X] = chp.Delay;
+                    chp.PC = pc + 2;
+                    if (record)
+                        chp.History.Record(chp);
+                    chp.CountDown();
+                    if (V[op.X] == 0x00) {
+                        chp.PC = pc + 6;
+                        left -= 2;
+                        break;
+                    }
+                    chp.PC = pc + 4;
+                    if (record)
+                        chp.History.Record(chp);
+                    chp.CountDown();
+                    chp.PC = pc;
+                    left -= 3;
+                }
+                executed += remaining - left;
+                break;
+            }
+
+        default:
+            if (!chp.Execute()) {
+                budget = executed;
+                break;
+            }
+            executed += 1;
+            break;
+        }
+    }
+
+    chp.Opcode = ReadOpcode(chp.memory, last);
+    return executed;
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <bitset>
+#include <cstdint>
+
+#include "mem.h"
+
+class CHIP8;
+
+// Bump whenever decoding or DecodedOp changes, cached tables depend on it
+#define PREDECODED_ENGINE_VERSION 2
+
+enum E_OP {
+    OP_FALLBACK,        // Anything rare goes through the reference interpreter
+    OP_JP,
+    OP_CALL,
+    OP_RET,
+    OP_SE_IMM,
+    OP_SNE_IMM,
+    OP_SE_REG,
+    OP_SNE_REG,
+    OP_LD_IMM,
+    OP_ADD_IMM,
+    OP_LD_REG,
+    OP_LD_I,
+    OP_DRW,
+    OP_LD_DT,
+
+    // Superinstructions
+    OP_LD_I_DRW,        // Annn, Dxyn
+    OP_LD_IMM2,         // 6xnn, 6ynn
+    OP_ADD_SE_JP,       // 7xnn, 3xkk, 1nnn loop counter
+    OP_ADD_SNE_JP,      // 7xnn, 4xkk, 1nnn loop counter
+    OP_WAIT_DT          // Fx07, 3x00, 1nnn back to itself
+};
+
+struct DecodedOp {
+    uint8_t Op;
+    uint8_t X;
+    uint8_t Y;
+    uint8_t NN;
+    uint16_t NNN;
+    uint8_t NN2;        // Immediate of the second fused instruction
+    uint8_t N;
+};
+
+// Decodes each address once into a compact op and dispatches on that, fusing
+// the most frequent instruction sequences into single handlers. Decoded ops
+// are dropped whenever the core reports a write into code.
+class PredecodedEngine {
+public:
+    PredecodedEngine();
+
+    // Execute up to `budget` instructions, returns how many actually ran
+    uint32_t Run(CHIP8 &chp, uint32_t budget);
+    void Invalidate();
+
+    bool Fusion;
+
+    uint64_t Dispatches;
+    uint64_t FusedDispatches;
+
+private:
+    friend class TranslationCache;
+
+    const DecodedOp &Decode(CHIP8 &chp, uint16_t pc);
+    DecodedOp DecodeAt(const uint8_t *memory, uint16_t pc) const;
+    DecodedOp Fuse(const uint8_t *memory, uint16_t pc, const DecodedOp &first) const;
+
+    DecodedOp Ops[MEMORY_SIZE];
+    std::bitset<MEMORY_SIZE> Valid;
+    uint32_t Generation;
+};
@@ -0,0 +1,388 @@
+#include "program-analysis.h"
+#include "chip8.h"
+#include <cstdio>
+
+bool Disassemble(uint16_t opcode, std::string &out, const CHIP8_QUIRKS &quirks) {
+    char text[32];
+    const unsigned X = (opcode & 0x0F00) >> 8;
+    const unsigned Y = (opcode & 0x00F0) >> 4;
+    const unsigned N = opcode & 0x000F;
+    const unsigned NN = opcode & 0x00FF;
+    const unsigned NNN = opcode & 0x0FFF;
+    const bool super = quirks.Platform != PLATFORM_CHIP8;
+    const bool xo = quirks.Platform == PLATFORM_XOCHIP;
+    bool valid = true;
+
+    switch (opcode & 0xF000) {
+    case 0x0000:
+        if (opcode == 0x00E0)
+            snprintf(text, sizeof(text), "CLS");
+        else if (opcode == 0x00EE)
+            snprintf(text, sizeof(text), "RET");
+        else if (super && (opcode & 0xFFF0) == 0x00C0)
+            snprintf(text, sizeof(text), "SCD %u", N);
+        else if (xo && (opcode & 0xFFF0) == 0x00D0)
+            snprintf(text, sizeof(text), "SCU %u", N);
+        else if (super && opcode == 0x00FB)
+            snprintf(text, sizeof(text), "SCR");
+        else if (super && opcode == 0x00FC)
+            snprintf(text, sizeof(text), "SCL");
+        else if (super && opcode == 0x00FE)
+            snprintf(text, sizeof(text), "LOW");
+        else if (super && opcode == 0x00FF)
+            snprintf(text, sizeof(text), "HIGH");
+        else if (super && opcode == 0x00FD) {
+            // Stops the machine, nothing runs past it
+            snprintf(text, sizeof(text), "EXIT");
+            valid = false;
+        }
+        else {
+            snprintf(text, sizeof(text), "SYS 0x%03x", NNN);
+            valid = false;
+        }
+        break;
+    case 0x1000:
+        snprintf(text, sizeof(text), "JP 0x%03x", NNN);
+        break;
+    case 0x2000:
+        snprintf(text, sizeof(text), "CALL 0x%03x", NNN);
+        break;
+    case 0x3000:
+        snprintf(text, sizeof(text), "SE V%X, 0x%02x", X, NN);
+        break;
+    case 0x4000:
+        snprintf(text, sizeof(text), "SNE V%X, 0x%02x", X, NN);
+        break;
+    case 0x5000:
+        if (xo && N == 0x2)
+            snprintf(text, sizeof(text), "LD [I], V%X-V%X", X, Y);
+        else if (xo && N == 0x3)
+            snprintf(text, sizeof(text), "LD V%X-V%X, [I]", X, Y);
+        else if (xo && N != 0x0) {
+            snprintf(text, sizeof(text), "DW 0x%04x", opcode);
+            valid = false;
+        }
+        else
+            snprintf(text, sizeof(text), "SE V%X, V%X", X, Y);
+        break;
+    case 0x6000:
+        snprintf(text, sizeof(text), "LD V%X, 0x%02x", X, NN);
+        break;
+    case 0x7000:
+        snprintf(text, sizeof(text), "ADD V%X, 0x%02x", X, NN);
+        break;
+    case 0x8000:
+        {
+            static const char *names[16] = {
+                "LD", "OR", "AND", "XOR", "ADD", "SUB", "SHR", "SUBN",
+                NULL, NULL, NULL, NULL, NULL, NULL, "SHL", NULL
+            };
+            if (names[N]) {
+                snprintf(text, sizeof(text), "%s V%X, V%X", names[N], X, Y);
+            }
+            else {
+                snprintf(text, sizeof(text), "DW 0x%04x", opcode);
+                valid = false;
+            }
+            break;
+        }
+    case 0x9000:
+        snprintf(text, sizeof(text), "SNE V%X, V%X", X, Y);
+        break;
+    case 0xA000:
+        snprintf(text, sizeof(text), "LD I, 0x%03x", NNN);
+        break;
+    case 0xB000:
+        if (quirks.JumpUsesVX)
+            snprintf(text, sizeof(text), "JP V%X, 0x%03x", X, NNN);
+        else
+            snprintf(text, sizeof(text), "JP V0, 0x%03x", NNN);
+        break;
+    case 0xC000:
+        snprintf(text, sizeof(text), "RND V%X, 0x%02x", X, NN);
+        break;
+    case 0xD000:
+        snprintf(text, sizeof(text), "DRW V%X, V%X, %u", X, Y, N);
+        break;
+    case 0xE000:
+        if (NN == 0x9E)
+            snprintf(text, sizeof(text), "SKP V%X", X);
+        else if (NN == 0xA1)
+            snprintf(text, sizeof(text), "SKNP V%X", X);
+        else {
+            snprintf(text, sizeof(text), "DW 0x%04x", opcode);
+            valid = false;
+        }
+        break;
+    case 0xF000:
+        switch (NN) {
+        case 0x07: snprintf(text, sizeof(text), "LD V%X, DT", X); break;
+        case 0x0A: snprintf(text, sizeof(text), "LD V%X, K", X); break;
+        case 0x15: snprintf(text, sizeof(text), "LD DT, V%X", X); break;
+        case 0x18: snprintf(text, sizeof(text), "LD ST, V%X", X); break;
+        case 0x1E: snprintf(text, sizeof(text), "ADD I, V%X", X); break;
+        case 0x29: snprintf(text, sizeof(text), "LD F, V%X", X); break;
+        case 0x33: snprintf(text, sizeof(text), "LD B, V%X", X); break;
+        case 0x55: snprintf(text, sizeof(text), "LD [I], V%X", X); break;
+        case 0x65: snprintf(text, sizeof(text), "LD V%X, [I]", X); break;
+        case 0x30:
+            if (!super) {
+                snprintf(text, sizeof(text), "DW 0x%04x", opcode);
+                valid = false;
+            }
+            else
+                snprintf(text, sizeof(text), "LD HF, V%X", X);
+            break;
+        case 0x75:
+        case 0x85:
+            if (!super) {
+                snprintf(text, sizeof(text), "DW 0x%04x", opcode);
+                valid = false;
+            }
+            else if (NN == 0x75)
+                snprintf(text, sizeof(text), "LD R, V%X", X);
+            else
+                snprintf(text, sizeof(text), "LD V%X, R", X);
+            break;
+        case 0x00:
+        case 0x01:
+        case 0x02:
+        case 0x3A:
+            // XO-CHIP only, F000 and F002 exist for X = 0 alone
+            if (!xo || ((NN == 0x00 || NN == 0x02) && X != 0)) {
+                snprintf(text, sizeof(text), "DW 0x%04x", opcode);
+                valid = false;
+            }
+            else if (NN == 0x00)
+                snprintf(text, sizeof(text), "LD I, long");
+            else if (NN == 0x01)
+                snprintf(text, sizeof(text), "PLANE %u", X);
+            else if (NN == 0x02)
+                snprintf(text, sizeof(text), "AUDIO");
+            else
+                snprintf(text, sizeof(text), "PITCH V%X", X);
+            break;
+        default:
+            snprintf(text, sizeof(text), "DW 0x%04x", opcode);
+            valid = false;
+        }
+        break;
+    }
+
+    out = text;
+    return valid;
+}
+
+static uint16_t ReadOpcode(const uint8_t *memory, uint16_t address) {
+    return (memory[address] << 8) | memory[(address + 1) & MEMORY_MASK];
+}
+
+ProgramAnalysis::ProgramAnalysis() : Generation(0), Platform(PLATFORM_CHIP8), JumpUsesVX(false), Valid(false) {
+}
+
+bool ProgramAnalysis::IsStale(const CHIP8 &chp) const {
+    return !Valid || Generation != chp.CodeGeneration || Platform != chp.Quirks.Platform ||
+           JumpUsesVX != chp.Quirks.JumpUsesVX;
+}
+
+uint16_t ProgramAnalysis::Length(const uint8_t *memory, uint16_t address) const {
+    // XO-CHIP F000 nnnn carries its address in the next word
+    return Platform == PLATFORM_XOCHIP && ReadOpcode(memory, address) == 0xF000 ? 4 : 2;
+}
+
+bool ProgramAnalysis::IsSkip(uint16_t opcode) const {
+    switch (opcode & 0xF000) {
+    case 0x5000:
+        // XO-CHIP 5xy2 and 5xy3 move registers instead
+        return Platform != PLATFORM_XOCHIP || (opcode & 0x000F) == 0;
+    case 0x3000:
+    case 0x4000:
+    case 0x9000:
+    case 0xE000:
+        return true;
+    }
+    return false;
+}
+
+const BasicBlock *ProgramAnalysis::FindBlock(uint16_t address) const {
+    auto it = Blocks.upper_bound(address);
+    if (it == Blocks.begin())
+        return NULL;
+    --it;
+    return address < it->second.End ? &it->second : NULL;
+}
+
+void ProgramAnalysis::Analyze(CHIP8 &chp, uint16_t entry) {
+    Blocks.clear();
+    Functions.clear();
+    CallGraph.clear();
+    JumpTables.clear();
+    Instructions.reset();
+    Code.reset();
+    Leaders.reset();
+
+    Platform = chp.Quirks.Platform;
+    JumpUsesVX = chp.Quirks.JumpUsesVX;
+    Functions.insert(entry);
+    Discover(chp.memory, entry);
+    BuildBlocks(chp.memory);
+    BuildCallGraph();
+
+    // Let the core tell us when any of this goes stale
+    chp.CodeMap |= Code;
+    Generation = chp.CodeGeneration;
+    Valid = true;
+}
+
+void ProgramAnalysis::Discover(const uint8_t *memory, uint16_t entry) {
+    CHIP8_QUIRKS quirks = CHIP8_QUIRKS();
+    quirks.Platform = Platform;
+    quirks.JumpUsesVX = JumpUsesVX;
+
+    std::vector<uint16_t> pending;
+    pending.push_back(entry);
+    Leaders.set(entry);
+
+    while (!pending.empty()) {
+        uint16_t address = pending.back();
+        pending.pop_back();
+
+        std::string text;
+        while (address + 1 < MEMORY_SIZE && !Instructions[address]) {
+            const uint16_t opcode = ReadOpcode(memory, address);
+            if (!Disassemble(opcode, text, quirks))
+                break;
+            const uint16_t length = Length(memory, address);
+            if (address + length > MEMORY_SIZE)
+                break;
+
+            Instructions.set(address);
+            for (uint16_t i = 0; i < length; ++i) {
+                Code.set(address + i);
+            }
+
+            const uint16_t NNN = opcode & 0x0FFF;
+            const uint16_t next = address + length;
+
+            if ((opcode & 0xF000) == 0x1000) {
+                Leaders.set(NNN);
+                pending.push_back(NNN);
+                break;
+            }
+            if ((opcode & 0xF000) == 0x2000) {
+                Functions.insert(NNN);
+                Leaders.set(NNN);
+                Leaders.set(next);
+                pending.push_back(NNN);
+            }
+            else if ((opcode & 0xF000) == 0xB000) {
+                // Tables are usually a run of jumps right at the base address
+                std::vector<uint16_t> &targets = JumpTables[address];
+                for (uint16_t slot = NNN; slot + 1 < MEMORY_SIZE && targets.size() < 128; slot += 2) {
+                    if ((ReadOpcode(memory, slot) & 0xF000) != 0x1000)
+                        break;
+                    targets.push_back(slot);
+                }
+                if (targets.empty())
+                    targets.push_back(NNN);
+
+                for (uint16_t target : targets) {
+                    Leaders.set(target);
+                    pending.push_back(target);
+                }
+                break;
+            }
+            else if (opcode == 0x00EE) {
+                break;
+            }
+            else if (IsSkip(opcode)) {
+                const uint16_t skipped = (next + Length(memory, next % MEMORY_SIZE)) % MEMORY_SIZE;
+                Leaders.set(next);
+                Leaders.set(skipped);
+                pending.push_back(skipped);
+            }
+
+            address = next;
+        }
+    }
+}
+
+void ProgramAnalysis::BuildBlocks(const uint8_t *memory) {
+    for (uint16_t start = 0; start < MEMORY_SIZE; ++start) {
+        if (!Leaders[start] || !Instructions[start])
+            continue;
+
+        BasicBlock block;
+        block.Start = start;
+        block.Callee = 0;
+        block.Returns = false;
+        block.Indirect = false;
+        block.SelfLoop = false;
+
+        uint16_t address = start;
+        while (true) {
+            const uint16_t opcode = ReadOpcode(memory, address);
+            const uint16_t next = address + Length(memory, address);
+            block.End = next;
+
+            if ((opcode & 0xF000) == 0x1000) {
+                block.Successors.push_back(opcode & 0x0FFF);
+                block.SelfLoop = (opcode & 0x0FFF) == start;
+                break;
+            }
+            if ((opcode & 0xF000) == 0x2000) {
+                block.Callee = opcode & 0x0FFF;
+                block.Successors.push_back(next);
+                break;
+            }
+            if ((opcode & 0xF000) == 0xB000) {
+                block.Indirect = true;
+                block.Successors = JumpTables[address];
+                break;
+            }
+            if (opcode == 0x00EE) {
+                block.Returns = true;
+                break;
+            }
+            if (IsSkip(opcode)) {
+                block.Successors.push_back(next);
+                block.Successors.push_back((next + Length(memory, next % MEMORY_SIZE)) % MEMORY_SIZE);
+                break;
+            }
+            if (next + 1 >= MEMORY_SIZE || !Instructions[next])
+                break;
+            if (Leaders[next]) {
+                block.Successors.push_back(next);
+                break;
+            }
+            address = next;
+        }
+
+        Blocks[start] = block;
+    }
+}
+
+void ProgramAnalysis::BuildCallGraph() {
+    for (uint16_t function : Functions) {
+        std::set<uint16_t> &callees = CallGraph[function];
+        std::set<uint16_t> seen;
+        std::vector<uint16_t> pending(1, function);
+
+        while (!pending.empty()) {
+            uint16_t address = pending.back();
+            pending.pop_back();
+            if (!seen.insert(address).second)
+                continue;
+
+            auto it = Blocks.find(address);
+            if (it == Blocks.end())
+                continue;
+
+            if (it->second.Callee != 0)
+                callees.insert(it->second.Callee);
+            for (uint16_t successor : it->second.Successors) {
+                pending.push_back(successor);
+            }
+        }
+    }
+}
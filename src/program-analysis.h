@@ -0,0 +1,70 @@
+#pragma once
+#include <bitset>
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "mem.h"
+
+class CHIP8;
+struct CHIP8_QUIRKS;
+
+// Write the mnemonic for `opcode` into `out`, returns false for opcodes the core can't run.
+// The platform decides which instructions exist, JumpUsesVX how Bnnn reads.
+bool Disassemble(uint16_t opcode, std::string &out, const CHIP8_QUIRKS &quirks);
+
+struct BasicBlock {
+    uint16_t Start;
+    uint16_t End;       // One past the last instruction byte
+
+    std::vector<uint16_t> Successors;
+    uint16_t Callee;    // Target of a trailing 2nnn, 0 otherwise
+
+    bool Returns;       // Ends in 00EE
+    bool Indirect;      // Ends in Bnnn
+    bool SelfLoop;      // Ends in a jump to its own start, an idle loop
+};
+
+// Recursive descent over the loaded ROM. The result is cached until the core
+// reports a write into one of the bytes that were decoded as code.
+class ProgramAnalysis {
+public:
+    ProgramAnalysis();
+
+    void Analyze(CHIP8 &chp, uint16_t entry = PROGRAM_START);
+    bool IsStale(const CHIP8 &chp) const;
+
+    const BasicBlock *FindBlock(uint16_t address) const;
+    // Bytes taken by the instruction at `address`, 4 for XO-CHIP F000 nnnn
+    uint16_t Length(const uint8_t *memory, uint16_t address) const;
+    bool IsCode(uint16_t address) const { return Code[address % MEMORY_SIZE]; }
+
+    // Blocks keyed by start address
+    std::map<uint16_t, BasicBlock> Blocks;
+
+    // Subroutine entries, including the program entry point
+    std::set<uint16_t> Functions;
+    std::map<uint16_t, std::set<uint16_t> > CallGraph;
+
+    // Bnnn sites and the table entries recovered behind them
+    std::map<uint16_t, std::vector<uint16_t> > JumpTables;
+
+    // First byte of every decoded instruction
+    std::bitset<MEMORY_SIZE> Instructions;
+    // Every byte covered by a decoded instruction
+    std::bitset<MEMORY_SIZE> Code;
+
+private:
+    void Discover(const uint8_t *memory, uint16_t entry);
+    void BuildBlocks(const uint8_t *memory);
+    void BuildCallGraph();
+    bool IsSkip(uint16_t opcode) const;
+
+    std::bitset<MEMORY_SIZE> Leaders;
+    uint32_t Generation;
+    uint8_t Platform;   // Of the analyzed machine, decides which opcodes exist
+    bool JumpUsesVX;
+    bool Valid;
+};
@@ -1,17 +1,122 @@
 #include "program-reader.h"
+#include "chip8.h"
+#include "rom-archive.h"
+#include <cstring>
 #include <iostream>
 
-void ProgramReader::Load(const std::string &filename) {
-    std::ifstream file(filename.c_str(), std::ios::binary);
+uint64_t HashProgram(const uint8_t *data, size_t size) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+ProgramReader::ProgramReader() : Hash(0), Size(0) {
+}
+
+bool ProgramReader::Open(const std::string &filename, std::ifstream &file) {
+    file.open(filename.c_str(), std::ios::binary | std::ios::ate);
     if (!file) {
-        std::cout << "Could not open requested program file" << std::endl;
+        Error = "Could not open requested program file " + filename;
+        std::cout << Error << std::endl;
+        return false;
+    }
+
+    std::streamoff size = file.tellg();
+    if (size < 0 || size > XO_MEMORY_SIZE - PROGRAM_START) {
+        Error = "Program " + filename + " does not fit in memory";
+        std::cout << Error << std::endl;
+        return false;
+    }
+
+    Size = static_cast<size_t>(size);
+    file.seekg(0);
+    Error.clear();
+    return true;
+}
+
+bool ProgramReader::Load(const std::string &filename) {
+    std::ifstream file;
+
+    Program.clear();
+    if (!Open(filename, file))
+        return false;
+
+    Program.resize(Size);
+    if (Size > 0 && !file.read(reinterpret_cast<char *>(Program.data()), Size)) {
+        Error = "Could not read program file " + filename;
+        Program.clear();
+        return false;
+    }
+
+    Hash = HashProgram(Program.data(), Size);
+    return true;
+}
+
+bool ProgramReader::LoadInto(const std::string &filename, CHIP8 &chp) {
+    std::ifstream file;
+    if (!Open(filename, file))
+        return false;
+
+    auto guard = chp.Lock();
+
+    uint8_t *program = &chp.memory[PROGRAM_START];
+    if (Size > 0 && !file.read(reinterpret_cast<char *>(program), Size)) {
+        Error = "Could not read program file " + filename;
+        return false;
     }
+    // XO-CHIP programs may run past MEMORY_SIZE, their data is only reached through I
+    memset(program + Size, 0x00, XO_MEMORY_SIZE - PROGRAM_START - Size);
+    chp.ExtendedDirty = true;
+
+    Hash = HashProgram(program, Size);
+    return true;
+}
 
-    char ch;
+bool ProgramReader::Fits(uint8_t platform) {
+    const size_t limit = (platform == PLATFORM_XOCHIP ? XO_MEMORY_SIZE : MEMORY_SIZE) - PROGRAM_START;
+    if (Size <= limit)
+        return true;
 
+    Error = "Program of " + std::to_string(Size) + " bytes does not fit in memory, only XO-CHIP reaches past 4K";
+    std::cout << Error << std::endl;
+    return false;
+}
+
+bool ProgramReader::Load(const RomArchive &archive, const ArchiveEntry &entry) {
     Program.clear();
+    if (entry.Size > XO_MEMORY_SIZE - PROGRAM_START) {
+        Error = std::string("Program ") + archive.Name(entry) + " does not fit in memory";
+        std::cout << Error << std::endl;
+        return false;
+    }
+
+    Program.assign(archive.Data(entry), archive.Data(entry) + entry.Size);
+    Size = entry.Size;
+    Hash = entry.Hash;
+    Error.clear();
+    return true;
+}
 
-    while (file >> std::noskipws >> ch) {
-        Program.push_back(ch);
+bool ProgramReader::LoadInto(const RomArchive &archive, const ArchiveEntry &entry, CHIP8 &chp) {
+    if (entry.Size > XO_MEMORY_SIZE - PROGRAM_START) {
+        Error = std::string("Program ") + archive.Name(entry) + " does not fit in memory";
+        std::cout << Error << std::endl;
+        return false;
     }
+
+    auto guard = chp.Lock();
+
+    uint8_t *program = &chp.memory[PROGRAM_START];
+    memcpy(program, archive.Data(entry), entry.Size);
+    memset(program + entry.Size, 0x00, XO_MEMORY_SIZE - PROGRAM_START - entry.Size);
+    chp.ExtendedDirty = true;
+
+    // The index already carries the hash, no need to walk the bytes again
+    Size = entry.Size;
+    Hash = entry.Hash;
+    Error.clear();
+    return true;
 }
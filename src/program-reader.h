@@ -2,10 +2,37 @@
 #include <fstream>
 #include <vector>
 #include <string>
+#include <cstdint>
+
+class CHIP8;
+class RomArchive;
+struct ArchiveEntry;
+
+// FNV-1a, used to key per-ROM settings and caches
+uint64_t HashProgram(const uint8_t *data, size_t size);
 
 class ProgramReader {
 public:
-    void Load(const std::string &filename);
+    ProgramReader();
+
+    // Read the whole file in one go into Program
+    bool Load(const std::string &filename);
+    // Copy a ROM out of an opened archive into Program
+    bool Load(const RomArchive &archive, const ArchiveEntry &entry);
+    // Read the file straight into the VM memory above 0x200
+    bool LoadInto(const std::string &filename, CHIP8 &chp);
+    // Copy a ROM out of an opened archive, without touching the filesystem
+    bool LoadInto(const RomArchive &archive, const ArchiveEntry &entry, CHIP8 &chp);
+    // Anything up to 64K loads so the hash can pick the settings, only
+    // XO-CHIP reaches past the first 4K. Call once the platform is known.
+    bool Fits(uint8_t platform);
 
     std::vector<uint8_t> Program;
+
+    uint64_t Hash;
+    size_t Size;
+    std::string Error;
+
+private:
+    bool Open(const std::string &filename, std::ifstream &file);
 };
@@ -0,0 +1,69 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+
+// Lock-free single producer / single consumer ring buffer.
+// Capacity must be a power of two, one slot is never used.
+template <typename T, size_t Capacity>
+class RingBuffer {
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    RingBuffer() : Head(0), Tail(0) {}
+
+    // Producer side, returns the number of elements actually written
+    size_t Push(const T *data, size_t count) {
+        const size_t head = Head.load(std::memory_order_relaxed);
+        const size_t tail = Tail.load(std::memory_order_acquire);
+        const size_t free = Capacity - 1 - ((head - tail) & Mask);
+        if (count > free)
+            count = free;
+
+        for (size_t i = 0; i < count; ++i) {
+            Buffer[(head + i) & Mask] = data[i];
+        }
+        Head.store((head + count) & Mask, std::memory_order_release);
+        return count;
+    }
+
+    bool Push(const T &value) {
+        return Push(&value, 1) == 1;
+    }
+
+    // Consumer side, returns the number of elements actually read
+    size_t Pop(T *data, size_t count) {
+        const size_t tail = Tail.load(std::memory_order_relaxed);
+        const size_t head = Head.load(std::memory_order_acquire);
+        const size_t used = (head - tail) & Mask;
+        if (count > used)
+            count = used;
+
+        for (size_t i = 0; i < count; ++i) {
+            data[i] = Buffer[(tail + i) & Mask];
+        }
+        Tail.store((tail + count) & Mask, std::memory_order_release);
+        return count;
+    }
+
+    bool Pop(T &value) {
+        return Pop(&value, 1) == 1;
+    }
+
+    // Approximate fill level
+    size_t Size() const {
+        return (Head.load(std::memory_order_acquire) - Tail.load(std::memory_order_acquire)) & Mask;
+    }
+
+    // Consumer side, drops everything currently queued
+    void Clear() {
+        Tail.store(Head.load(std::memory_order_acquire), std::memory_order_release);
+    }
+
+private:
+    static const size_t Mask = Capacity - 1;
+
+    T Buffer[Capacity];
+
+    alignas(64) std::atomic<size_t> Head;
+    alignas(64) std::atomic<size_t> Tail;
+};
@@ -0,0 +1,183 @@
+#include "rom-archive.h"
+#include "program-reader.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define ARCHIVE_HEADER_SIZE 16
+
+RomArchive::RomArchive() : Base(NULL), Length(0), Entries(NULL), EntryCount(0), Strings(NULL), Mapped(false) {
+}
+
+RomArchive::~RomArchive() {
+    Close();
+}
+
+void RomArchive::Close() {
+#ifndef _WIN32
+    if (Mapped && Base)
+        munmap(const_cast<uint8_t *>(Base), Length);
+#endif
+    Buffer.clear();
+    Base = NULL;
+    Length = 0;
+    Entries = NULL;
+    EntryCount = 0;
+    Strings = NULL;
+    Mapped = false;
+}
+
+bool RomArchive::Open(const std::string &filename) {
+    Close();
+
+#ifndef _WIN32
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        Error = "Could not open archive " + filename;
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        void *mapping = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED) {
+            // Lookups jump straight to one blob, readahead would be wasted
+            madvise(mapping, info.st_size, MADV_RANDOM);
+            Base = static_cast<const uint8_t *>(mapping);
+            Length = static_cast<size_t>(info.st_size);
+            Mapped = true;
+        }
+    }
+    close(fd);
+#endif
+
+    if (!Mapped) {
+        std::ifstream file(filename.c_str(), std::ios::binary | std::ios::ate);
+        if (!file) {
+            Error = "Could not open archive " + filename;
+            return false;
+        }
+        Buffer.resize(static_cast<size_t>(file.tellg()));
+        file.seekg(0);
+        if (!file.read(reinterpret_cast<char *>(Buffer.data()), Buffer.size())) {
+            Error = "Could not read archive " + filename;
+            Buffer.clear();
+            return false;
+        }
+        Base = Buffer.data();
+        Length = Buffer.size();
+    }
+
+    if (!Validate()) {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+bool RomArchive::Validate() {
+    uint32_t header[4];
+    if (Length < ARCHIVE_HEADER_SIZE) {
+        Error = "Archive is truncated";
+        return false;
+    }
+    memcpy(header, Base, sizeof(header));
+
+    if (header[0] != ARCHIVE_MAGIC || header[1] != ARCHIVE_VERSION) {
+        Error = "Not a ROM archive or unsupported version";
+        return false;
+    }
+
+    const size_t count = header[2];
+    const size_t strings = header[3];
+    const size_t tables = ARCHIVE_HEADER_SIZE + count * sizeof(ArchiveEntry) + strings;
+    if (tables > Length || (strings > 0 && Base[tables - 1] != '\0')) {
+        Error = "Archive index is corrupt";
+        return false;
+    }
+
+    Entries = reinterpret_cast<const ArchiveEntry *>(Base + ARCHIVE_HEADER_SIZE);
+    EntryCount = count;
+    Strings = reinterpret_cast<const char *>(Base + ARCHIVE_HEADER_SIZE + count * sizeof(ArchiveEntry));
+
+    for (size_t i = 0; i < count; ++i) {
+        const ArchiveEntry &entry = Entries[i];
+        if (entry.Offset < tables || entry.Offset > Length || entry.Size > Length - entry.Offset ||
+            entry.Name >= strings || (i > 0 && Entries[i - 1].Hash > entry.Hash)) {
+            Error = "Archive entry is corrupt";
+            return false;
+        }
+    }
+    return true;
+}
+
+const ArchiveEntry *RomArchive::Find(uint64_t hash) const {
+    const ArchiveEntry *end = Entries + EntryCount;
+    const ArchiveEntry *it = std::lower_bound(Entries, end, hash, [](const ArchiveEntry &entry, uint64_t value) {
+        return entry.Hash < value;
+    });
+    return it != end && it->Hash == hash ? it : NULL;
+}
+
+bool RomArchiveBuilder::Add(const std::string &name, const std::vector<uint8_t> &data) {
+    Rom rom;
+    rom.Hash = HashProgram(data.data(), data.size());
+    for (const auto &existing : Roms) {
+        if (existing.Hash == rom.Hash)
+            return false;
+    }
+
+    rom.Name = name;
+    rom.Data = data;
+    Roms.push_back(rom);
+    return true;
+}
+
+bool RomArchiveBuilder::Write(const std::string &filename) const {
+    std::vector<const Rom *> sorted;
+    for (const auto &rom : Roms) {
+        sorted.push_back(&rom);
+    }
+    std::sort(sorted.begin(), sorted.end(), [](const Rom *a, const Rom *b) {
+        return a->Hash < b->Hash;
+    });
+
+    std::string strings;
+    std::vector<ArchiveEntry> entries(sorted.size());
+    for (size_t i = 0; i < sorted.size(); ++i) {
+        entries[i].Hash = sorted[i]->Hash;
+        entries[i].Size = static_cast<uint32_t>(sorted[i]->Data.size());
+        entries[i].Name = static_cast<uint32_t>(strings.size());
+        strings += sorted[i]->Name;
+        strings += '\0';
+    }
+
+    uint64_t offset = ARCHIVE_HEADER_SIZE + entries.size() * sizeof(ArchiveEntry) + strings.size();
+    for (auto &entry : entries) {
+        entry.Offset = offset;
+        offset += entry.Size;
+    }
+
+    std::ofstream file(filename.c_str(), std::ios::binary | std::ios::trunc);
+    if (!file)
+        return false;
+
+    const uint32_t header[4] = {
+        ARCHIVE_MAGIC, ARCHIVE_VERSION,
+        static_cast<uint32_t>(entries.size()), static_cast<uint32_t>(strings.size())
+    };
+    file.write(reinterpret_cast<const char *>(header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(entries.data()), entries.size() * sizeof(ArchiveEntry));
+    file.write(strings.data(), strings.size());
+    for (const Rom *rom : sorted) {
+        file.write(reinterpret_cast<const char *>(rom->Data.data()), rom->Data.size());
+    }
+    return static_cast<bool>(file);
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Packed archive layout, all fields little-endian:
+//   header   "C8PK", version, entry count, string table size   (4 x uint32)
+//   index    entry count x ArchiveEntry, sorted by hash
+//   strings  NUL terminated ROM names
+//   blobs    ROM contents, back to back
+#define ARCHIVE_MAGIC 0x4b503843    // "C8PK"
+#define ARCHIVE_VERSION 1
+
+struct ArchiveEntry {
+    uint64_t Hash;
+    uint64_t Offset;        // From the start of the file
+    uint32_t Size;
+    uint32_t Name;          // Offset into the string table
+};
+
+// Read-only view of an archive. The file is memory mapped where possible so
+// ROM contents are handed out as pointers into the mapping, never copied.
+class RomArchive {
+public:
+    RomArchive();
+    ~RomArchive();
+
+    bool Open(const std::string &filename);
+    void Close();
+
+    size_t Count() const { return EntryCount; }
+    const ArchiveEntry &Entry(size_t index) const { return Entries[index]; }
+    const ArchiveEntry *Find(uint64_t hash) const;
+
+    const uint8_t *Data(const ArchiveEntry &entry) const { return Base + entry.Offset; }
+    const char *Name(const ArchiveEntry &entry) const { return Strings + entry.Name; }
+
+    std::string Error;
+
+private:
+    RomArchive(const RomArchive &) = delete;
+    RomArchive &operator=(const RomArchive &) = delete;
+
+    bool Validate();
+
+    const uint8_t *Base;
+    size_t Length;
+    const ArchiveEntry *Entries;
+    size_t EntryCount;
+    const char *Strings;
+
+    // Fallback storage where mapping isn't available
+    std::vector<uint8_t> Buffer;
+    bool Mapped;
+};
+
+class RomArchiveBuilder {
+public:
+    // Returns false when the same content was already added
+    bool Add(const std::string &name, const std::vector<uint8_t> &data);
+    bool Write(const std::string &filename) const;
+
+    size_t Count() const { return Roms.size(); }
+
+private:
+    struct Rom {
+        uint64_t Hash;
+        std::string Name;
+        std::vector<uint8_t> Data;
+    };
+    std::vector<Rom> Roms;
+};
@@ -0,0 +1,92 @@
+#include "rom-database.h"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+RomSettings RomDatabase::Defaults() {
+    RomSettings settings;
+    settings.InstructionsPerFrame = 10;
+    settings.Quirks.ShiftUsesVY = true;
+    settings.Quirks.LoadStoreIncrementsI = false;
+    settings.Quirks.JumpUsesVX = false;
+    settings.Quirks.Platform = PLATFORM_CHIP8;
+    return settings;
+}
+
+static void ParseQuirks(const std::string &value, CHIP8_QUIRKS &quirks) {
+    std::stringstream list(value);
+    std::string quirk;
+    while (std::getline(list, quirk, ',')) {
+        if (quirk == "noshiftvy")
+            quirks.ShiftUsesVY = false;
+        else if (quirk == "loadstore")
+            quirks.LoadStoreIncrementsI = true;
+        else if (quirk == "jumpvx")
+            quirks.JumpUsesVX = true;
+    }
+}
+
+static void ParsePlatform(const std::string &value, CHIP8_QUIRKS &quirks) {
+    if (value == "chip8")
+        quirks.Platform = PLATFORM_CHIP8;
+    else if (value == "schip")
+        quirks.Platform = PLATFORM_SCHIP;
+    else if (value == "xochip")
+        quirks.Platform = PLATFORM_XOCHIP;
+}
+
+bool RomDatabase::Load(const std::string &filename) {
+    std::ifstream file(filename.c_str());
+    if (!file) {
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        std::stringstream fields(line);
+        std::string hash;
+        fields >> hash;
+
+        try {
+            RomSettings settings = Defaults();
+            std::string field;
+            while (fields >> field) {
+                size_t split = field.find('=');
+                if (split == std::string::npos)
+                    continue;
+
+                std::string key = field.substr(0, split);
+                std::string value = field.substr(split + 1);
+                if (key == "title")
+                    settings.Title = value;
+                else if (key == "ipf")
+                    settings.InstructionsPerFrame = static_cast<uint32_t>(std::max(1ul, std::stoul(value)));
+                else if (key == "quirks")
+                    ParseQuirks(value, settings.Quirks);
+                else if (key == "platform")
+                    ParsePlatform(value, settings.Quirks);
+                else if (key == "keymap" && value.size() == 16)
+                    settings.Keymap = value;
+            }
+
+            Entries[std::stoull(hash, NULL, 16)] = settings;
+        }
+        catch (const std::exception &) {
+            std::cout << "Skipping bad ROM database line: " << line << std::endl;
+        }
+    }
+    return true;
+}
+
+bool RomDatabase::Find(uint64_t hash, RomSettings &settings) const {
+    auto it = Entries.find(hash);
+    if (it == Entries.end())
+        return false;
+
+    settings = it->second;
+    return true;
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+#include "chip8.h"
+
+struct RomSettings {
+    std::string Title;
+    uint32_t InstructionsPerFrame;
+    CHIP8_QUIRKS Quirks;
+    std::string Keymap;     // 16 host keys for CHIP-8 keys 0 to F, empty keeps the default
+};
+
+// Per-ROM settings keyed by program hash, read from a plain text file:
+//   <hash in hex> title=MAZE ipf=10 quirks=noshiftvy,loadstore,jumpvx platform=chip8|schip|xochip
+//                 keymap=x123qweasdzc4rfv
+class RomDatabase {
+public:
+    bool Load(const std::string &filename);
+    bool Find(uint64_t hash, RomSettings &settings) const;
+
+    static RomSettings Defaults();
+
+    std::unordered_map<uint64_t, RomSettings> Entries;
+};
@@ -0,0 +1,291 @@
+#include "rom-library.h"
+#include "mem.h"
+#include "program-reader.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <experimental/filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::experimental::filesystem;
+
+static int64_t Now() {
+    return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+RomLibrary::RomLibrary(const std::string &indexFile) : IndexFile(indexFile) {
+    RescanSeconds = 60;
+    RescanRequested = false;
+    Running = false;
+    Notify = -1;
+    Entries = std::make_shared<const std::vector<RomEntry> >();
+}
+
+RomLibrary::~RomLibrary() {
+    Stop();
+}
+
+void RomLibrary::AddDirectory(const std::string &path) {
+    std::lock_guard<std::mutex> guard(Guard);
+    Directories.push_back(path);
+    RescanRequested = true;
+    Wake.notify_one();
+}
+
+void RomLibrary::Start() {
+    if (Running)
+        return;
+
+    Running = true;
+    Worker = std::thread(&RomLibrary::Run, this);
+}
+
+void RomLibrary::Stop() {
+    {
+        std::lock_guard<std::mutex> guard(Guard);
+        Running = false;
+        Wake.notify_one();
+    }
+    if (Worker.joinable())
+        Worker.join();
+}
+
+void RomLibrary::Rescan() {
+    std::lock_guard<std::mutex> guard(Guard);
+    RescanRequested = true;
+    Wake.notify_one();
+}
+
+std::shared_ptr<const std::vector<RomEntry> > RomLibrary::Snapshot() const {
+    std::lock_guard<std::mutex> guard(Guard);
+    return Entries;
+}
+
+void RomLibrary::MarkPlayed(const std::string &path) {
+    // Wakes the worker to publish and save, without touching the directories
+    std::lock_guard<std::mutex> guard(Guard);
+    Played[path] = Now();
+    Wake.notify_one();
+}
+
+void RomLibrary::Run() {
+#ifdef __linux__
+    Notify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+
+    // Serve the cached index right away, then bring it up to date
+    LoadIndex();
+    Publish();
+
+    bool rescan = true;
+    while (Running) {
+        bool changed = rescan && Scan();
+
+        bool played;
+        {
+            std::lock_guard<std::mutex> guard(Guard);
+            played = !Played.empty();
+        }
+        if (changed || played) {
+            Publish();
+            SaveIndex();
+        }
+
+        rescan = WaitForChanges();
+    }
+
+#ifdef __linux__
+    if (Notify >= 0) {
+        close(Notify);
+        Notify = -1;
+    }
+#endif
+}
+
+bool RomLibrary::WaitForChanges() {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(RescanSeconds);
+    bool rescan = false;
+
+    std::unique_lock<std::mutex> lock(Guard);
+    while (Running && !RescanRequested && Played.empty()) {
+        if (std::chrono::steady_clock::now() >= deadline) {
+            rescan = true;
+            break;
+        }
+#ifdef __linux__
+        if (Notify >= 0) {
+            lock.unlock();
+            struct pollfd fd = { Notify, POLLIN, 0 };
+            int ready = poll(&fd, 1, 250);
+            if (ready > 0) {
+                // Drain the events, any of them means a rescan
+                char buffer[4096];
+                while (read(Notify, buffer, sizeof(buffer)) > 0) {
+                }
+                lock.lock();
+                rescan = true;
+                break;
+            }
+            lock.lock();
+            continue;
+        }
+#endif
+        Wake.wait_for(lock, std::chrono::milliseconds(250));
+    }
+    rescan = rescan || RescanRequested;
+    RescanRequested = false;
+    return rescan;
+}
+
+bool RomLibrary::Scan() {
+    std::vector<std::string> directories;
+    {
+        std::lock_guard<std::mutex> guard(Guard);
+        directories = Directories;
+    }
+
+    bool changed = false;
+    std::map<std::string, RomEntry> found;
+    for (const auto &directory : directories) {
+        std::error_code error;
+        fs::directory_iterator it(directory, error);
+        if (error)
+            continue;
+
+#ifdef __linux__
+        if (Notify >= 0) {
+            // Adding an existing watch again is harmless
+            inotify_add_watch(Notify, directory.c_str(), IN_CREATE | IN_DELETE | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO);
+        }
+#endif
+
+        for (; it != fs::directory_iterator(); it.increment(error)) {
+            if (error)
+                break;
+            if (!fs::is_regular_file(it->status()))
+                continue;
+
+            // The file may be gone by now, and nothing bigger than XO-CHIP memory is a ROM
+            std::error_code stat;
+            const uintmax_t size = fs::file_size(it->path(), stat);
+            if (stat || size > XO_MEMORY_SIZE - PROGRAM_START)
+                continue;
+            const auto modified = fs::last_write_time(it->path(), stat);
+            if (stat)
+                continue;
+
+            const std::string path = it->path().string();
+            RomEntry entry;
+            entry.Path = path;
+            entry.Title = it->path().stem().string();
+            entry.Size = size;
+            entry.Modified = std::chrono::duration_cast<std::chrono::seconds>(modified.time_since_epoch()).count();
+            entry.Hash = 0;
+            entry.LastPlayed = 0;
+
+            // Only hash files that are new or changed since the index was written
+            auto cached = Index.find(path);
+            if (cached != Index.end() && cached->second.Size == entry.Size && cached->second.Modified == entry.Modified) {
+                entry.Hash = cached->second.Hash;
+                entry.LastPlayed = cached->second.LastPlayed;
+            }
+            else {
+                std::ifstream file(path.c_str(), std::ios::binary);
+                std::vector<uint8_t> data(static_cast<size_t>(entry.Size));
+                if (!data.empty() && file.read(reinterpret_cast<char *>(data.data()), data.size())) {
+                    entry.Hash = HashProgram(data.data(), data.size());
+                }
+                if (cached != Index.end())
+                    entry.LastPlayed = cached->second.LastPlayed;
+                changed = true;
+            }
+            found[path] = entry;
+        }
+    }
+
+    if (found.size() != Index.size())
+        changed = true;
+    Index.swap(found);
+    return changed;
+}
+
+void RomLibrary::Publish() {
+    std::shared_ptr<std::vector<RomEntry> > entries = std::make_shared<std::vector<RomEntry> >();
+
+    std::lock_guard<std::mutex> guard(Guard);
+    for (const auto &played : Played) {
+        auto it = Index.find(played.first);
+        if (it != Index.end())
+            it->second.LastPlayed = played.second;
+    }
+    Played.clear();
+
+    entries->reserve(Index.size());
+    for (const auto &entry : Index) {
+        entries->push_back(entry.second);
+    }
+    std::sort(entries->begin(), entries->end(), [](const RomEntry &a, const RomEntry &b) {
+        return a.Title < b.Title;
+    });
+    Entries = entries;
+}
+
+void RomLibrary::LoadIndex() {
+    std::ifstream file(IndexFile.c_str());
+    if (!file)
+        return;
+
+    // One tab separated line per ROM: path, size, modified, hash, last played, title
+    std::string line;
+    while (std::getline(file, line)) {
+        std::stringstream fields(line);
+        RomEntry entry;
+        std::string size, modified, hash, played;
+        if (!std::getline(fields, entry.Path, '\t') || !std::getline(fields, size, '\t') ||
+            !std::getline(fields, modified, '\t') || !std::getline(fields, hash, '\t') ||
+            !std::getline(fields, played, '\t') || !std::getline(fields, entry.Title))
+            continue;
+
+        try {
+            entry.Size = std::stoull(size);
+            entry.Modified = std::stoll(modified);
+            entry.Hash = std::stoull(hash, NULL, 16);
+            entry.LastPlayed = std::stoll(played);
+        }
+        catch (const std::exception &) {
+            continue;
+        }
+        Index[entry.Path] = entry;
+    }
+}
+
+void RomLibrary::SaveIndex() {
+    // Write aside and rename so a crash never leaves a truncated index
+    const std::string temporary = IndexFile + ".tmp";
+    {
+        std::ofstream file(temporary.c_str(), std::ios::trunc);
+        if (!file) {
+            std::cout << "Could not write ROM index " << IndexFile << std::endl;
+            return;
+        }
+
+        char hash[17];
+        for (const auto &it : Index) {
+            const RomEntry &entry = it.second;
+            snprintf(hash, sizeof(hash), "%016llx", static_cast<unsigned long long>(entry.Hash));
+            file << entry.Path << '\t' << entry.Size << '\t' << entry.Modified << '\t' << hash << '\t'
+                 << entry.LastPlayed << '\t' << entry.Title << '\n';
+        }
+    }
+
+    std::error_code error;
+    fs::rename(temporary, IndexFile, error);
+}
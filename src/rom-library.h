@@ -0,0 +1,67 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct RomEntry {
+    std::string Path;
+    std::string Title;
+    uint64_t Size;
+    uint64_t Hash;
+    int64_t Modified;       // Seconds since epoch, used to skip re-hashing
+    int64_t LastPlayed;     // Seconds since epoch, 0 when never played
+};
+
+// Indexes ROM directories on a background thread and serves the result from
+// memory. Metadata is cached in an index file so restarts only stat files,
+// and on Linux directory changes are picked up through inotify.
+class RomLibrary {
+public:
+    RomLibrary(const std::string &indexFile);
+    ~RomLibrary();
+
+    void AddDirectory(const std::string &path);
+
+    void Start();
+    void Stop();
+    void Rescan();
+
+    // Never blocks on the filesystem, just hands out the last published list
+    std::shared_ptr<const std::vector<RomEntry> > Snapshot() const;
+
+    void MarkPlayed(const std::string &path);
+
+    // Rescan period for filesystems where change notifications don't work
+    int RescanSeconds;
+
+private:
+    void Run();
+    bool Scan();
+    void Publish();
+    void LoadIndex();
+    void SaveIndex();
+    // True when the directories need a rescan, false when only play times changed
+    bool WaitForChanges();
+
+    std::string IndexFile;
+    std::vector<std::string> Directories;
+
+    // Worker side state, keyed by path
+    std::map<std::string, RomEntry> Index;
+
+    mutable std::mutex Guard;
+    std::condition_variable Wake;
+    std::shared_ptr<const std::vector<RomEntry> > Entries;
+    std::map<std::string, int64_t> Played;
+    bool RescanRequested;
+
+    std::atomic<bool> Running;
+    std::thread Worker;
+    int Notify;
+};
@@ -0,0 +1,357 @@
+#include "scaler.h"
+#include "frame-recorder.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define SCALER_X86 1
+#include <immintrin.h>
+#endif
+
+bool ParseScaler(const std::string &name, E_SCALER &filter) {
+    if (name == "nearest")
+        filter = SCALER_NEAREST;
+    else if (name == "scale2x" || name == "epx")
+        filter = SCALER_SCALE2X;
+    else if (name == "scale3x")
+        filter = SCALER_SCALE3X;
+    else if (name == "phosphor")
+        filter = SCALER_PHOSPHOR;
+    else
+        return false;
+    return true;
+}
+
+bool SavePPM(const std::string &file, const uint32_t *rgba, int width, int height) {
+    std::ofstream out(file.c_str(), std::ios::binary | std::ios::trunc);
+    out << "P6\n" << width << " " << height << "\n255\n";
+    std::vector<uint8_t> row(width * 3);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            const uint32_t colour = rgba[y * width + x];
+            row[x * 3] = static_cast<uint8_t>(colour);
+            row[x * 3 + 1] = static_cast<uint8_t>(colour >> 8);
+            row[x * 3 + 2] = static_cast<uint8_t>(colour >> 16);
+        }
+        out.write(reinterpret_cast<const char *>(row.data()), row.size());
+    }
+    return static_cast<bool>(out);
+}
+
+// Instruction sets, probed once
+enum E_ISA {
+    ISA_SCALAR,
+    ISA_SSE2,
+    ISA_AVX2
+};
+
+static E_ISA DetectISA() {
+#ifdef SCALER_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return ISA_AVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return ISA_SSE2;
+#endif
+    return ISA_SCALAR;
+}
+
+static const E_ISA ISA = DetectISA();
+
+// Bit x of the words becomes colour x of out
+static void ExpandScalar(const uint64_t *words, int count, uint32_t on, uint32_t off, uint32_t *out) {
+    for (int x = 0; x < count; ++x) {
+        out[x] = (words[x >> 6] >> (x & 63)) & 1 ? on : off;
+    }
+}
+
+#ifdef SCALER_X86
+static void ExpandSSE2(const uint64_t *words, int count, uint32_t on, uint32_t off, uint32_t *out) {
+    const __m128i bits = _mm_setr_epi32(1, 2, 4, 8);
+    const __m128i onv = _mm_set1_epi32(static_cast<int>(on));
+    const __m128i offv = _mm_set1_epi32(static_cast<int>(off));
+    for (int x = 0; x < count; x += 4) {
+        const int nibble = static_cast<int>((words[x >> 6] >> (x & 63)) & 0xF);
+        const __m128i mask = _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(nibble), bits), bits);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + x),
+                         _mm_or_si128(_mm_and_si128(mask, onv), _mm_andnot_si128(mask, offv)));
+    }
+}
+
+__attribute__((target("avx2")))
+static void ExpandAVX2(const uint64_t *words, int count, uint32_t on, uint32_t off, uint32_t *out) {
+    const __m256i bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    const __m256i onv = _mm256_set1_epi32(static_cast<int>(on));
+    const __m256i offv = _mm256_set1_epi32(static_cast<int>(off));
+    for (int x = 0; x < count; x += 8) {
+        const int byte = static_cast<int>((words[x >> 6] >> (x & 63)) & 0xFF);
+        const __m256i mask = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(byte), bits), bits);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + x), _mm256_blendv_epi8(offv, onv, mask));
+    }
+}
+
+// Eight output columns at a time, each picked from the eight inner columns
+// starting at ChunkStart. Upscaling never spans more than eight.
+__attribute__((target("avx2")))
+static void StretchAVX2(const uint32_t *line, const uint16_t *start, const uint32_t *perm, int chunks, uint32_t *out) {
+    for (int c = 0; c < chunks; ++c) {
+        const __m256i source = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(line + start[c]));
+        const __m256i lanes = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(perm + c * 8));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + c * 8), _mm256_permutevar8x32_epi32(source, lanes));
+    }
+}
+
+static void StretchSSE2(const uint32_t *line, const uint16_t *runs, int count, uint32_t *out) {
+    for (int x = 0; x < count; ++x) {
+        const __m128i colour = _mm_set1_epi32(static_cast<int>(line[x]));
+        int run = runs[x];
+        for (; run >= 4; run -= 4, out += 4) {
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out), colour);
+        }
+        for (; run > 0; --run) {
+            *out++ = line[x];
+        }
+    }
+}
+#endif
+
+static void Expand(const uint64_t *words, int count, uint32_t on, uint32_t off, uint32_t *out) {
+#ifdef SCALER_X86
+    if (ISA == ISA_AVX2)
+        return ExpandAVX2(words, count, on, off, out);
+    if (ISA == ISA_SSE2)
+        return ExpandSSE2(words, count, on, off, out);
+#endif
+    ExpandScalar(words, count, on, off, out);
+}
+
+// Neighbours of every pixel of a row, edges repeat the border pixel
+static inline uint64_t Left(const uint64_t *row, int w) {
+    return (row[w] << 1) | (w > 0 ? row[w - 1] >> 63 : row[0] & 1);
+}
+
+static inline uint64_t Right(const uint64_t *row, int w, int words) {
+    return (row[w] >> 1) | (w + 1 < words ? row[w + 1] << 63 : row[w] & (1ULL << 63));
+}
+
+// Bits 0..31 of x to the even bits of the result
+static inline uint64_t Spread2(uint64_t x) {
+    x &= 0xFFFFFFFFULL;
+    x = (x | (x << 16)) & 0x0000FFFF0000FFFFULL;
+    x = (x | (x << 8)) & 0x00FF00FF00FF00FFULL;
+    x = (x | (x << 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    x = (x | (x << 2)) & 0x3333333333333333ULL;
+    x = (x | (x << 1)) & 0x5555555555555555ULL;
+    return x;
+}
+
+// Bits of a byte to every third bit of 24
+struct Spread3Table {
+    uint32_t Values[256];
+    Spread3Table() {
+        for (int byte = 0; byte < 256; ++byte) {
+            uint32_t value = 0;
+            for (int bit = 0; bit < 8; ++bit) {
+                value |= ((byte >> bit) & 1u) << (bit * 3);
+            }
+            Values[byte] = value;
+        }
+    }
+};
+static const Spread3Table Spread3;
+
+// All 64 pixels of a word at once. Per pixel, with B above, D left, F right
+// and H below E:
+//   E0 = B == D && B != F && D != H ? D : E     E1 = B == F && B != D && F != H ? F : E
+//   E2 = D == H && D != B && H != F ? D : E     E3 = H == F && H != D && F != B ? F : E
+static void Scale2x(const uint64_t *rows, int words, int height, uint64_t *out) {
+    for (int y = 0; y < height; ++y) {
+        const uint64_t *up = rows + std::max(y - 1, 0) * words;
+        const uint64_t *row = rows + y * words;
+        const uint64_t *down = rows + std::min(y + 1, height - 1) * words;
+        uint64_t *top = out + (2 * y) * (2 * words);
+        uint64_t *bottom = top + 2 * words;
+
+        for (int w = 0; w < words; ++w) {
+            const uint64_t B = up[w], H = down[w], E = row[w];
+            const uint64_t D = Left(row, w), F = Right(row, w, words);
+            const uint64_t c0 = ~(B ^ D) & (B ^ F) & (D ^ H);
+            const uint64_t c1 = ~(B ^ F) & (B ^ D) & (F ^ H);
+            const uint64_t c2 = ~(D ^ H) & (D ^ B) & (H ^ F);
+            const uint64_t c3 = ~(H ^ F) & (H ^ D) & (F ^ B);
+            const uint64_t e0 = (c0 & D) | (~c0 & E), e1 = (c1 & F) | (~c1 & E);
+            const uint64_t e2 = (c2 & D) | (~c2 & E), e3 = (c3 & F) | (~c3 & E);
+
+            top[2 * w] = Spread2(e0) | (Spread2(e1) << 1);
+            top[2 * w + 1] = Spread2(e0 >> 32) | (Spread2(e1 >> 32) << 1);
+            bottom[2 * w] = Spread2(e2) | (Spread2(e3) << 1);
+            bottom[2 * w + 1] = Spread2(e2 >> 32) | (Spread2(e3 >> 32) << 1);
+        }
+    }
+}
+
+// Interleaves three words of sub-pixels into 192 output bits
+static void Weave3(uint64_t a, uint64_t b, uint64_t c, uint64_t *out) {
+    out[0] = out[1] = out[2] = 0;
+    for (int byte = 0; byte < 8; ++byte) {
+        const int shift = byte * 8;
+        const uint64_t bits = Spread3.Values[(a >> shift) & 0xFF] | (Spread3.Values[(b >> shift) & 0xFF] << 1) |
+                              (Spread3.Values[(c >> shift) & 0xFF] << 2);
+        const int offset = byte * 24;
+        out[offset >> 6] |= bits << (offset & 63);
+        if ((offset & 63) > 40)
+            out[(offset >> 6) + 1] |= bits >> (64 - (offset & 63));
+    }
+}
+
+// Same idea with the full neighbourhood, A B C / D E F / G H I
+static void Scale3x(const uint64_t *rows, int words, int height, uint64_t *out) {
+    for (int y = 0; y < height; ++y) {
+        const uint64_t *up = rows + std::max(y - 1, 0) * words;
+        const uint64_t *row = rows + y * words;
+        const uint64_t *down = rows + std::min(y + 1, height - 1) * words;
+        uint64_t *r0 = out + (3 * y) * (3 * words);
+        uint64_t *r1 = r0 + 3 * words;
+        uint64_t *r2 = r1 + 3 * words;
+
+        for (int w = 0; w < words; ++w) {
+            const uint64_t A = Left(up, w), B = up[w], C = Right(up, w, words);
+            const uint64_t D = Left(row, w), E = row[w], F = Right(row, w, words);
+            const uint64_t G = Left(down, w), H = down[w], I = Right(down, w, words);
+
+            const uint64_t db = ~(D ^ B) & (B ^ F) & (D ^ H);   // D == B && B != F && D != H
+            const uint64_t bf = ~(B ^ F) & (B ^ D) & (F ^ H);   // B == F && B != D && F != H
+            const uint64_t dh = ~(D ^ H) & (D ^ B) & (H ^ F);   // D == H && D != B && H != F
+            const uint64_t hf = ~(H ^ F) & (D ^ H) & (B ^ F);   // H == F && D != H && B != F
+
+            const uint64_t m0 = db, m2 = bf, m6 = dh, m8 = hf;
+            const uint64_t m1 = (db & (E ^ C)) | (bf & (E ^ A));
+            const uint64_t m3 = (db & (E ^ G)) | (dh & (E ^ A));
+            const uint64_t m5 = (bf & (E ^ I)) | (hf & (E ^ C));
+            const uint64_t m7 = (dh & (E ^ I)) | (hf & (E ^ G));
+
+            auto pick = [E](uint64_t mask, uint64_t value) { return (mask & value) | (~mask & E); };
+            Weave3(pick(m0, D), pick(m1, B), pick(m2, F), r0 + 3 * w);
+            Weave3(pick(m3, D), E, pick(m5, F), r1 + 3 * w);
+            Weave3(pick(m6, D), pick(m7, H), pick(m8, F), r2 + 3 * w);
+        }
+    }
+}
+
+FrameScaler::FrameScaler(E_SCALER filter, int scale, int width, int height)
+    : On(PackRGBA(0xFF, 0xFF, 0xFF)), Off(PackRGBA(0x00, 0x00, 0x00)), Persistence(0.6f), Filter(filter),
+      SourceWidth(width), SourceHeight(height), RampOn(0), RampOff(0), RampPersistence(-1.0f) {
+    scale = std::max(scale, 1);
+    Factor = filter == SCALER_SCALE2X ? 2 : filter == SCALER_SCALE3X ? 3 : 1;
+    // The pixel art pass never shrinks, a smaller scale just stretches its output less
+    scale = std::max(scale, Factor);
+
+    InnerWidth = width * Factor;
+    InnerHeight = height * Factor;
+    OutWidth = width * scale;
+    OutHeight = height * scale;
+
+    if (Factor > 1)
+        Inner.resize(static_cast<size_t>(InnerWidth / 64) * InnerHeight);
+    Line.resize(InnerWidth + 8);
+    if (Filter == SCALER_PHOSPHOR)
+        Brightness.assign(static_cast<size_t>(width) * height, 0);
+
+    Columns.resize(OutWidth);
+    Runs.assign(InnerWidth, 0);
+    for (int x = 0; x < OutWidth; ++x) {
+        Columns[x] = static_cast<uint16_t>(x * InnerWidth / OutWidth);
+        ++Runs[Columns[x]];
+    }
+    for (int c = 0; c < OutWidth / 8; ++c) {
+        ChunkStart.push_back(Columns[c * 8]);
+        for (int k = 0; k < 8; ++k) {
+            ChunkPerm.push_back(Columns[c * 8 + k] - Columns[c * 8]);
+        }
+    }
+}
+
+void FrameScaler::Reset() {
+    std::fill(Brightness.begin(), Brightness.end(), 0);
+}
+
+void FrameScaler::Stretch(const uint32_t *line, uint32_t *out) const {
+#ifdef SCALER_X86
+    if (ISA == ISA_AVX2)
+        return StretchAVX2(line, ChunkStart.data(), ChunkPerm.data(), OutWidth / 8, out);
+    if (ISA == ISA_SSE2)
+        return StretchSSE2(line, Runs.data(), InnerWidth, out);
+#endif
+    for (int x = 0; x < OutWidth; ++x) {
+        out[x] = line[Columns[x]];
+    }
+}
+
+// Lit pixels go to full brightness, the rest keep Persistence of theirs
+void FrameScaler::Decay(const uint64_t *rows) {
+    const int words = SourceWidth / 64;
+    const uint16_t keep = static_cast<uint16_t>(std::min(std::max(Persistence, 0.0f), 1.0f) * 256.0f);
+    for (int y = 0; y < SourceHeight; ++y) {
+        uint8_t *level = &Brightness[static_cast<size_t>(y) * SourceWidth];
+        for (int x = 0; x < SourceWidth; ++x) {
+            const bool lit = (rows[y * words + (x >> 6)] >> (x & 63)) & 1;
+            level[x] = lit ? 0xFF : static_cast<uint8_t>((level[x] * keep) >> 8);
+        }
+    }
+
+    if (RampOn != On || RampOff != Off || RampPersistence != Persistence) {
+        for (int level = 0; level < 256; ++level) {
+            uint32_t colour = 0;
+            for (int channel = 0; channel < 32; channel += 8) {
+                const int from = (Off >> channel) & 0xFF, to = (On >> channel) & 0xFF;
+                colour |= static_cast<uint32_t>(from + (to - from) * level / 255) << channel;
+            }
+            Ramp[level] = colour;
+        }
+        RampOn = On;
+        RampOff = Off;
+        RampPersistence = Persistence;
+    }
+}
+
+void FrameScaler::Scale(const uint64_t *rows, uint32_t *rgba) {
+    const uint64_t *source = rows;
+    if (Factor == 2) {
+        Scale2x(rows, SourceWidth / 64, SourceHeight, Inner.data());
+        source = Inner.data();
+    }
+    else if (Factor == 3) {
+        Scale3x(rows, SourceWidth / 64, SourceHeight, Inner.data());
+        source = Inner.data();
+    }
+    if (Filter == SCALER_PHOSPHOR)
+        Decay(rows);
+
+    const int words = InnerWidth / 64;
+    int previous = -1;
+    for (int y = 0; y < OutHeight; ++y) {
+        uint32_t *out = rgba + static_cast<size_t>(y) * OutWidth;
+        const int inner = y * InnerHeight / OutHeight;
+        if (inner == previous) {
+            memcpy(out, out - OutWidth, OutWidth * sizeof(uint32_t));
+            continue;
+        }
+        previous = inner;
+
+        if (Filter == SCALER_PHOSPHOR) {
+            const uint8_t *level = &Brightness[static_cast<size_t>(inner) * SourceWidth];
+            for (int x = 0; x < InnerWidth; ++x) {
+                Line[x] = Ramp[level[x]];
+            }
+        }
+        else {
+            Expand(source + inner * words, InnerWidth, On, Off, Line.data());
+        }
+        Stretch(Line.data(), out);
+    }
+}
+
+void FrameScaler::Scale(const PackedFrame &frame, uint32_t *rgba) {
+    Scale(frame.Rows, rgba);
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct PackedFrame;
+
+enum E_SCALER {
+    SCALER_NEAREST,
+    SCALER_SCALE2X,     // Also known as EPX, the rules are the same
+    SCALER_SCALE3X,
+    SCALER_PHOSPHOR     // Nearest over a per-pixel brightness that fades out
+};
+
+// nearest, scale2x, epx, scale3x or phosphor
+bool ParseScaler(const std::string &name, E_SCALER &filter);
+
+// Binary PPM of Width x Height RGBA pixels, alpha is dropped
+bool SavePPM(const std::string &file, const uint32_t *rgba, int width, int height);
+
+// Colour as laid out in memory, red first, same as IM_COL32
+inline uint32_t PackRGBA(uint8_t r, uint8_t g, uint8_t b, uint8_t a = 0xFF) {
+    return r | (g << 8) | (b << 16) | (static_cast<uint32_t>(a) << 24);
+}
+
+// Turns 1-bit frames into RGBA at any integer scale on the CPU, for
+// exports and screenshots where there is no GPU. Scale2x and Scale3x work
+// on whole 64 pixel words of the packed rows, the RGBA expansion and
+// stretching use AVX2 or SSE2 when the CPU has them.
+class FrameScaler {
+public:
+    // width must be a multiple of 64
+    FrameScaler(E_SCALER filter, int scale, int width = 64, int height = 32);
+
+    int Width() const { return OutWidth; }
+    int Height() const { return OutHeight; }
+
+    // rows holds width / 64 words per row, bit x of a word is pixel x.
+    // Writes Width() x Height() pixels.
+    void Scale(const uint64_t *rows, uint32_t *rgba);
+    void Scale(const PackedFrame &frame, uint32_t *rgba);
+
+    // Phosphor only, forget the brightness built up so far
+    void Reset();
+
+    uint32_t On;
+    uint32_t Off;
+    float Persistence;      // Phosphor, share of the brightness kept from one frame to the next
+
+private:
+    void Stretch(const uint32_t *line, uint32_t *out) const;
+    void Decay(const uint64_t *rows);
+
+    E_SCALER Filter;
+    int SourceWidth, SourceHeight;
+    int Factor;             // Of the pixel art pass, 1 for none
+    int InnerWidth, InnerHeight;
+    int OutWidth, OutHeight;
+
+    std::vector<uint64_t> Inner;        // Output of the pixel art pass
+    std::vector<uint16_t> Columns;      // Output column to inner column
+    std::vector<uint16_t> Runs;         // Output columns per inner column
+    std::vector<uint16_t> ChunkStart;   // AVX2, first inner column of 8 output columns
+    std::vector<uint32_t> ChunkPerm;    // AVX2, lane offsets from there
+    std::vector<uint32_t> Line;         // One inner row in colours, padded for vector loads
+
+    std::vector<uint8_t> Brightness;    // Phosphor, one byte per source pixel
+    uint32_t Ramp[256];                 // Phosphor, brightness to colour
+    uint32_t RampOn, RampOff;
+    float RampPersistence;
+};
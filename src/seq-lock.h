@@ -0,0 +1,69 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// Publishes a small value from the emulation thread to any number of
+// readers without a lock. Readers never stall the writer, they retry the
+// copy if a store overlapped it. The value lives in atomic words so the
+// racing copies are well defined.
+template <typename T>
+class SeqLock {
+    static_assert(std::is_trivially_copyable<T>::value, "SeqLock values are copied word by word");
+
+public:
+    SeqLock() : Sequence(0) {
+        for (auto &word : Words) {
+            word.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    // Writers are expected to be one thread at a time, overlapping ones are
+    // serialized on the odd count rather than corrupting the value
+    void Store(const T &value) {
+        uint64_t buffer[WordCount] = {};
+        memcpy(buffer, &value, sizeof(T));
+
+        uint32_t sequence = Sequence.load(std::memory_order_relaxed);
+        while ((sequence & 1) || !Sequence.compare_exchange_weak(sequence, sequence + 1, std::memory_order_acquire,
+                                                                  std::memory_order_relaxed)) {
+            sequence = Sequence.load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_release);
+
+        for (size_t i = 0; i < WordCount; ++i) {
+            Words[i].store(buffer[i], std::memory_order_relaxed);
+        }
+        Sequence.store(sequence + 2, std::memory_order_release);
+    }
+
+    // Any thread, always returns a value that was stored as a whole
+    T Load() const {
+        uint64_t buffer[WordCount];
+        uint32_t before, after;
+        do {
+            before = Sequence.load(std::memory_order_acquire);
+            for (size_t i = 0; i < WordCount; ++i) {
+                buffer[i] = Words[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = Sequence.load(std::memory_order_relaxed);
+        } while ((before & 1) || before != after);
+
+        T value;
+        memcpy(&value, buffer, sizeof(T));
+        return value;
+    }
+
+    // Changes with every store, lets readers skip work on unchanged values
+    uint32_t Version() const {
+        return Sequence.load(std::memory_order_acquire) >> 1;
+    }
+
+private:
+    static const size_t WordCount = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+    std::atomic<uint32_t> Sequence;
+    std::atomic<uint64_t> Words[WordCount];
+};
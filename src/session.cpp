@@ -0,0 +1,288 @@
+#include "session.h"
+#include "latency-probe.h"
+#include "program-reader.h"
+#include "rom-archive.h"
+#include "translation-cache.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <utility>
+
+Session::Session(uint32_t id) : Id(id), Hash(0), Claimed(false) {
+    Settings = RomDatabase::Defaults();
+    Running = false;
+    Speed = 1.0f;
+    Achieved = 0.0f;
+    Instructions = 0;
+    Frames = 0;
+
+    Owed = 0.0;
+    Paused = true;
+    WindowFrames = 0;
+
+    Sound = 0;
+    memset(Pattern, 0x00, sizeof(Pattern));
+    Pitch = 64;
+    PatternLoaded = false;
+    Version = 0;
+}
+
+void Session::Claim() {
+    while (!TryClaim()) {
+        std::this_thread::yield();
+    }
+}
+
+bool Session::Load(const std::string &path, const RomDatabase &database, TranslationCache *cache) {
+    ProgramReader pr;
+    if (!pr.Load(path))
+        return false;
+
+    const size_t slash = path.find_last_of("/\\");
+    return Loaded(pr, slash == std::string::npos ? path : path.substr(slash + 1), database, cache);
+}
+
+bool Session::Load(const RomArchive &archive, const ArchiveEntry &entry, const RomDatabase &database, TranslationCache *cache) {
+    ProgramReader pr;
+    if (!pr.Load(archive, entry))
+        return false;
+    return Loaded(pr, archive.Name(entry), database, cache);
+}
+
+void Session::Load(const Session &other, TranslationCache *cache) {
+    if (cache)
+        cache->Store(Hash, Machine);
+
+    Machine.ClearMemory();
+    if (!other.Program.empty())
+        memcpy(&Machine.memory[PROGRAM_START], other.Program.data(), other.Program.size());
+    Program = other.Program;
+    Hash = other.Hash;
+    Title = other.Title;
+    Settings = other.Settings;
+    Settings.Quirks = other.Machine.Quirks;
+    Machine.Quirks = other.Machine.Quirks;
+    Machine.ClockSpeed = other.Machine.ClockSpeed;
+
+    Restart();
+    if (cache)
+        cache->Load(Hash, Machine);
+}
+
+bool Session::Loaded(ProgramReader &pr, const std::string &title, const RomDatabase &database, TranslationCache *cache) {
+    // Per-ROM settings, falling back to the defaults for unknown ROMs
+    RomSettings settings;
+    if (!database.Find(pr.Hash, settings))
+        settings = RomDatabase::Defaults();
+    if (!pr.Fits(settings.Quirks.Platform))
+        return false;
+
+    // The running program stays untouched until the new one is known to load
+    if (cache)
+        cache->Store(Hash, Machine);
+    {
+        auto guard = Machine.Lock();
+        Machine.ClearMemory();
+        if (pr.Size > 0)
+            memcpy(&Machine.memory[PROGRAM_START], pr.Program.data(), pr.Size);
+    }
+
+    Program = std::move(pr.Program);
+    Hash = pr.Hash;
+    Title = title;
+    Settings = settings;
+    if (!Settings.Title.empty())
+        Title = Settings.Title;
+    Machine.Quirks = Settings.Quirks;
+    Machine.ClockSpeed = 1.0f / (60.0f * Settings.InstructionsPerFrame);
+
+    Restart();
+    if (cache)
+        cache->Load(Hash, Machine);
+    return true;
+}
+
+void Session::Restart() {
+    Machine.Init();
+    Machine.ScreenDirty = true;
+    Publish();
+}
+
+void Session::Publish() {
+    std::lock_guard<std::mutex> guard(FrameGuard);
+    if (Machine.ScreenDirty) {
+        Frame = Machine.screen;
+        Machine.ScreenDirty = false;
+        Version.fetch_add(1, std::memory_order_release);
+    }
+    Sound = Machine.Sound;
+    memcpy(Pattern, Machine.Pattern, sizeof(Pattern));
+    Pitch = Machine.Pitch;
+    PatternLoaded = Machine.PatternLoaded;
+}
+
+uint32_t Session::Advance(std::chrono::steady_clock::time_point now, std::chrono::microseconds slice) {
+    double seconds = std::chrono::duration<double>(now - Last).count();
+    Last = now;
+    if (!Running) {
+        Paused = true;
+        Achieved = 0.0f;
+        return 0;
+    }
+    if (Paused) {
+        // Nothing is owed for the time spent paused
+        Paused = false;
+        Owed = 0.0;
+        seconds = 0.0;
+        Window = now;
+        WindowFrames = 0;
+    }
+
+    const float speed = Speed;
+    const double rate = Machine.ClockSpeed > 0.0f ? 1.0 / (60.0 * Machine.ClockSpeed) : 1.0;
+    const uint32_t ipf = static_cast<uint32_t>(std::max(1L, lround(rate)));
+    const auto deadline = now + slice;
+    if (speed > 0.0f) {
+        // At most a tenth of a second behind, a long stall is not caught up on
+        Owed = std::min(Owed + seconds * 60.0 * speed, std::max(1.0, 6.0 * speed));
+    }
+
+    uint32_t executed = 0, frames = 0;
+    while (speed > 0.0f ? Owed >= 1.0 : std::chrono::steady_clock::now() < deadline) {
+        const uint32_t ran = Machine.Run(ipf);
+        executed += ran;
+        if (Machine.Probe)
+            Machine.Probe->AfterRun(Machine, ran);
+        if (ran < ipf && (Machine.Blocked || Machine.Debug.Reason != BREAK_NONE)) {
+            // Waiting for a key is not time to make up for afterwards
+            Owed = std::min(Owed, 1.0);
+            break;
+        }
+        Owed -= 1.0;
+        ++frames;
+        Video.Capture(Machine.screen);
+        if (std::chrono::steady_clock::now() >= deadline)
+            break;
+    }
+    if (Machine.Debug.Reason != BREAK_NONE)
+        Running = false;
+    Publish();
+
+    Instructions += executed;
+    Frames += frames;
+    WindowFrames += frames;
+    const double span = std::chrono::duration<double>(now - Window).count();
+    if (span >= 0.5) {
+        Achieved = static_cast<float>(WindowFrames / (span * 60.0));
+        Window = now;
+        WindowFrames = 0;
+    }
+    return executed;
+}
+
+bool Session::CopyFrame(Display &screen, uint32_t &version) const {
+    if (Version.load(std::memory_order_acquire) == version)
+        return false;
+
+    std::lock_guard<std::mutex> guard(FrameGuard);
+    screen = Frame;
+    version = Version.load(std::memory_order_relaxed);
+    return true;
+}
+
+void Session::CopyAudio(uint8_t &sound, uint8_t pattern[16], uint8_t &pitch, bool &loaded) const {
+    std::lock_guard<std::mutex> guard(FrameGuard);
+    sound = Sound;
+    memcpy(pattern, Pattern, sizeof(Pattern));
+    pitch = Pitch;
+    loaded = PatternLoaded;
+}
+
+SessionPool::SessionPool() : Slice(4000), NextId(1) {
+    SleepNs = 0;
+    Stopping = false;
+    Cursor = 0;
+    Sessions = std::make_shared<const std::vector<std::shared_ptr<Session> > >();
+}
+
+SessionPool::~SessionPool() {
+    Stop();
+}
+
+void SessionPool::Start(unsigned threads) {
+    Stop();
+    if (threads == 0) {
+        const unsigned cores = std::thread::hardware_concurrency();
+        threads = cores > 1 ? cores - 1 : 1;
+    }
+
+    Stopping = false;
+    for (unsigned i = 0; i < threads; ++i) {
+        Workers.emplace_back(&SessionPool::Work, this);
+    }
+}
+
+void SessionPool::Stop() {
+    Stopping = true;
+    for (auto &worker : Workers) {
+        worker.join();
+    }
+    Workers.clear();
+}
+
+std::shared_ptr<Session> SessionPool::Add() {
+    std::lock_guard<std::mutex> guard(Guard);
+    auto session = std::make_shared<Session>(NextId++);
+    auto sessions = std::make_shared<std::vector<std::shared_ptr<Session> > >(*Sessions);
+    sessions->push_back(session);
+    Sessions = sessions;
+    return session;
+}
+
+void SessionPool::Remove(uint32_t id) {
+    std::shared_ptr<Session> removed;
+    {
+        std::lock_guard<std::mutex> guard(Guard);
+        auto sessions = std::make_shared<std::vector<std::shared_ptr<Session> > >(*Sessions);
+        auto it = std::find_if(sessions->begin(), sessions->end(), [id](const std::shared_ptr<Session> &session) {
+            return session->Id == id;
+        });
+        if (it == sessions->end())
+            return;
+        removed = *it;
+        sessions->erase(it);
+        Sessions = sessions;
+    }
+
+    // Stop it here, workers that still see the old list find it paused
+    SessionClaim claim(*removed);
+    removed->Running = false;
+}
+
+std::shared_ptr<const std::vector<std::shared_ptr<Session> > > SessionPool::Snapshot() const {
+    std::lock_guard<std::mutex> guard(Guard);
+    return Sessions;
+}
+
+void SessionPool::Work() {
+    while (!Stopping) {
+        const auto sessions = Snapshot();
+        const size_t count = sessions->size();
+
+        bool worked = false;
+        for (size_t i = 0; i < count; ++i) {
+            Session &session = *(*sessions)[Cursor.fetch_add(1, std::memory_order_relaxed) % count];
+            if (!session.TryClaim())
+                continue;
+            worked |= session.Advance(std::chrono::steady_clock::now(), Slice) != 0;
+            session.Release();
+        }
+
+        // Real time sessions owe a frame every 16 ms, idle between them
+        if (!worked) {
+            const auto before = std::chrono::steady_clock::now();
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+            SleepNs += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - before).count();
+        }
+    }
+}
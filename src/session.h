@@ -0,0 +1,140 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "chip8.h"
+#include "frame-recorder.h"
+#include "rom-database.h"
+
+class ProgramReader;
+class RomArchive;
+struct ArchiveEntry;
+class TranslationCache;
+
+// One machine hosted next to others in the same process. A SessionPool worker
+// runs it in whole 60 Hz frames and publishes the screen and sound state;
+// the render thread copies them out only when they changed.
+//
+// Whoever touches Machine outside of Advance claims the session first.
+// Workers skip sessions that are claimed, so the GUI waits for at most one
+// time slice and never for the other sessions.
+class Session {
+public:
+    explicit Session(uint32_t id);
+
+    const uint32_t Id;
+    CHIP8 Machine;
+    RomSettings Settings;
+    std::string Title;
+    uint64_t Hash;          // Of the loaded program, keys the translation cache
+    std::vector<uint8_t> Program;   // As loaded, for restarts in other sessions
+
+    bool TryClaim() {
+        bool expected = false;
+        return Claimed.compare_exchange_strong(expected, true, std::memory_order_acquire);
+    }
+    void Claim();
+    void Release() { Claimed.store(false, std::memory_order_release); }
+
+    // With the session claimed. The cache, when given, keeps decoded tables across loads.
+    bool Load(const std::string &path, const RomDatabase &database, TranslationCache *cache);
+    bool Load(const RomArchive &archive, const ArchiveEntry &entry, const RomDatabase &database, TranslationCache *cache);
+    // Program, title and quirks of `other`, read from the thread that loads both
+    void Load(const Session &other, TranslationCache *cache);
+    void Restart();
+    // Makes changes done while claimed visible to CopyFrame and CopyAudio
+    void Publish();
+
+    // Worker thread, with the session claimed. Runs the frames owed since the
+    // last call for at most `slice`, returns the instructions executed.
+    uint32_t Advance(std::chrono::steady_clock::time_point now, std::chrono::microseconds slice);
+
+    // Copies the screen only when it changed since `version`
+    bool CopyFrame(Display &screen, uint32_t &version) const;
+    uint32_t FrameVersion() const { return Version.load(std::memory_order_acquire); }
+    void CopyAudio(uint8_t &sound, uint8_t pattern[16], uint8_t &pitch, bool &loaded) const;
+
+    // Set from any thread
+    std::atomic<bool> Running;
+    std::atomic<float> Speed;       // Multiple of real time, 0 runs as fast as the slice allows
+
+    // Measured over half a second of wall time
+    std::atomic<float> Achieved;
+    std::atomic<uint64_t> Instructions;
+    std::atomic<uint64_t> Frames;
+
+    // Captured by the worker once per emulated frame
+    FrameRecorder Video;
+
+private:
+    bool Loaded(ProgramReader &pr, const std::string &title, const RomDatabase &database, TranslationCache *cache);
+
+    std::atomic<bool> Claimed;
+
+    // Worker side
+    double Owed;
+    bool Paused;
+    std::chrono::steady_clock::time_point Last;
+    std::chrono::steady_clock::time_point Window;
+    uint64_t WindowFrames;
+
+    mutable std::mutex FrameGuard;
+    Display Frame;
+    uint8_t Sound;
+    uint8_t Pattern[16];
+    uint8_t Pitch;
+    bool PatternLoaded;
+    std::atomic<uint32_t> Version;
+};
+
+// Holds a claim until the end of the scope
+class SessionClaim {
+public:
+    explicit SessionClaim(Session &session) : Owner(session) { Owner.Claim(); }
+    ~SessionClaim() { Owner.Release(); }
+
+private:
+    Session &Owner;
+};
+
+// Worker threads shared by every session. Each pass claims sessions round
+// robin, so a worker never blocks on one the GUI holds, and a session never
+// runs on two workers at once.
+class SessionPool {
+public:
+    SessionPool();
+    ~SessionPool();
+
+    // 0 picks one worker per core besides the render thread, at least one
+    void Start(unsigned threads = 0);
+    void Stop();
+    unsigned Threads() const { return static_cast<unsigned>(Workers.size()); }
+
+    std::shared_ptr<Session> Add();
+    // A worker still holding the session finishes its slice first
+    void Remove(uint32_t id);
+    // Never waits on the workers, just hands out the current list
+    std::shared_ptr<const std::vector<std::shared_ptr<Session> > > Snapshot() const;
+
+    // Longest a worker stays on one session before moving to the next
+    std::chrono::microseconds Slice;
+    // Time the workers spent idle, summed over all of them
+    std::atomic<uint64_t> SleepNs;
+
+private:
+    void Work();
+
+    mutable std::mutex Guard;
+    std::shared_ptr<const std::vector<std::shared_ptr<Session> > > Sessions;
+    uint32_t NextId;
+
+    std::vector<std::thread> Workers;
+    std::atomic<bool> Stopping;
+    std::atomic<uint32_t> Cursor;
+};
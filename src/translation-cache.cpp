@@ -0,0 +1,153 @@
+#include "translation-cache.h"
+#include "chip8.h"
+#include "program-reader.h"
+#include <cstdio>
+#include <cstring>
+#include <experimental/filesystem>
+#include <fstream>
+#include <functional>
+#include <thread>
+#include <vector>
+
+namespace fs = std::experimental::filesystem;
+
+static_assert(sizeof(CachedOp) == 16, "CachedOp is written to disk as is");
+
+TranslationCache::TranslationCache(const std::string &directory) : Directory(directory), Loaded(0), Dropped(0), LoadedHash(0) {
+}
+
+std::string TranslationCache::Path(uint64_t hash) const {
+    char name[24];
+    snprintf(name, sizeof(name), "%016llx.c8dc", static_cast<unsigned long long>(hash));
+    return Directory.empty() ? name : Directory + "/" + name;
+}
+
+static bool IsSane(const CachedOp &entry) {
+    const DecodedOp &op = entry.Op;
+    return entry.Address < MEMORY_SIZE && op.Op <= OP_WAIT_DT && op.X < 16 && op.Y < 16 && op.N < 16 &&
+           op.NNN < MEMORY_SIZE;
+}
+
+bool TranslationCache::Load(uint64_t hash, CHIP8 &chp) {
+    Loaded = 0;
+    Dropped = 0;
+    LoadedHash = hash;
+    Error.clear();
+
+    std::ifstream file(Path(hash).c_str(), std::ios::binary | std::ios::ate);
+    if (!file)
+        return false;
+
+    std::vector<uint8_t> data(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    if (data.size() < sizeof(CacheHeader) || !file.read(reinterpret_cast<char *>(data.data()), data.size())) {
+        Error = "Cache file is truncated";
+        return false;
+    }
+
+    CacheHeader header;
+    memcpy(&header, data.data(), sizeof(header));
+    if (header.Magic != CACHE_MAGIC || header.Version != CACHE_VERSION || header.Hash != hash) {
+        Error = "Cache file is from another engine version or ROM";
+        return false;
+    }
+    if (header.Fusion != (chp.Engine.Fusion ? 1u : 0u)) {
+        Error = "Cache file was built with a different fusion setting";
+        return false;
+    }
+    const uint8_t *entries = data.data() + sizeof(CacheHeader);
+    if (header.Count > MEMORY_SIZE || data.size() != sizeof(CacheHeader) + header.Count * sizeof(CachedOp) ||
+        HashProgram(entries, header.Count * sizeof(CachedOp)) != header.Checksum) {
+        Error = "Cache file is corrupt";
+        return false;
+    }
+
+    auto guard = chp.Lock();
+    PredecodedEngine &engine = chp.Engine;
+    engine.Invalidate();
+    engine.Generation = chp.CodeGeneration;
+
+    for (uint32_t i = 0; i < header.Count; ++i) {
+        CachedOp entry;
+        memcpy(&entry, entries + i * sizeof(CachedOp), sizeof(entry));
+
+        bool same = IsSane(entry);
+        for (uint16_t k = 0; same && k < sizeof(entry.Source); ++k) {
+            same = chp.memory[(entry.Address + k) & MEMORY_MASK] == entry.Source[k];
+        }
+        if (!same) {
+            ++Dropped;
+            continue;
+        }
+
+        engine.Ops[entry.Address] = entry.Op;
+        engine.Valid.set(entry.Address);
+        for (uint16_t k = 0; k < sizeof(entry.Source); ++k) {
+            chp.CodeMap.set((entry.Address + k) & MEMORY_MASK);
+        }
+        ++Loaded;
+    }
+    return Loaded > 0;
+}
+
+bool TranslationCache::Store(uint64_t hash, CHIP8 &chp) {
+    std::vector<CachedOp> entries;
+    {
+        auto guard = chp.Lock();
+        const PredecodedEngine &engine = chp.Engine;
+
+        // Ops decoded before the last write into code may not match memory anymore
+        if (engine.Generation != chp.CodeGeneration)
+            return false;
+
+        for (uint16_t address = 0; address < MEMORY_SIZE; ++address) {
+            if (!engine.Valid[address])
+                continue;
+            CachedOp entry;
+            memset(&entry, 0, sizeof(entry));
+            entry.Address = address;
+            for (uint16_t k = 0; k < sizeof(entry.Source); ++k) {
+                entry.Source[k] = chp.memory[(address + k) & MEMORY_MASK];
+            }
+            entry.Op = engine.Ops[address];
+            entries.push_back(entry);
+        }
+    }
+    if (entries.empty() || (hash == LoadedHash && entries.size() <= Loaded))
+        return false;
+
+    CacheHeader header;
+    header.Magic = CACHE_MAGIC;
+    header.Version = CACHE_VERSION;
+    header.Fusion = chp.Engine.Fusion ? 1 : 0;
+    header.Count = static_cast<uint32_t>(entries.size());
+    header.Hash = hash;
+    header.Checksum = HashProgram(reinterpret_cast<const uint8_t *>(entries.data()), entries.size() * sizeof(CachedOp));
+
+    std::error_code error;
+    if (!Directory.empty())
+        fs::create_directories(Directory, error);
+
+    // Write aside and rename, concurrent workers may store the same ROM
+    const std::string filename = Path(hash);
+    const std::string temporary = filename + ".tmp" + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+    {
+        std::ofstream file(temporary.c_str(), std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char *>(entries.data()), entries.size() * sizeof(CachedOp));
+        if (!file) {
+            Error = "Could not write " + temporary;
+            remove(temporary.c_str());
+            return false;
+        }
+    }
+    if (rename(temporary.c_str(), filename.c_str()) != 0) {
+        Error = "Could not replace " + filename;
+        remove(temporary.c_str());
+        return false;
+    }
+
+    LoadedHash = hash;
+    Loaded = header.Count;
+    return true;
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+#include "predecoded-engine.h"
+
+class CHIP8;
+
+// One file per ROM, <directory>/<rom hash>.c8dc, all fields little-endian:
+//   header   CacheHeader
+//   entries  CachedOp x count
+#define CACHE_MAGIC 0x43443843      // "C8DC"
+#define CACHE_VERSION (0x10000 | PREDECODED_ENGINE_VERSION)
+
+struct CacheHeader {
+    uint32_t Magic;
+    uint32_t Version;
+    uint32_t Fusion;        // Fused and plain tables are not interchangeable
+    uint32_t Count;
+    uint64_t Hash;          // ROM the tables were built for
+    uint64_t Checksum;      // HashProgram over the entries
+};
+
+struct CachedOp {
+    uint16_t Address;
+    uint8_t Source[6];      // Bytes the op was decoded from, fused ops read up to 6
+    DecodedOp Op;
+};
+
+// Persists the predecoded engine's tables across runs, so short-lived
+// sessions of the same ROM skip the decode warm-up. Anything that does not
+// match, from the engine version down to single entries whose bytes differ
+// from what is in memory now, is ignored rather than trusted.
+class TranslationCache {
+public:
+    explicit TranslationCache(const std::string &directory = "");
+
+    // Seed the engine of a machine that was just loaded and initialized
+    bool Load(uint64_t hash, CHIP8 &chp);
+    // Write the tables back when they cover more than what was loaded
+    bool Store(uint64_t hash, CHIP8 &chp);
+
+    std::string Directory;
+    std::string Error;
+
+    uint32_t Loaded;        // Entries taken from the last Load
+    uint32_t Dropped;       // Entries of the last Load that were stale
+
+private:
+    std::string Path(uint64_t hash) const;
+
+    uint64_t LoadedHash;
+};
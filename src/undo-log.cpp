@@ -0,0 +1,312 @@
+#include "undo-log.h"
+#include "chip8.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+#define UNDO_CHUNK_SIZE (1024 * 1024)
+
+// Entry layout: kind, 16 bit address, length, then `length` bytes of old state
+enum E_UNDO {
+    UNDO_REGISTERS,     // V[address..]
+    UNDO_INDEX,         // I
+    UNDO_STACK,         // SP, then the stack slot at `address`
+    UNDO_MEMORY,        // memory[address..]
+    UNDO_SCREEN,        // bytes of the Display starting at byte `address`
+    UNDO_SPRITE,        // Dxyn, toggling the same sprite again reverts it
+    UNDO_FLAGS,         // Flags[address..]
+    UNDO_AUDIO          // Pattern, Pitch and PatternLoaded
+};
+
+UndoLog::UndoLog() {
+    Enabled = false;
+    Limit = 64 * 1024 * 1024;
+    ScratchUsed = 0;
+    StepCount = 0;
+    ByteCount = 0;
+}
+
+void UndoLog::Clear() {
+    Chunks.clear();
+    StepCount = 0;
+    ByteCount = 0;
+}
+
+void UndoLog::Put(uint8_t kind, uint16_t address, const uint8_t *data, uint8_t length) {
+    uint8_t *out = &Scratch[ScratchUsed];
+    out[0] = kind;
+    out[1] = address & 0xFF;
+    out[2] = address >> 8;
+    out[3] = length;
+    if (length > 0)
+        memcpy(&out[4], data, length);
+    ScratchUsed += 4 + length;
+}
+
+void UndoLog::PutMemory(const CHIP8 &chp, uint16_t address, uint8_t length) {
+    const uint16_t mask = chp.AddressMask();
+    address &= mask;
+    const uint8_t head = static_cast<uint8_t>(std::min<int>(length, mask + 1 - address));
+    Put(UNDO_MEMORY, address, &chp.memory[address], head);
+    if (head < length)
+        Put(UNDO_MEMORY, 0, chp.memory, length - head);
+}
+
+void UndoLog::PutScreen(const CHIP8 &chp, size_t offset, size_t length) {
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&chp.screen);
+    while (length > 0) {
+        const uint8_t part = static_cast<uint8_t>(std::min<size_t>(length, 255));
+        Put(UNDO_SCREEN, static_cast<uint16_t>(offset), bytes + offset, part);
+        offset += part;
+        length -= part;
+    }
+}
+
+void UndoLog::PutPlanes(const CHIP8 &chp) {
+    // A low resolution plane is 256 bytes, as much as the screen used to be
+    for (int plane = 0; plane < DISPLAY_PLANES; ++plane) {
+        if (chp.screen.Planes & (1 << plane))
+            PutScreen(chp, offsetof(Display, Rows) + sizeof(chp.screen.Rows[0]) * plane,
+                      chp.screen.Size() * sizeof(uint64_t));
+    }
+}
+
+void UndoLog::Record(const CHIP8 &chp) {
+    const uint16_t PC = chp.PC;
+    const uint16_t opcode = (chp.memory[PC & MEMORY_MASK] << 8) | chp.memory[(PC + 1) & MEMORY_MASK];
+    const uint8_t X = (opcode & 0x0F00) >> 8;
+    const uint8_t Y = (opcode & 0x00F0) >> 4;
+
+    // Header: PC, timers and flags are cheap enough to always keep
+    Scratch[0] = PC & 0xFF;
+    Scratch[1] = PC >> 8;
+    Scratch[2] = chp.Delay;
+    Scratch[3] = chp.Sound;
+    Scratch[4] = chp.Blocked ? 0x01 : 0x00;
+    ScratchUsed = 5;
+
+    uint8_t old[16];
+    switch (opcode & 0xF000) {
+    case 0x0000:
+        if ((opcode & 0x00FF) == 0xE0 || (opcode & 0x00FF) == 0xFB || (opcode & 0x00FF) == 0xFC ||
+            (opcode & 0xFFF0) == 0x00C0 || (opcode & 0xFFF0) == 0x00D0) {
+            PutPlanes(chp);
+        }
+        else if ((opcode & 0x00FF) == 0xFE || (opcode & 0x00FF) == 0xFF) {
+            // Switching resolution blanks everything
+            PutScreen(chp, 0, sizeof(Display));
+        }
+        else if ((opcode & 0x00FF) == 0xEE) {
+            old[0] = chp.SP;
+            Put(UNDO_STACK, 0xFFFF, old, 1);
+        }
+        break;
+    case 0x2000:
+        {
+            // The call writes the slot above SP
+            uint8_t slot = (chp.SP + 1) & STACK_MASK;
+            old[0] = chp.SP;
+            old[1] = chp.stack[slot] & 0xFF;
+            old[2] = chp.stack[slot] >> 8;
+            Put(UNDO_STACK, slot, old, 3);
+            break;
+        }
+    case 0x5000:
+        if (chp.Quirks.Platform == PLATFORM_XOCHIP && (opcode & 0x000F) == 0x2) {
+            PutMemory(chp, chp.I, (X <= Y ? Y - X : X - Y) + 1);
+        }
+        else if (chp.Quirks.Platform == PLATFORM_XOCHIP && (opcode & 0x000F) == 0x3) {
+            const uint8_t low = std::min(X, Y), high = std::max(X, Y);
+            Put(UNDO_REGISTERS, low, &chp.V[low], high - low + 1);
+        }
+        break;
+    case 0x6000:
+    case 0x7000:
+    case 0xC000:
+        old[0] = chp.V[X];
+        Put(UNDO_REGISTERS, X, old, 1);
+        break;
+    case 0x8000:
+        old[0] = chp.V[X];
+        Put(UNDO_REGISTERS, X, old, 1);
+        if ((opcode & 0x000F) == 0x0E) {
+            old[0] = chp.V[Y];
+            Put(UNDO_REGISTERS, Y, old, 1);
+        }
+        if ((opcode & 0x000F) >= 0x04) {
+            Put(UNDO_REGISTERS, 0x0F, &chp.V[0xF], 1);
+        }
+        break;
+    case 0xA000:
+        old[0] = chp.I & 0xFF;
+        old[1] = chp.I >> 8;
+        Put(UNDO_INDEX, 0, old, 2);
+        break;
+    case 0xD000:
+        Put(UNDO_REGISTERS, 0x0F, &chp.V[0xF], 1);
+        Put(UNDO_SPRITE, 0, NULL, 0);
+        break;
+    case 0xF000:
+        switch (opcode & 0x00FF) {
+        case 0x01:
+            PutScreen(chp, offsetof(Display, Planes), 1);
+            break;
+        case 0x02:
+        case 0x3A:
+            memcpy(old, chp.Pattern, 16);
+            Put(UNDO_AUDIO, 0, old, 16);
+            old[0] = chp.Pitch;
+            old[1] = chp.PatternLoaded ? 0x01 : 0x00;
+            Put(UNDO_AUDIO, 16, old, 2);
+            break;
+        case 0x07:
+        case 0x0A:
+            old[0] = chp.V[X];
+            Put(UNDO_REGISTERS, X, old, 1);
+            break;
+        case 0x00:
+        case 0x1E:
+        case 0x29:
+        case 0x30:
+            old[0] = chp.I & 0xFF;
+            old[1] = chp.I >> 8;
+            Put(UNDO_INDEX, 0, old, 2);
+            Put(UNDO_REGISTERS, 0x0F, &chp.V[0xF], 1);
+            break;
+        case 0x33:
+            PutMemory(chp, chp.I, 3);
+            break;
+        case 0x55:
+            PutMemory(chp, chp.I, X + 1);
+            break;
+        case 0x65:
+        case 0x85:
+            for (uint8_t i = 0; i <= X; ++i) {
+                old[i] = chp.V[i];
+            }
+            Put(UNDO_REGISTERS, 0, old, X + 1);
+            break;
+        case 0x75:
+            Put(UNDO_FLAGS, 0, chp.Flags, X + 1);
+            break;
+        }
+        if (chp.Quirks.LoadStoreIncrementsI && ((opcode & 0x00FF) == 0x55 || (opcode & 0x00FF) == 0x65)) {
+            old[0] = chp.I & 0xFF;
+            old[1] = chp.I >> 8;
+            Put(UNDO_INDEX, 0, old, 2);
+        }
+        break;
+    }
+
+    // Footer holds the record length so the log can be walked backwards
+    const size_t length = ScratchUsed + 2;
+    Scratch[ScratchUsed++] = length & 0xFF;
+    Scratch[ScratchUsed++] = length >> 8;
+    Commit();
+}
+
+void UndoLog::Commit() {
+    if (Chunks.empty() || Chunks.back().Used + ScratchUsed > UNDO_CHUNK_SIZE) {
+        // Recycle the oldest chunk once over the limit
+        if (!Chunks.empty() && ByteCount + UNDO_CHUNK_SIZE > Limit && Chunks.size() > 1) {
+            Chunk oldest = std::move(Chunks.front());
+            Chunks.pop_front();
+            StepCount -= oldest.Steps;
+            ByteCount -= oldest.Used;
+            oldest.Used = 0;
+            oldest.Steps = 0;
+            Chunks.push_back(std::move(oldest));
+        }
+        else {
+            Chunk chunk;
+            chunk.Data.reset(new uint8_t[UNDO_CHUNK_SIZE]);
+            chunk.Used = 0;
+            chunk.Steps = 0;
+            Chunks.push_back(std::move(chunk));
+        }
+    }
+
+    Chunk &chunk = Chunks.back();
+    memcpy(&chunk.Data[chunk.Used], Scratch, ScratchUsed);
+    chunk.Used += ScratchUsed;
+    chunk.Steps++;
+
+    StepCount++;
+    ByteCount += ScratchUsed;
+}
+
+bool UndoLog::Undo(CHIP8 &chp) {
+    while (!Chunks.empty() && Chunks.back().Used == 0) {
+        Chunks.pop_back();
+    }
+    if (Chunks.empty())
+        return false;
+
+    Chunk &chunk = Chunks.back();
+    size_t length = chunk.Data[chunk.Used - 2] | (chunk.Data[chunk.Used - 1] << 8);
+    const uint8_t *record = &chunk.Data[chunk.Used - length];
+    const uint8_t *end = &chunk.Data[chunk.Used - 2];
+
+    chp.PC = record[0] | (record[1] << 8);
+    chp.Delay = record[2];
+    chp.Sound = record[3];
+    chp.Blocked = (record[4] & 0x01) != 0;
+
+    for (const uint8_t *entry = record + 5; entry < end; entry += 4 + entry[3]) {
+        const uint16_t address = entry[1] | (entry[2] << 8);
+        const uint8_t *data = &entry[4];
+        const uint8_t size = entry[3];
+
+        switch (entry[0]) {
+        case UNDO_REGISTERS:
+            memcpy(&chp.V[address], data, size);
+            break;
+        case UNDO_INDEX:
+            chp.I = data[0] | (data[1] << 8);
+            break;
+        case UNDO_STACK:
+            chp.SP = data[0];
+            if (size == 3)
+                chp.stack[address] = data[1] | (data[2] << 8);
+            break;
+        case UNDO_MEMORY:
+            memcpy(&chp.memory[address], data, size);
+            chp.NotifyWrite(address, size);
+            break;
+        case UNDO_SCREEN:
+            memcpy(reinterpret_cast<uint8_t *>(&chp.screen) + address, data, size);
+            chp.ScreenDirty = true;
+            break;
+        case UNDO_SPRITE:
+            {
+                // Everything else is restored already so I and V match the draw
+                const uint16_t opcode = (chp.memory[chp.PC & MEMORY_MASK] << 8) | chp.memory[(chp.PC + 1) & MEMORY_MASK];
+                const uint8_t X = (opcode & 0x0F00) >> 8;
+                const uint8_t Y = (opcode & 0x00F0) >> 4;
+                const uint8_t N = opcode & 0x000F;
+                const bool wide = N == 0 && chp.Quirks.Platform != PLATFORM_CHIP8;
+                chp.screen.Draw(chp.V[X], chp.V[Y], chp.memory, chp.I, chp.AddressMask(), wide ? 16 : N, wide);
+                chp.ScreenDirty = true;
+                break;
+            }
+        case UNDO_FLAGS:
+            memcpy(&chp.Flags[address], data, size);
+            break;
+        case UNDO_AUDIO:
+            if (address == 0) {
+                memcpy(chp.Pattern, data, size);
+            }
+            else {
+                chp.Pitch = data[0];
+                chp.PatternLoaded = data[1] != 0;
+            }
+            break;
+        }
+    }
+
+    chunk.Used -= length;
+    chunk.Steps--;
+    StepCount--;
+    ByteCount -= length;
+    return true;
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <memory>
+
+class CHIP8;
+
+// Append-only log of the state each executed instruction is about to overwrite.
+// A record is the PC and timers followed by a few small entries, typically
+// around a dozen bytes, so millions of steps fit in tens of MB.
+class UndoLog {
+public:
+    UndoLog();
+
+    // Called by the interpreter before the instruction at PC executes
+    void Record(const CHIP8 &chp);
+    // Restore the state from before the last recorded instruction
+    bool Undo(CHIP8 &chp);
+
+    void Clear();
+
+    size_t Steps() const { return StepCount; }
+    size_t Bytes() const { return ByteCount; }
+
+    bool Enabled;
+    // Oldest chunks are dropped once the log grows past this many bytes
+    size_t Limit;
+
+private:
+    struct Chunk {
+        std::unique_ptr<uint8_t[]> Data;
+        size_t Used;
+        size_t Steps;
+    };
+
+    void Put(uint8_t kind, uint16_t address, const uint8_t *data, uint8_t length);
+    // Splits ranges that wrap past the end of memory
+    void PutMemory(const CHIP8 &chp, uint16_t address, uint8_t length);
+    // Bytes of the Display from `offset`, split into entries
+    void PutScreen(const CHIP8 &chp, size_t offset, size_t length);
+    // Active part of every plane the next clear or scroll touches
+    void PutPlanes(const CHIP8 &chp);
+    void Commit();
+
+    std::deque<Chunk> Chunks;
+
+    // Record being assembled before it is appended, big enough for a whole Display
+    uint8_t Scratch[4096];
+    size_t ScratchUsed;
+
+    size_t StepCount;
+    size_t ByteCount;
+};
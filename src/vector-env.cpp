@@ -0,0 +1,231 @@
+#include "vector-env.h"
+#include "frame-recorder.h"
+#include "program-reader.h"
+#include "rom-database.h"
+#include <cstring>
+
+// Observations stay 64x32, high resolution screens are OR-reduced
+static void PackScreen(const CHIP8 &chp, uint64_t *rows) {
+    PackedFrame frame;
+    frame.Pack(chp.screen);
+    memcpy(rows, frame.Rows, sizeof(frame.Rows));
+}
+
+VectorEnv::VectorEnv() : Ipf(0), Generation(0), Pending(0), Stopping(false) {
+    memset(&Settings, 0, sizeof(Settings));
+}
+
+VectorEnv::~VectorEnv() {
+    Stop();
+}
+
+bool VectorEnv::Create(const std::string &rom, const std::string &database, const EnvSettings &settings) {
+    Stop();
+    Slots.clear();
+    Error.clear();
+
+    if (settings.Count == 0) {
+        Error = "An environment needs at least one VM";
+        return false;
+    }
+    if (settings.RewardSource == ENV_SOURCE_REGISTER && settings.RewardIndex > 0xF) {
+        Error = "Reward register must be 0 to F";
+        return false;
+    }
+    if (settings.DoneSource == ENV_SOURCE_REGISTER && settings.DoneIndex > 0xF) {
+        Error = "Done register must be 0 to F";
+        return false;
+    }
+    Settings = settings;
+    if (Settings.FramesPerAction == 0)
+        Settings.FramesPerAction = 1;
+
+    RomDatabase db;
+    if (!database.empty() && !db.Load(database)) {
+        Error = "Could not read " + database;
+        return false;
+    }
+
+    // Loaded once, every VM forks from this machine's state
+    std::unique_ptr<CHIP8> setup(new CHIP8());
+    setup->History.Enabled = false;
+    ProgramReader pr;
+    setup->ClearMemory();
+    if (!pr.LoadInto(rom, *setup)) {
+        Error = pr.Error;
+        return false;
+    }
+    setup->Init();
+    memset(setup->Keys, 0, sizeof(setup->Keys));
+
+    RomSettings rs;
+    if (!db.Find(pr.Hash, rs))
+        rs = RomDatabase::Defaults();
+    Ipf = Settings.InstructionsPerFrame != 0 ? Settings.InstructionsPerFrame : rs.InstructionsPerFrame;
+    setup->Quirks = rs.Quirks;
+    if (!pr.Fits(rs.Quirks.Platform)) {
+        Error = pr.Error;
+        return false;
+    }
+
+    Slots.reserve(Settings.Count);
+    for (uint32_t i = 0; i < Settings.Count; ++i) {
+        std::unique_ptr<Slot> slot(new Slot());
+        slot->Runner.Machine->Quirks = rs.Quirks;
+        slot->Episode = 0;
+        slot->Frames = 0;
+        Slots.push_back(std::move(slot));
+    }
+    Root = Slots[0]->Runner.Snapshot(*setup);
+    for (uint32_t i = 0; i < Settings.Count; ++i) {
+        ResetSlot(i);
+    }
+
+    // The caller's thread takes the first slice. New workers start from
+    // generation 0, the last batch of a previous Create must not look pending.
+    const uint32_t threads = Settings.Threads < Settings.Count ? Settings.Threads : Settings.Count;
+    Stopping = false;
+    Generation = 0;
+    Pending = 0;
+    Current = Batch();
+    for (uint32_t worker = 1; worker < threads; ++worker) {
+        Workers.emplace_back(&VectorEnv::Work, this, worker);
+    }
+    return true;
+}
+
+void VectorEnv::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(Guard);
+        Stopping = true;
+    }
+    Wake.notify_all();
+    for (auto &worker : Workers) {
+        worker.join();
+    }
+    Workers.clear();
+}
+
+void VectorEnv::ResetSlot(uint32_t index) {
+    Slot &slot = *Slots[index];
+    slot.Runner.Restore(Root);
+    // Distinct and reproducible per VM and episode
+    slot.Runner.Machine->DeferSeed(Settings.Seed + index + slot.Episode * Settings.Count);
+    slot.Frames = 0;
+}
+
+void VectorEnv::Reset(uint64_t *observations) {
+    for (uint32_t i = 0; i < Settings.Count; ++i) {
+        Slots[i]->Episode = 0;
+        ResetSlot(i);
+        if (observations)
+            PackScreen(*Slots[i]->Runner.Machine, observations + i * ENV_OBSERVATION_WORDS);
+    }
+}
+
+uint8_t VectorEnv::Read(const CHIP8 &chp, E_ENV_SOURCE source, uint16_t index) const {
+    switch (source) {
+    case ENV_SOURCE_REGISTER:
+    {
+        const CHIP8_INFO info = chp.GetInfo();
+        return index == 0xF ? info.VF : info.V[index];
+    }
+    case ENV_SOURCE_MEMORY:
+        return chp.memory[index & MEMORY_MASK];
+    default:
+        return 0;
+    }
+}
+
+bool VectorEnv::Halted(const CHIP8 &chp) const {
+    // Programs commonly end on a jump to itself, a wait in Fx0A is not an end
+    const uint16_t pc = chp.GetInfo().PC & MEMORY_MASK;
+    const uint16_t opcode = (chp.memory[pc] << 8) | chp.memory[(pc + 1) & MEMORY_MASK];
+    return opcode == (0x1000 | pc);
+}
+
+void VectorEnv::StepSlot(uint32_t index, const Batch &batch) {
+    Slot &slot = *Slots[index];
+    CHIP8 &chp = *slot.Runner.Machine;
+
+    const uint16_t action = batch.Actions ? batch.Actions[index] : 0;
+    for (int key = 0; key < 16; ++key) {
+        chp.Keys[key] = (action >> key) & 1;
+    }
+
+    const uint8_t before = Read(chp, Settings.RewardSource, Settings.RewardIndex);
+    for (uint32_t frame = 0; frame < Settings.FramesPerAction; ++frame) {
+        ++slot.Frames;
+        chp.Run(Ipf);
+    }
+    const uint8_t after = Read(chp, Settings.RewardSource, Settings.RewardIndex);
+    if (batch.Rewards)
+        batch.Rewards[index] = static_cast<int8_t>(after - before);
+
+    uint8_t flags = 0;
+    if (Halted(chp) ||
+        (Settings.DoneSource != ENV_SOURCE_NONE && Read(chp, Settings.DoneSource, Settings.DoneIndex) == Settings.DoneValue))
+        flags = ENV_TERMINATED;
+    else if (Settings.MaxFrames != 0 && slot.Frames >= Settings.MaxFrames)
+        flags = ENV_TRUNCATED;
+    if (batch.Flags)
+        batch.Flags[index] = flags;
+
+    if (flags != 0) {
+        if (batch.Final)
+            PackScreen(chp, batch.Final + index * ENV_OBSERVATION_WORDS);
+        ++slot.Episode;
+        ResetSlot(index);
+    }
+    if (batch.Observations)
+        PackScreen(chp, batch.Observations + index * ENV_OBSERVATION_WORDS);
+}
+
+void VectorEnv::StepRange(uint32_t worker, const Batch &batch) {
+    const uint32_t parts = static_cast<uint32_t>(Workers.size()) + 1;
+    const uint32_t begin = static_cast<uint32_t>(uint64_t(Settings.Count) * worker / parts);
+    const uint32_t end = static_cast<uint32_t>(uint64_t(Settings.Count) * (worker + 1) / parts);
+    for (uint32_t i = begin; i < end; ++i) {
+        StepSlot(i, batch);
+    }
+}
+
+void VectorEnv::Work(uint32_t worker) {
+    uint64_t seen = 0;
+    for (;;) {
+        Batch batch;
+        {
+            std::unique_lock<std::mutex> lock(Guard);
+            Wake.wait(lock, [&] { return Stopping || Generation != seen; });
+            if (Stopping)
+                return;
+            seen = Generation;
+            batch = Current;
+        }
+        StepRange(worker, batch);
+
+        std::lock_guard<std::mutex> lock(Guard);
+        if (--Pending == 0)
+            Finished.notify_one();
+    }
+}
+
+void VectorEnv::Step(const uint16_t *actions, uint64_t *observations, float *rewards, uint8_t *flags, uint64_t *final) {
+    const Batch batch = { actions, observations, rewards, flags, final };
+    if (Workers.empty()) {
+        StepRange(0, batch);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(Guard);
+        Current = batch;
+        Pending = static_cast<uint32_t>(Workers.size());
+        ++Generation;
+    }
+    Wake.notify_all();
+    StepRange(0, batch);
+
+    std::unique_lock<std::mutex> lock(Guard);
+    Finished.wait(lock, [&] { return Pending == 0; });
+}
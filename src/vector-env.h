@@ -0,0 +1,103 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "vm-state.h"
+
+// Where rewards and episode ends are read from
+enum E_ENV_SOURCE {
+    ENV_SOURCE_NONE,
+    ENV_SOURCE_REGISTER,    // Index is a V register
+    ENV_SOURCE_MEMORY       // Index is a memory address
+};
+
+// Flags written per VM by Step
+#define ENV_TERMINATED 0x01     // The program halted or hit the done condition
+#define ENV_TRUNCATED 0x02      // The episode ran out of frames
+
+// One packed 64x32 frame, bit x of word y is pixel (x, y)
+#define ENV_OBSERVATION_WORDS SCREEN_HEIGHT
+
+struct EnvSettings {
+    uint32_t Count;
+    uint32_t FramesPerAction;       // Frames run with the keys of one action held
+    uint32_t InstructionsPerFrame;  // 0 picks the database or default value
+    uint32_t MaxFrames;             // Episode length before truncation, 0 for none
+    uint32_t Seed;                  // VM i starts from Seed + i, episodes draw new seeds
+    uint32_t Threads;               // 0 or 1 steps everything on the caller's thread
+
+    E_ENV_SOURCE RewardSource;      // Reward is the signed change of this byte
+    uint16_t RewardIndex;
+    E_ENV_SOURCE DoneSource;        // Episode ends when this byte equals DoneValue
+    uint16_t DoneIndex;
+    uint8_t DoneValue;
+};
+
+// Steps a batch of VMs of one ROM for reinforcement learning. Actions are
+// key masks, bit k holds key k for every frame of the step. Observations,
+// rewards and flags go straight into caller buffers; nothing is allocated
+// after Create. A VM whose episode ends is reset in the same step, the
+// observation written is the first of its new episode.
+//
+// Every VM forks from one root VMState, a reset only copies back the memory
+// pages its episode wrote.
+class VectorEnv {
+public:
+    VectorEnv();
+    ~VectorEnv();
+
+    bool Create(const std::string &rom, const std::string &database, const EnvSettings &settings);
+
+    // observations holds Count x ENV_OBSERVATION_WORDS words
+    void Reset(uint64_t *observations);
+    // final, when given, receives the last frame of every VM that was reset
+    void Step(const uint16_t *actions, uint64_t *observations, float *rewards, uint8_t *flags, uint64_t *final);
+
+    uint32_t Count() const { return Settings.Count; }
+    uint32_t InstructionsPerFrame() const { return Ipf; }
+
+    std::string Error;
+
+private:
+    struct Slot {
+        VMRunner Runner;
+        uint32_t Frames;        // Into the current episode
+        uint32_t Episode;
+    };
+
+    struct Batch {
+        const uint16_t *Actions;
+        uint64_t *Observations;
+        float *Rewards;
+        uint8_t *Flags;
+        uint64_t *Final;
+    };
+
+    void ResetSlot(uint32_t index);
+    void StepSlot(uint32_t index, const Batch &batch);
+    void StepRange(uint32_t worker, const Batch &batch);
+    uint8_t Read(const CHIP8 &chp, E_ENV_SOURCE source, uint16_t index) const;
+    bool Halted(const CHIP8 &chp) const;
+    void Work(uint32_t worker);
+    void Stop();
+
+    EnvSettings Settings;
+    uint32_t Ipf;
+    VMState Root;
+    std::vector<std::unique_ptr<Slot>> Slots;
+
+    // Persistent workers, each takes a fixed slice of the batch
+    std::vector<std::thread> Workers;
+    std::mutex Guard;
+    std::condition_variable Wake;
+    std::condition_variable Finished;
+    Batch Current;
+    uint64_t Generation;
+    uint32_t Pending;
+    bool Stopping;
+};
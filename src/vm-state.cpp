@@ -0,0 +1,150 @@
+#include "vm-state.h"
+#include <cstring>
+
+static_assert(PAGE_COUNT <= 16, "DirtyPages has one bit per page");
+
+static void CopyXO(VMState &state, const CHIP8 &chp) {
+    memcpy(state.Flags, chp.Flags, sizeof(state.Flags));
+    memcpy(state.Pattern, chp.Pattern, sizeof(state.Pattern));
+    state.Pitch = chp.Pitch;
+    state.PatternLoaded = chp.PatternLoaded;
+}
+
+int VMState::SharedPages(const VMState &other) const {
+    int shared = Screen == other.Screen ? 1 : 0;
+    for (int page = 0; page < PAGE_COUNT; ++page) {
+        shared += Pages[page] == other.Pages[page] ? 1 : 0;
+    }
+    return shared;
+}
+
+VMRunner::VMRunner() : Machine(new CHIP8()) {
+    Machine->History.Enabled = false;
+}
+
+VMState VMRunner::Snapshot(const CHIP8 &chp) {
+    VMState state;
+    memcpy(state.V, chp.V, sizeof(state.V));
+    state.I = chp.I;
+    state.PC = chp.PC;
+    state.SP = chp.SP;
+    memcpy(state.Stack, chp.stack, sizeof(state.Stack));
+    state.Delay = chp.Delay;
+    state.Sound = chp.Sound;
+    state.Blocked = chp.Blocked;
+    memcpy(state.Keys, chp.Keys, sizeof(state.Keys));
+
+    // Draw the seed from a copy, taking a snapshot must not disturb the machine
+    std::mt19937 rng = chp.mt;
+    state.Rng = chp.SeedPending ? chp.PendingSeed : static_cast<uint32_t>(rng());
+
+    for (int page = 0; page < PAGE_COUNT; ++page) {
+        auto copy = std::make_shared<MemoryPage>();
+        memcpy(copy->Bytes, &chp.memory[page * PAGE_SIZE], PAGE_SIZE);
+        state.Pages[page] = copy;
+    }
+    auto screen = std::make_shared<ScreenBuffer>();
+    screen->Pixels = chp.screen;
+    state.Screen = screen;
+
+    // Plain CHIP-8 and SUPER-CHIP programs never get to share anything up there
+    if (chp.Quirks.Platform == PLATFORM_XOCHIP) {
+        auto extended = std::make_shared<ExtendedMemory>();
+        memcpy(extended->Bytes, &chp.memory[MEMORY_SIZE], sizeof(extended->Bytes));
+        state.Extended = extended;
+    }
+    CopyXO(state, chp);
+
+    Machine->Quirks = chp.Quirks;
+    return state;
+}
+
+void VMRunner::Restore(const VMState &state) {
+    CHIP8 &chp = *Machine;
+
+    for (int page = 0; page < PAGE_COUNT; ++page) {
+        if (Loaded[page] == state.Pages[page] && !(chp.DirtyPages & (1 << page)))
+            continue;
+        memcpy(&chp.memory[page * PAGE_SIZE], state.Pages[page]->Bytes, PAGE_SIZE);
+        // Lets the engines drop anything they decoded from the old page
+        chp.NotifyWrite(page * PAGE_SIZE, PAGE_SIZE);
+        Loaded[page] = state.Pages[page];
+    }
+    if (LoadedScreen != state.Screen || chp.ScreenDirty) {
+        chp.screen = state.Screen->Pixels;
+        LoadedScreen = state.Screen;
+    }
+    if (LoadedExtended != state.Extended || chp.ExtendedDirty) {
+        if (state.Extended)
+            memcpy(&chp.memory[MEMORY_SIZE], state.Extended->Bytes, sizeof(state.Extended->Bytes));
+        else
+            memset(&chp.memory[MEMORY_SIZE], 0x00, XO_MEMORY_SIZE - MEMORY_SIZE);
+        LoadedExtended = state.Extended;
+    }
+
+    memcpy(chp.V, state.V, sizeof(chp.V));
+    chp.I = state.I;
+    chp.PC = state.PC;
+    chp.SP = state.SP;
+    memcpy(chp.stack, state.Stack, sizeof(chp.stack));
+    chp.Delay = state.Delay;
+    chp.Sound = state.Sound;
+    chp.Blocked = state.Blocked;
+    memcpy(chp.Keys, state.Keys, sizeof(chp.Keys));
+    chp.DeferSeed(state.Rng);
+    memcpy(chp.Flags, state.Flags, sizeof(chp.Flags));
+    memcpy(chp.Pattern, state.Pattern, sizeof(chp.Pattern));
+    chp.Pitch = state.Pitch;
+    chp.PatternLoaded = state.PatternLoaded;
+
+    chp.DirtyPages = 0;
+    chp.ExtendedDirty = false;
+    chp.ScreenDirty = false;
+}
+
+void VMRunner::Capture(VMState &state) {
+    CHIP8 &chp = *Machine;
+
+    // Copy on write, everything the run did not touch stays shared
+    for (int page = 0; page < PAGE_COUNT; ++page) {
+        if (!(chp.DirtyPages & (1 << page)))
+            continue;
+        auto copy = std::make_shared<MemoryPage>();
+        memcpy(copy->Bytes, &chp.memory[page * PAGE_SIZE], PAGE_SIZE);
+        state.Pages[page] = copy;
+        Loaded[page] = copy;
+    }
+    if (chp.ScreenDirty) {
+        auto screen = std::make_shared<ScreenBuffer>();
+        screen->Pixels = chp.screen;
+        state.Screen = screen;
+        LoadedScreen = screen;
+    }
+    if (chp.ExtendedDirty) {
+        auto extended = std::make_shared<ExtendedMemory>();
+        memcpy(extended->Bytes, &chp.memory[MEMORY_SIZE], sizeof(extended->Bytes));
+        state.Extended = extended;
+        LoadedExtended = extended;
+    }
+    chp.DirtyPages = 0;
+    chp.ExtendedDirty = false;
+    chp.ScreenDirty = false;
+
+    memcpy(state.V, chp.V, sizeof(state.V));
+    state.I = chp.I;
+    state.PC = chp.PC;
+    state.SP = chp.SP;
+    memcpy(state.Stack, chp.stack, sizeof(state.Stack));
+    state.Delay = chp.Delay;
+    state.Sound = chp.Sound;
+    state.Blocked = chp.Blocked;
+    state.Rng = chp.SeedPending ? chp.PendingSeed : static_cast<uint32_t>(chp.mt());
+    CopyXO(state, chp);
+}
+
+uint32_t VMRunner::Run(VMState &state, uint32_t count) {
+    Restore(state);
+    const uint32_t executed = Machine->Run(count);
+    Capture(state);
+    return executed;
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+
+#include "chip8.h"
+
+struct MemoryPage {
+    uint8_t Bytes[PAGE_SIZE];
+};
+
+struct ScreenBuffer {
+    Display Pixels;
+};
+
+// XO-CHIP memory above MEMORY_SIZE, only reachable through I
+struct ExtendedMemory {
+    uint8_t Bytes[XO_MEMORY_SIZE - MEMORY_SIZE];
+};
+
+// Complete machine state that forks in constant time. Memory is split into
+// PAGE_SIZE pages and the screen is one more page, all shared between forks
+// and refcounted; a page is copied only when the state that runs writes it.
+// XO-CHIP memory past MEMORY_SIZE is one more shared block, NULL until a
+// program first writes there.
+// Registers, stack and keys are a few hundred bytes of plain copy.
+//
+// The RNG is kept as a 32 bit seed rather than the full mt19937 state. A
+// state that draws random numbers hands its children a fresh seed, so every
+// future is reproducible from its own state alone.
+class VMState {
+public:
+    VMState Fork() const { return *this; }
+
+    uint8_t Peek(uint16_t address) const { return Pages[(address & MEMORY_MASK) / PAGE_SIZE]->Bytes[address % PAGE_SIZE]; }
+    bool Pixel(int x, int y, int plane = 0) const { return Screen->Pixels.Pixel(x, y, plane); }
+    // Pages still shared with `other`, mostly for diagnostics
+    int SharedPages(const VMState &other) const;
+
+    uint8_t V[16];
+    uint16_t I;
+    uint16_t PC;
+    uint8_t SP;
+    uint16_t Stack[STACK_SIZE];
+    uint8_t Delay;
+    uint8_t Sound;
+    bool Blocked;
+    uint32_t Rng;
+
+    uint8_t Flags[16];
+    uint8_t Pattern[16];
+    uint8_t Pitch;
+    bool PatternLoaded;
+
+    // Inputs for the next Run, set freely on each fork
+    bool Keys[16];
+
+    std::shared_ptr<const MemoryPage> Pages[PAGE_COUNT];
+    std::shared_ptr<const ScreenBuffer> Screen;
+    std::shared_ptr<const ExtendedMemory> Extended;
+};
+
+// Runs VMStates on a private machine. Only pages that differ from what the
+// machine already holds are copied in, and only pages the program wrote are
+// copied out, so stepping many forks of one parent stays cheap.
+class VMRunner {
+public:
+    VMRunner();
+
+    // Root state from a machine set up the usual way, loaded and initialized
+    VMState Snapshot(const CHIP8 &chp);
+
+    // Advance `state` by up to `count` instructions, returns how many ran
+    uint32_t Run(VMState &state, uint32_t count);
+
+    // Put `state` on Machine to be driven directly, pages the machine wrote
+    // since are copied back on the next Restore
+    void Restore(const VMState &state);
+
+    // The machine states run on, set Quirks and the engine here
+    std::unique_ptr<CHIP8> Machine;
+
+private:
+    void Capture(VMState &state);
+
+    std::shared_ptr<const MemoryPage> Loaded[PAGE_COUNT];
+    std::shared_ptr<const ScreenBuffer> LoadedScreen;
+    std::shared_ptr<const ExtendedMemory> LoadedExtended;
+};
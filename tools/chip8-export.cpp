@@ -0,0 +1,28 @@
+#include "frame-recorder.h"
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+// Converts a recorded .c8v stream for review:
+//   chip8-export <in.c8v> <out.gif|out.y4m> [scale] [filter]
+// Filters are nearest, scale2x (epx), scale3x and phosphor.
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        std::cout << "Usage: " << argv[0] << " <in.c8v> <out.gif|out.y4m> [scale] [filter]" << std::endl;
+        return 1;
+    }
+
+    const std::string output = argv[2];
+    int scale = argc > 3 ? atoi(argv[3]) : 4;
+    if (scale < 1)
+        scale = 1;
+    E_SCALER filter = SCALER_NEAREST;
+    if (argc > 4 && !ParseScaler(argv[4], filter)) {
+        std::cout << "Unknown filter " << argv[4] << ", use nearest, scale2x, epx, scale3x or phosphor" << std::endl;
+        return 1;
+    }
+
+    const bool gif = output.size() >= 4 && output.compare(output.size() - 4, 4, ".gif") == 0;
+    const bool ok = gif ? ExportGIF(argv[1], output, scale, filter) : ExportY4M(argv[1], output, scale, filter);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,428 @@
+#include "chip8.h"
+#include "hazard.h"
+#include "input-replay.h"
+#include "program-analysis.h"
+#include "program-reader.h"
+#include <algorithm>
+#include <atomic>
+#include <bitset>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <experimental/filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <set>
+#include <thread>
+#include <vector>
+
+namespace fs = std::experimental::filesystem;
+
+// Coverage guided fuzzer for ROMs and key input:
+//   chip8-fuzz [--jobs N] [--seconds S] [--frames N] [--ipf N] [--seeds DIR] [--out DIR]
+//   chip8-fuzz --replay <rom> [--keys file]
+// Every instruction is checked with PredictHazard before it runs, so a case
+// ends at the first access that only stays in range through masking.
+// Each new kind of hazard is minimized and written to the output directory
+// as a ROM and a key replay, reproducible with --replay.
+#define FUZZ_SEED 0x43485038
+#define FUZZ_MAP_SIZE 65536
+#define FUZZ_MAX_ROM (MEMORY_SIZE - PROGRAM_START)
+
+struct FuzzCase {
+    std::vector<uint8_t> Rom;
+    std::vector<InputEvent> Keys;
+};
+
+struct FuzzResult {
+    E_HAZARD Hazard;
+    uint16_t PC;
+    uint16_t Opcode;
+    uint32_t Instructions;
+};
+
+struct FuzzOptions {
+    unsigned int Jobs;
+    double Seconds;
+    uint32_t Frames;
+    uint32_t InstructionsPerFrame;
+    std::string Output;
+};
+
+typedef std::bitset<FUZZ_MAP_SIZE> Coverage;
+
+// Shared between the workers, everything behind Guard
+struct FuzzState {
+    std::mutex Guard;
+    std::vector<FuzzCase> Corpus;
+    Coverage Seen;
+    std::set<uint32_t> Findings;
+
+    std::atomic<uint64_t> Executions;
+    std::atomic<bool> Running;
+};
+
+static FuzzResult Execute(CHIP8 &chp, const FuzzCase &fuzz, const FuzzOptions &options, Coverage *coverage) {
+    chp.ClearMemory();
+    memcpy(&chp.memory[PROGRAM_START], fuzz.Rom.data(), fuzz.Rom.size());
+    chp.Init();
+    chp.Seed(FUZZ_SEED);
+    memset(chp.Keys, 0, sizeof(chp.Keys));
+
+    InputReplay replay;
+    replay.Events = fuzz.Keys;
+
+    FuzzResult result = { HAZARD_NONE, 0, 0, 0 };
+    uint16_t previous = PROGRAM_START;
+    std::string text;
+    for (uint32_t frame = 0; frame < options.Frames; ++frame) {
+        replay.Apply(frame, chp);
+        for (uint32_t i = 0; i < options.InstructionsPerFrame; ++i) {
+            const E_HAZARD hazard = PredictHazard(chp);
+            const CHIP8_INFO info = chp.GetInfo();
+            const uint16_t opcode = info.PC + 1 < MEMORY_SIZE ? (chp.memory[info.PC] << 8) | chp.memory[info.PC + 1] : 0;
+
+            // Opcodes the core rejects end the run quietly
+            if (hazard != HAZARD_FETCH && !Disassemble(opcode, text, chp.Quirks))
+                return result;
+
+            if (hazard != HAZARD_NONE) {
+                result.Hazard = hazard;
+                result.PC = info.PC;
+                result.Opcode = opcode;
+                return result;
+            }
+
+            if (coverage) {
+                // Control flow edges, plus stack depth and the page I points
+                // into so mutations get rewarded for creeping towards a limit
+                coverage->set(((previous << 5) ^ info.PC ^ (opcode & 0xF00F)) % FUZZ_MAP_SIZE);
+                coverage->set(0xF000 | (info.SP & 0x1F) << 4 | info.I >> 8);
+                previous = info.PC;
+            }
+
+            ++result.Instructions;
+            if (!chp.Cycle())
+                return result;
+        }
+    }
+    return result;
+}
+
+// Groups findings by hazard and instruction, not by address
+static uint32_t FindingKey(const FuzzResult &result) {
+    uint16_t group = result.Opcode & 0xF000;
+    switch (group) {
+    case 0x0000:
+    case 0xE000:
+    case 0xF000:
+        group |= result.Opcode & 0x00FF;
+        break;
+    case 0x8000:
+        group |= result.Opcode & 0x000F;
+        break;
+    }
+    return static_cast<uint32_t>(result.Hazard) << 16 | group;
+}
+
+static const uint16_t InterestingOpcodes[] = {
+    0x2000, 0x00EE, 0xA000, 0xD000, 0xF055, 0xF065, 0xF033, 0xF01E, 0xF029, 0xB000, 0x1000, 0xE09E, 0xE0A1, 0x8000
+};
+
+static const uint8_t InterestingValues[] = { 0x00, 0x01, 0x0F, 0x10, 0x1F, 0x20, 0x3F, 0x40, 0x7F, 0x80, 0xFE, 0xFF };
+
+static void Mutate(FuzzCase &fuzz, const FuzzCase &other, std::mt19937 &rng) {
+    auto random = [&](uint32_t limit) { return limit ? static_cast<uint32_t>(rng() % limit) : 0; };
+
+    const uint32_t count = 1 + random(4);
+    for (uint32_t i = 0; i < count; ++i) {
+        std::vector<uint8_t> &rom = fuzz.Rom;
+        const uint32_t at = random(static_cast<uint32_t>(rom.size()));
+        switch (random(8)) {
+        case 0:
+            if (!rom.empty())
+                rom[at] ^= 1 << random(8);
+            break;
+        case 1:
+            if (!rom.empty())
+                rom[at] = static_cast<uint8_t>(rng());
+            break;
+        case 2:
+            if (rom.size() >= 2) {
+                // Drop a likely hazardous instruction onto an even address
+                const uint16_t opcode = InterestingOpcodes[random(sizeof(InterestingOpcodes) / sizeof(InterestingOpcodes[0]))];
+                const uint16_t operand = static_cast<uint16_t>(rng()) & (opcode & 0x00FF ? 0x0F00 : 0x0FFF);
+                const uint32_t even = at & ~1u;
+                if (even + 1 < rom.size()) {
+                    rom[even] = (opcode | operand) >> 8;
+                    rom[even + 1] = (opcode | operand) & 0xFF;
+                }
+            }
+            break;
+        case 3:
+            if (!rom.empty())
+                rom[at] = InterestingValues[random(sizeof(InterestingValues))];
+            break;
+        case 4:
+            if (rom.size() + 2 <= FUZZ_MAX_ROM) {
+                rom.insert(rom.begin() + (at & ~1u), 2, 0);
+                rom[at & ~1u] = static_cast<uint8_t>(rng());
+                rom[(at & ~1u) + 1] = static_cast<uint8_t>(rng());
+            }
+            break;
+        case 5:
+            if (rom.size() > 2)
+                rom.erase(rom.begin() + (at & ~1u), rom.begin() + std::min<size_t>((at & ~1u) + 2, rom.size()));
+            break;
+        case 6:
+            if (!other.Rom.empty()) {
+                // Splice the tail of another corpus entry in
+                const uint32_t from = random(static_cast<uint32_t>(other.Rom.size()));
+                rom.resize(at);
+                rom.insert(rom.end(), other.Rom.begin() + from, other.Rom.end());
+                if (rom.size() > FUZZ_MAX_ROM)
+                    rom.resize(FUZZ_MAX_ROM);
+            }
+            break;
+        default:
+            {
+                std::vector<InputEvent> &keys = fuzz.Keys;
+                if (!keys.empty() && random(2)) {
+                    keys.erase(keys.begin() + random(static_cast<uint32_t>(keys.size())));
+                }
+                else {
+                    InputEvent event;
+                    event.Frame = random(64);
+                    event.Key = random(16);
+                    event.Pressed = random(2) != 0;
+                    auto it = std::upper_bound(keys.begin(), keys.end(), event, [](const InputEvent &a, const InputEvent &b) {
+                        return a.Frame < b.Frame;
+                    });
+                    keys.insert(it, event);
+                }
+                break;
+            }
+        }
+    }
+}
+
+static void Minimize(CHIP8 &chp, FuzzCase &fuzz, FuzzResult &result, const FuzzOptions &options) {
+    auto reproduces = [&](const FuzzCase &candidate) {
+        FuzzResult again = Execute(chp, candidate, options, NULL);
+        if (again.Hazard == HAZARD_NONE || FindingKey(again) != FindingKey(result))
+            return false;
+        result = again;
+        return true;
+    };
+
+    for (size_t i = fuzz.Keys.size(); i-- > 0;) {
+        FuzzCase candidate = fuzz;
+        candidate.Keys.erase(candidate.Keys.begin() + i);
+        if (reproduces(candidate))
+            fuzz = candidate;
+    }
+
+    for (size_t chunk = fuzz.Rom.size() / 2; chunk > 0;) {
+        FuzzCase candidate = fuzz;
+        candidate.Rom.resize(fuzz.Rom.size() - chunk);
+        if (reproduces(candidate))
+            fuzz = candidate;
+        else
+            chunk /= 2;
+        chunk = std::min(chunk, fuzz.Rom.size() / 2);
+    }
+
+    for (size_t i = 0; i < fuzz.Rom.size(); ++i) {
+        if (fuzz.Rom[i] == 0)
+            continue;
+        FuzzCase candidate = fuzz;
+        candidate.Rom[i] = 0;
+        if (reproduces(candidate))
+            fuzz = candidate;
+    }
+}
+
+static void Save(const FuzzCase &fuzz, const FuzzResult &result, const CHIP8_QUIRKS &quirks, const FuzzOptions &options) {
+    char name[64];
+    snprintf(name, sizeof(name), "%s-%03x-%04x", HazardName(result.Hazard), result.PC, result.Opcode);
+    const std::string base = options.Output + "/" + name;
+
+    std::ofstream rom((base + ".ch8").c_str(), std::ios::binary | std::ios::trunc);
+    rom.write(reinterpret_cast<const char *>(fuzz.Rom.data()), fuzz.Rom.size());
+
+    std::ofstream keys((base + ".keys").c_str(), std::ios::trunc);
+    for (const auto &event : fuzz.Keys) {
+        keys << event.Frame << ' ' << std::hex << static_cast<int>(event.Key) << std::dec << ' ' << event.Pressed << '\n';
+    }
+
+    std::string text;
+    Disassemble(result.Opcode, text, quirks);
+    std::ofstream log((options.Output + "/findings.txt").c_str(), std::ios::app);
+    log << name << ".ch8 " << HazardName(result.Hazard) << " at instruction " << result.Instructions
+        << ": " << text << '\n';
+
+    printf("Found %s hazard at %03x: %s (%zu bytes, %zu key events)\n", HazardName(result.Hazard), result.PC,
+           text.c_str(), fuzz.Rom.size(), fuzz.Keys.size());
+}
+
+static void Work(FuzzState &state, const FuzzOptions &options, unsigned int index) {
+    std::unique_ptr<CHIP8> chp(new CHIP8());
+    chp->History.Enabled = false;
+    chp->UsePredecoded = false;
+
+    std::mt19937 rng(FUZZ_SEED ^ (index * 0x9E3779B9u) ^ static_cast<uint32_t>(std::chrono::steady_clock::now().time_since_epoch().count()));
+    Coverage coverage;
+
+    while (state.Running) {
+        FuzzCase fuzz, other;
+        {
+            std::lock_guard<std::mutex> guard(state.Guard);
+            fuzz = state.Corpus[rng() % state.Corpus.size()];
+            other = state.Corpus[rng() % state.Corpus.size()];
+        }
+        Mutate(fuzz, other, rng);
+
+        coverage.reset();
+        FuzzResult result = Execute(*chp, fuzz, options, &coverage);
+        ++state.Executions;
+
+        bool fresh = false;
+        {
+            std::lock_guard<std::mutex> guard(state.Guard);
+            if ((coverage & ~state.Seen).any()) {
+                state.Seen |= coverage;
+                state.Corpus.push_back(fuzz);
+            }
+            if (result.Hazard != HAZARD_NONE)
+                fresh = state.Findings.insert(FindingKey(result)).second;
+        }
+
+        if (fresh) {
+            Minimize(*chp, fuzz, result, options);
+            Save(fuzz, result, chp->Quirks, options);
+        }
+    }
+}
+
+static bool LoadCase(const std::string &rom, const std::string &keys, FuzzCase &fuzz) {
+    ProgramReader pr;
+    if (!pr.Load(rom))
+        return false;
+    fuzz.Rom = pr.Program;
+
+    InputReplay replay;
+    if (!keys.empty())
+        replay.Load(keys);
+    fuzz.Keys = replay.Events;
+    return true;
+}
+
+int main(int argc, char **argv) {
+    FuzzOptions options;
+    options.Jobs = std::thread::hardware_concurrency();
+    options.Seconds = 60.0;
+    options.Frames = 60;
+    options.InstructionsPerFrame = 10;
+    options.Output = "findings";
+
+    std::string seeds, replay, keys;
+    for (int i = 1; i < argc; ++i) {
+        const bool hasValue = i + 1 < argc;
+        if (!strcmp(argv[i], "--jobs") && hasValue)
+            options.Jobs = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--seconds") && hasValue)
+            options.Seconds = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--frames") && hasValue)
+            options.Frames = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--ipf") && hasValue)
+            options.InstructionsPerFrame = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--seeds") && hasValue)
+            seeds = argv[++i];
+        else if (!strcmp(argv[i], "--out") && hasValue)
+            options.Output = argv[++i];
+        else if (!strcmp(argv[i], "--replay") && hasValue)
+            replay = argv[++i];
+        else if (!strcmp(argv[i], "--keys") && hasValue)
+            keys = argv[++i];
+        else {
+            std::cout << "Usage: " << argv[0] << " [--jobs N] [--seconds S] [--frames N] [--ipf N] [--seeds DIR] [--out DIR] | --replay <rom> [--keys file]" << std::endl;
+            return 1;
+        }
+    }
+    if (options.Jobs == 0)
+        options.Jobs = 1;
+
+    if (!replay.empty()) {
+        FuzzCase fuzz;
+        if (!LoadCase(replay, keys, fuzz))
+            return 1;
+        std::unique_ptr<CHIP8> chp(new CHIP8());
+        chp->History.Enabled = false;
+        FuzzResult result = Execute(*chp, fuzz, options, NULL);
+        if (result.Hazard == HAZARD_NONE) {
+            printf("No hazard after %u instructions\n", result.Instructions);
+            return 0;
+        }
+        std::string text;
+        Disassemble(result.Opcode, text, chp->Quirks);
+        printf("%s hazard at %03x after %u instructions: %04x %s\n", HazardName(result.Hazard), result.PC,
+               result.Instructions, result.Opcode, text.c_str());
+        return 1;
+    }
+
+    FuzzState state;
+    state.Executions = 0;
+    state.Running = true;
+
+    std::error_code error;
+    if (!seeds.empty()) {
+        for (fs::recursive_directory_iterator it(seeds, error), end; !error && it != end; it.increment(error)) {
+            FuzzCase fuzz;
+            if (fs::is_regular_file(it->status()) && it->path().extension() != ".keys" &&
+                LoadCase(it->path().string(), "", fuzz))
+                state.Corpus.push_back(fuzz);
+        }
+    }
+    if (state.Corpus.empty()) {
+        // Draw a sprite, step the position, loop
+        FuzzCase fuzz;
+        fuzz.Rom = { 0x60, 0x00, 0x61, 0x00, 0xA2, 0x0C, 0xD0, 0x15, 0x70, 0x08, 0x12, 0x04, 0xF0, 0x90, 0x90, 0x90, 0xF0 };
+        state.Corpus.push_back(fuzz);
+    }
+    fs::create_directories(options.Output, error);
+
+    std::vector<std::thread> workers;
+    for (unsigned int i = 0; i < options.Jobs; ++i) {
+        workers.emplace_back(Work, std::ref(state), std::cref(options), i);
+    }
+
+    auto started = std::chrono::steady_clock::now();
+    while (true) {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - started;
+
+        size_t corpus, covered, findings;
+        {
+            std::lock_guard<std::mutex> guard(state.Guard);
+            corpus = state.Corpus.size();
+            covered = state.Seen.count();
+            findings = state.Findings.size();
+        }
+        printf("%6.0fs  %llu execs (%.0f/s)  corpus %zu  coverage %zu  findings %zu\n", elapsed.count(),
+               static_cast<unsigned long long>(state.Executions.load()), state.Executions / elapsed.count(),
+               corpus, covered, findings);
+
+        if (options.Seconds > 0 && elapsed.count() >= options.Seconds)
+            break;
+    }
+
+    state.Running = false;
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    return 0;
+}
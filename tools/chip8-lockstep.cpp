@@ -0,0 +1,374 @@
+#include "chip8.h"
+#include "input-replay.h"
+#include "program-analysis.h"
+#include "program-reader.h"
+#include "rom-archive.h"
+#include "rom-database.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <experimental/filesystem>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace fs = std::experimental::filesystem;
+
+// Runs ROMs on two execution engines side by side and stops at the first
+// dispatch after which their machine state differs:
+//   chip8-lockstep [--engines a,b] [--compiled lib] [--frames N] [--seed N] [--keys file] [--db file] <rom | directory | --archive file>
+// The faster engine picks how many instructions it runs per step, fused ops
+// included, and the other one is advanced by the same count. State is
+// compared after every step so a divergence is pinned to at most one
+// superinstruction. On a divergence the ROM runs again up to that step,
+// with history on, to list the instructions each engine went through. The
+// compiled engine runs the chip8-translate output loaded with --compiled,
+// ROMs it was not built from run interpreted.
+#define LOCKSTEP_SEED 0x43485038
+#define LOCKSTEP_STEP 3     // Longest superinstruction
+
+struct EngineSpec {
+    const char *Name;
+    bool Predecoded;
+    bool Fusion;
+    bool Compiled;
+};
+
+static const EngineSpec Engines[] = {
+    { "cycle", false, false, false },
+    { "predecoded", true, true, false },
+    { "nofusion", true, false, false },
+    { "compiled", false, false, true },
+};
+
+struct LockstepOptions {
+    const EngineSpec *Reference;
+    const EngineSpec *Candidate;
+    uint32_t Frames;
+    uint32_t Seed;
+    std::string Keys;
+    RomDatabase Database;
+    CompiledEngine Compiled;
+};
+
+static const EngineSpec *FindEngine(const std::string &name) {
+    for (const auto &engine : Engines) {
+        if (name == engine.Name)
+            return &engine;
+    }
+    return NULL;
+}
+
+static void Configure(CHIP8 &chp, const EngineSpec &engine, const LockstepOptions &options) {
+    chp.Compiled = engine.Compiled ? options.Compiled : CompiledEngine();
+    chp.UsePredecoded = engine.Predecoded;
+    chp.Engine.Fusion = engine.Fusion;
+    chp.Engine.Invalidate();
+    chp.History.Enabled = false;
+    chp.Debug.ClearAll();
+}
+
+// Opcode is left out, engines only promise to keep it meaningful per batch
+static bool Compare(const CHIP8 &a, const CHIP8 &b, bool print) {
+    const CHIP8_INFO x = a.GetInfo(), y = b.GetInfo();
+    bool same = true;
+
+    auto report = [&](const char *name, int index, unsigned int left, unsigned int right) {
+        if (left == right)
+            return;
+        same = false;
+        if (print) {
+            char label[16];
+            snprintf(label, sizeof(label), name, index);
+            printf("  %-8s %04x %04x\n", label, left, right);
+        }
+    };
+
+    for (int i = 0; i < 15; ++i) {
+        report("V%X", i, x.V[i], y.V[i]);
+    }
+    report("VF", 0, x.VF, y.VF);
+    report("I", 0, x.I, y.I);
+    report("PC", 0, x.PC, y.PC);
+    report("SP", 0, x.SP, y.SP);
+    for (int i = 0; i < STACK_SIZE; ++i) {
+        report("stack[%d]", i, x.Stack[i], y.Stack[i]);
+    }
+    report("Delay", 0, a.Delay, b.Delay);
+    report("Sound", 0, a.Sound, b.Sound);
+    report("Blocked", 0, a.Blocked, b.Blocked);
+    for (int i = 0; i < 16; ++i) {
+        report("flag[%d]", i, a.Flags[i], b.Flags[i]);
+    }
+    report("Pitch", 0, a.Pitch, b.Pitch);
+
+    if (memcmp(a.memory, b.memory, sizeof(a.memory)) != 0) {
+        same = false;
+        for (int i = 0, shown = 0; print && i < XO_MEMORY_SIZE && shown < 16; ++i) {
+            if (a.memory[i] != b.memory[i]) {
+                printf("  mem[%03x] %02x %02x\n", i, a.memory[i], b.memory[i]);
+                ++shown;
+            }
+        }
+    }
+
+    if (!a.screen.Same(b.screen)) {
+        same = false;
+        int pixels = 0;
+        if (a.screen.HiRes != b.screen.HiRes && print)
+            printf("  hires %d %d\n", a.screen.HiRes, b.screen.HiRes);
+        for (int px = 0; px < a.screen.Width(); ++px) {
+            for (int py = 0; py < a.screen.Height(); ++py) {
+                if (a.screen.Colour(px, py) != b.screen.Colour(px, py)) {
+                    if (print && pixels < 8)
+                        printf("  pixel (%d, %d) %d %d\n", px, py, a.screen.Colour(px, py), b.screen.Colour(px, py));
+                    ++pixels;
+                }
+            }
+        }
+        if (print)
+            printf("  %d pixels differ\n", pixels);
+    }
+    return same;
+}
+
+// The PCs each engine went through in one step, filled in by a second run
+struct StepTrace {
+    uint64_t Step;
+    std::vector<uint16_t> Reference;
+    std::vector<uint16_t> Candidate;
+};
+
+// Every undo record starts with the PC of its instruction, walking the log
+// back lists them. Translated code has no per instruction hooks, and
+// recording would hand it to the predecoded engine, so it stays untraced.
+static void TracedRun(CHIP8 &chp, const EngineSpec &engine, uint32_t step, std::vector<uint16_t> &pcs) {
+    if (engine.Compiled) {
+        chp.Run(step);
+        return;
+    }
+
+    chp.History.Clear();
+    chp.History.Enabled = true;
+    const uint32_t count = chp.Run(step);
+    chp.History.Enabled = false;
+    while (chp.History.Undo(chp)) {
+        pcs.push_back(chp.GetInfo().PC & MEMORY_MASK);
+    }
+    // An instruction the engine refused was recorded but never ran
+    std::reverse(pcs.begin(), pcs.end());
+    pcs.resize(std::min<size_t>(pcs.size(), count));
+}
+
+static void PrintPath(const CHIP8 &chp, const EngineSpec &engine, uint32_t count, uint16_t from,
+                      const std::vector<uint16_t> &pcs) {
+    if (engine.Compiled) {
+        printf("  %s ran %u instructions of translated code from %03x to %03x\n", engine.Name, count, from,
+               chp.GetInfo().PC);
+        return;
+    }
+
+    printf("  %s ran %u instructions:\n", engine.Name, count);
+    for (uint16_t pc : pcs) {
+        const uint16_t opcode = chp.memory[pc] << 8 | chp.memory[(pc + 1) & MEMORY_MASK];
+        std::string text;
+        Disassemble(opcode, text, chp.Quirks);
+        printf("    %03x  %04x  %s\n", pc, opcode, text.c_str());
+    }
+}
+
+static bool Load(CHIP8 &chp, const RomArchive *archive, const ArchiveEntry *entry, const std::string &path, ProgramReader &pr) {
+    chp.ClearMemory();
+    if (entry ? !pr.LoadInto(*archive, *entry, chp) : !pr.LoadInto(path, chp))
+        return false;
+    chp.Init();
+    memset(chp.Keys, 0, sizeof(chp.Keys));
+    return true;
+}
+
+// Returns false on a divergence. With `trace` the run stops at its step
+// instead, and only records the PCs the engines ran through.
+static bool Lockstep(const std::string &name, const RomArchive *archive, const ArchiveEntry *entry,
+                     const LockstepOptions &options, uint64_t &instructions, StepTrace *trace = NULL) {
+    std::unique_ptr<CHIP8> reference(new CHIP8()), candidate(new CHIP8());
+    ProgramReader pr;
+    if (!Load(*reference, archive, entry, name, pr) || !Load(*candidate, archive, entry, name, pr)) {
+        printf("ERROR %s: %s\n", name.c_str(), pr.Error.c_str());
+        return false;
+    }
+    Configure(*reference, *options.Reference, options);
+    Configure(*candidate, *options.Candidate, options);
+    reference->Seed(options.Seed);
+    candidate->Seed(options.Seed);
+
+    RomSettings settings;
+    if (!options.Database.Find(pr.Hash, settings)) {
+        settings = RomDatabase::Defaults();
+    }
+    reference->Quirks = settings.Quirks;
+    candidate->Quirks = settings.Quirks;
+    if (!pr.Fits(settings.Quirks.Platform)) {
+        printf("ERROR %s: %s\n", name.c_str(), pr.Error.c_str());
+        return false;
+    }
+
+    InputReplay replay[2];
+    if (!options.Keys.empty()) {
+        replay[0].Load(options.Keys);
+        replay[1].Load(options.Keys);
+    }
+
+    uint64_t executed = 0;
+    uint64_t steps = 0;
+    for (uint32_t frame = 0; frame < options.Frames; ++frame) {
+        replay[0].Apply(frame, *reference);
+        replay[1].Apply(frame, *candidate);
+
+        uint32_t left = settings.InstructionsPerFrame;
+        while (left > 0) {
+            const CHIP8_INFO before = reference->GetInfo();
+            // Both get the same request, an engine stopping early may have
+            // already counted the timers down for the instruction it refused
+            const uint32_t step = std::min<uint32_t>(left, LOCKSTEP_STEP);
+            if (trace && steps == trace->Step) {
+                TracedRun(*candidate, *options.Candidate, step, trace->Candidate);
+                TracedRun(*reference, *options.Reference, step, trace->Reference);
+                return false;
+            }
+            const uint32_t count = candidate->Run(step);
+            const uint32_t matched = reference->Run(step);
+            ++steps;
+
+            if (matched != count || !Compare(*reference, *candidate, false)) {
+                if (trace)
+                    return false;
+                printf("DIVERGED %s at frame %u, instruction %llu, from %03x\n", name.c_str(), frame,
+                       static_cast<unsigned long long>(executed + 1), before.PC);
+
+                // Same seed and inputs, the second run reaches the same state
+                StepTrace path;
+                path.Step = steps - 1;
+                uint64_t traced = 0;
+                Lockstep(name, archive, entry, options, traced, &path);
+                PrintPath(*reference, *options.Reference, matched, before.PC, path.Reference);
+                PrintPath(*candidate, *options.Candidate, count, before.PC, path.Candidate);
+                printf("  %-8s %s / %s\n", "", options.Reference->Name, options.Candidate->Name);
+                Compare(*reference, *candidate, true);
+                instructions += executed;
+                return false;
+            }
+
+            executed += count;
+            left -= count;
+            if (count < step) {
+                // Both waiting on a key, nothing more happens this frame
+                if (candidate->Blocked)
+                    break;
+                // Both stopped on an instruction neither runs, the end of the ROM
+                instructions += executed;
+                return true;
+            }
+        }
+    }
+
+    instructions += executed;
+    return true;
+}
+
+int main(int argc, char **argv) {
+    LockstepOptions options;
+    options.Reference = FindEngine("cycle");
+    options.Candidate = FindEngine("predecoded");
+    options.Frames = 600;
+    options.Seed = LOCKSTEP_SEED;
+
+    std::string archiveFile, target;
+    for (int i = 1; i < argc; ++i) {
+        const bool hasValue = i + 1 < argc;
+        if (!strcmp(argv[i], "--engines") && hasValue) {
+            const std::string engines = argv[++i];
+            const size_t split = engines.find(',');
+            options.Reference = FindEngine(engines.substr(0, split));
+            options.Candidate = split != std::string::npos ? FindEngine(engines.substr(split + 1)) : NULL;
+            if (!options.Reference || !options.Candidate) {
+                std::cout << "Unknown engines " << engines << ", pick two of cycle, predecoded, nofusion, compiled" << std::endl;
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--compiled") && hasValue) {
+            if (!options.Compiled.Load(argv[++i])) {
+                std::cout << options.Compiled.Error << std::endl;
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--frames") && hasValue)
+            options.Frames = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--seed") && hasValue)
+            options.Seed = strtoul(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "--keys") && hasValue)
+            options.Keys = argv[++i];
+        else if (!strcmp(argv[i], "--db") && hasValue)
+            options.Database.Load(argv[++i]);
+        else if (!strcmp(argv[i], "--archive") && hasValue)
+            archiveFile = argv[++i];
+        else if (argv[i][0] != '-')
+            target = argv[i];
+        else {
+            std::cout << "Unknown option " << argv[i] << std::endl;
+            return 1;
+        }
+    }
+
+    if ((options.Reference->Compiled || options.Candidate->Compiled) && !options.Compiled.Attached()) {
+        std::cout << "The compiled engine needs --compiled" << std::endl;
+        return 1;
+    }
+    if (archiveFile.empty() == target.empty()) {
+        std::cout << "Usage: " << argv[0] << " [--engines a,b] [--compiled lib] [--frames N] [--seed N] [--keys file] [--db file] <rom | directory | --archive file>" << std::endl;
+        return 1;
+    }
+
+    auto started = std::chrono::steady_clock::now();
+    uint64_t instructions = 0;
+    size_t roms = 0, diverged = 0;
+
+    if (!archiveFile.empty()) {
+        RomArchive archive;
+        if (!archive.Open(archiveFile)) {
+            std::cout << archive.Error << std::endl;
+            return 1;
+        }
+        for (size_t i = 0; i < archive.Count(); ++i, ++roms) {
+            const ArchiveEntry &entry = archive.Entry(i);
+            if (!Lockstep(archive.Name(entry), &archive, &entry, options, instructions))
+                ++diverged;
+        }
+    }
+    else {
+        std::vector<std::string> paths;
+        std::error_code error;
+        if (fs::is_directory(target, error)) {
+            for (fs::recursive_directory_iterator it(target, error), end; !error && it != end; it.increment(error)) {
+                if (fs::is_regular_file(it->status()))
+                    paths.push_back(it->path().string());
+            }
+        }
+        else {
+            paths.push_back(target);
+        }
+        for (const auto &path : paths) {
+            if (!Lockstep(path, NULL, NULL, options, instructions))
+                ++diverged;
+            ++roms;
+        }
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - started;
+    printf("%zu ROMs, %llu instructions in %.2fs, %s vs %s: %zu diverged\n", roms,
+           static_cast<unsigned long long>(instructions), elapsed.count(), options.Reference->Name,
+           options.Candidate->Name, diverged);
+    return diverged == 0 ? 0 : 1;
+}
@@ -0,0 +1,352 @@
+#include "chip8.h"
+#include "frame-recorder.h"
+#include "input-replay.h"
+#include "metrics.h"
+#include "program-reader.h"
+#include "rom-archive.h"
+#include "rom-database.h"
+#include "translation-cache.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <experimental/filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+namespace fs = std::experimental::filesystem;
+
+// Golden-image regression run over a ROM corpus:
+//   chip8-regress [--jobs N] [--goldens DIR] [--db roms.db] [--cache DIR] [--metrics TARGET] [--update [--frames N] [--every K]] <directory | --archive file>
+// Goldens live in DIR as <hash>.golden, one "<frame> <screen hash>" line per
+// checkpoint, and an optional <hash>.keys input replay next to them. Every
+// ROM runs with a fixed RNG seed until its last checkpoint. A ROM without a
+// golden fails, goldens are only written with --update, which by default
+// records every frame so a failure names the exact frame. With --cache the
+// predecoded tables of every ROM are kept in a directory between runs.
+// --metrics exports per-worker counters to a file or unix:<socket>.
+#define REGRESS_SEED 0x43485038
+
+enum E_RESULT {
+    RESULT_PASS,
+    RESULT_FAIL,
+    RESULT_NEW,
+    RESULT_MISSING,
+    RESULT_ERROR
+};
+
+struct Checkpoint {
+    uint32_t Frame;
+    uint64_t Hash;
+};
+
+struct Job {
+    std::string Name;
+    std::string Path;
+    const ArchiveEntry *Entry;
+
+    E_RESULT Result;
+    uint64_t Hash;
+    Checkpoint Expected;
+    Checkpoint Actual;
+    uint32_t LastMatch;
+    uint32_t LastChecked;
+    std::string Error;
+};
+
+struct RegressOptions {
+    std::string Goldens;
+    bool Update;
+    uint32_t Frames;
+    uint32_t Every;
+    RomDatabase Database;
+    const RomArchive *Archive;
+    std::string Cache;
+    MetricsExporter *Exporter;
+};
+
+static std::string HashName(uint64_t hash) {
+    char name[17];
+    snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(hash));
+    return name;
+}
+
+static bool LoadGolden(const std::string &filename, std::vector<Checkpoint> &checkpoints) {
+    std::ifstream file(filename.c_str());
+    if (!file)
+        return false;
+
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#')
+            continue;
+        std::stringstream fields(line);
+        Checkpoint checkpoint;
+        if (fields >> checkpoint.Frame >> std::hex >> checkpoint.Hash)
+            checkpoints.push_back(checkpoint);
+    }
+    return !checkpoints.empty();
+}
+
+static bool SaveGolden(const std::string &filename, const std::string &name, const std::vector<Checkpoint> &checkpoints) {
+    std::ofstream file(filename.c_str(), std::ios::trunc);
+    if (!file)
+        return false;
+
+    file << "# " << name << '\n';
+    for (const auto &checkpoint : checkpoints) {
+        file << checkpoint.Frame << ' ' << HashName(checkpoint.Hash) << '\n';
+    }
+    return static_cast<bool>(file);
+}
+
+static void RunJob(CHIP8 &chp, Job &job, const RegressOptions &options, MetricsInstance &metrics) {
+    if (options.Exporter)
+        options.Exporter->SetLabel(metrics, job.Name);
+
+    const auto started = std::chrono::steady_clock::now();
+    ProgramReader pr;
+    chp.ClearMemory();
+    const bool loaded = job.Entry ? pr.LoadInto(*options.Archive, *job.Entry, chp) : pr.LoadInto(job.Path, chp);
+    if (!loaded) {
+        job.Result = RESULT_ERROR;
+        job.Error = pr.Error;
+        return;
+    }
+    chp.Init();
+    metrics.Loaded(std::chrono::steady_clock::now() - started);
+    chp.Seed(REGRESS_SEED);
+    memset(chp.Keys, 0, sizeof(chp.Keys));
+    job.Hash = pr.Hash;
+
+    RomSettings settings;
+    if (!options.Database.Find(pr.Hash, settings)) {
+        settings = RomDatabase::Defaults();
+    }
+    chp.Quirks = settings.Quirks;
+    if (!pr.Fits(settings.Quirks.Platform)) {
+        job.Result = RESULT_ERROR;
+        job.Error = pr.Error;
+        return;
+    }
+
+    TranslationCache cache(options.Cache);
+    if (!options.Cache.empty())
+        cache.Load(pr.Hash, chp);
+
+    const std::string base = options.Goldens + "/" + HashName(pr.Hash);
+    InputReplay replay;
+    replay.Load(base + ".keys");
+
+    std::vector<Checkpoint> expected;
+    const bool haveGolden = !options.Update && LoadGolden(base + ".golden", expected);
+    if (!haveGolden && !options.Update) {
+        job.Result = RESULT_MISSING;
+        return;
+    }
+    if (!haveGolden) {
+        expected.clear();
+        for (uint32_t frame = options.Every; frame <= options.Frames; frame += options.Every) {
+            expected.push_back({ frame, 0 });
+        }
+    }
+
+    // Frame N is the screen after N frames worth of instructions
+    uint32_t frame = 0;
+    job.LastMatch = 0;
+    job.LastChecked = 0;
+    for (auto &checkpoint : expected) {
+        for (; frame < checkpoint.Frame; ++frame) {
+            replay.Apply(frame, chp);
+            metrics.Ran(chp.Run(settings.InstructionsPerFrame), settings.InstructionsPerFrame);
+            metrics.Frame();
+        }
+        const uint64_t hash = chp.screen.Hash();
+
+        if (!haveGolden) {
+            checkpoint.Hash = hash;
+        }
+        else if (hash != checkpoint.Hash) {
+            job.Result = RESULT_FAIL;
+            job.Expected = checkpoint;
+            job.Actual = { checkpoint.Frame, hash };
+            return;
+        }
+        else {
+            job.LastMatch = checkpoint.Frame;
+        }
+        job.LastChecked = checkpoint.Frame;
+    }
+
+    if (!options.Cache.empty())
+        cache.Store(pr.Hash, chp);
+
+    if (haveGolden) {
+        job.Result = RESULT_PASS;
+        return;
+    }
+    if (!SaveGolden(base + ".golden", job.Name, expected)) {
+        job.Result = RESULT_ERROR;
+        job.Error = "Could not write golden " + base + ".golden";
+        return;
+    }
+    job.Result = RESULT_NEW;
+}
+
+int main(int argc, char **argv) {
+    RegressOptions options;
+    options.Goldens = "goldens";
+    options.Update = false;
+    options.Frames = 600;
+    options.Every = 1;
+    options.Archive = NULL;
+    options.Exporter = NULL;
+
+    unsigned int jobs = std::thread::hardware_concurrency();
+    std::string archiveFile, directory, metricsTarget;
+    uint32_t metricsInterval = 1000;
+
+    for (int i = 1; i < argc; ++i) {
+        const bool hasValue = i + 1 < argc;
+        if (!strcmp(argv[i], "--jobs") && hasValue)
+            jobs = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--goldens") && hasValue)
+            options.Goldens = argv[++i];
+        else if (!strcmp(argv[i], "--db") && hasValue)
+            options.Database.Load(argv[++i]);
+        else if (!strcmp(argv[i], "--frames") && hasValue)
+            options.Frames = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--every") && hasValue)
+            options.Every = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--cache") && hasValue)
+            options.Cache = argv[++i];
+        else if (!strcmp(argv[i], "--metrics") && hasValue)
+            metricsTarget = argv[++i];
+        else if (!strcmp(argv[i], "--metrics-interval") && hasValue)
+            metricsInterval = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--update"))
+            options.Update = true;
+        else if (!strcmp(argv[i], "--archive") && hasValue)
+            archiveFile = argv[++i];
+        else if (argv[i][0] != '-')
+            directory = argv[i];
+        else {
+            std::cout << "Unknown option " << argv[i] << std::endl;
+            return 1;
+        }
+    }
+
+    if (archiveFile.empty() == directory.empty() || options.Every == 0) {
+        std::cout << "Usage: " << argv[0] << " [--jobs N] [--goldens DIR] [--db file] [--cache DIR] [--metrics file | unix:path] [--update [--frames N] [--every K]] <directory | --archive file>" << std::endl;
+        return 1;
+    }
+    if (jobs == 0)
+        jobs = 1;
+
+    std::vector<Job> corpus;
+    RomArchive archive;
+    if (!archiveFile.empty()) {
+        if (!archive.Open(archiveFile)) {
+            std::cout << archive.Error << std::endl;
+            return 1;
+        }
+        options.Archive = &archive;
+        for (size_t i = 0; i < archive.Count(); ++i) {
+            Job job;
+            job.Name = archive.Name(archive.Entry(i));
+            job.Entry = &archive.Entry(i);
+            corpus.push_back(job);
+        }
+    }
+    else {
+        std::error_code error;
+        for (fs::recursive_directory_iterator it(directory, error), end; !error && it != end; it.increment(error)) {
+            const std::string extension = it->path().extension().string();
+            if (!fs::is_regular_file(it->status()) || extension == ".golden" || extension == ".keys")
+                continue;
+            Job job;
+            job.Name = it->path().string();
+            job.Path = job.Name;
+            job.Entry = NULL;
+            corpus.push_back(job);
+        }
+    }
+
+    if (options.Update) {
+        std::error_code error;
+        fs::create_directories(options.Goldens, error);
+    }
+
+    MetricsExporter exporter;
+    if (!metricsTarget.empty()) {
+        if (!exporter.Start(metricsTarget, metricsInterval)) {
+            std::cout << exporter.Error << std::endl;
+            return 1;
+        }
+        options.Exporter = &exporter;
+    }
+
+    // Each worker owns one machine and pulls the next ROM off a shared counter
+    auto started = std::chrono::steady_clock::now();
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> workers;
+    for (unsigned int i = 0; i < jobs; ++i) {
+        workers.emplace_back([&]() {
+            std::unique_ptr<CHIP8> chp(new CHIP8());
+            chp->History.Enabled = false;
+            // Counters stay with the worker, the exporter sums them on its own thread
+            MetricsInstance metrics;
+            metrics.Machine = chp.get();
+            if (options.Exporter)
+                options.Exporter->Add(metrics, "");
+            for (size_t index = next++; index < corpus.size(); index = next++) {
+                RunJob(*chp, corpus[index], options, metrics);
+            }
+            if (options.Exporter)
+                options.Exporter->Remove(metrics);
+        });
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - started;
+
+    size_t counts[5] = { 0, 0, 0, 0, 0 };
+    for (const auto &job : corpus) {
+        ++counts[job.Result];
+        switch (job.Result) {
+        case RESULT_FAIL:
+            // Goldens recorded with --every K only bound the divergence to a range of frames
+            if (job.Expected.Frame == job.LastChecked + 1)
+                printf("FAIL %s %s: first divergence at frame %u, expected %s got %s\n",
+                       HashName(job.Hash).c_str(), job.Name.c_str(), job.Expected.Frame,
+                       HashName(job.Expected.Hash).c_str(), HashName(job.Actual.Hash).c_str());
+            else
+                printf("FAIL %s %s: diverged after frame %u, by frame %u, expected %s got %s\n",
+                       HashName(job.Hash).c_str(), job.Name.c_str(), job.LastChecked, job.Expected.Frame,
+                       HashName(job.Expected.Hash).c_str(), HashName(job.Actual.Hash).c_str());
+            break;
+        case RESULT_NEW:
+            printf("NEW  %s %s\n", HashName(job.Hash).c_str(), job.Name.c_str());
+            break;
+        case RESULT_MISSING:
+            printf("MISSING %s %s: no golden, record one with --update\n", HashName(job.Hash).c_str(), job.Name.c_str());
+            break;
+        case RESULT_ERROR:
+            printf("ERROR %s: %s\n", job.Name.c_str(), job.Error.c_str());
+            break;
+        default:
+            break;
+        }
+    }
+
+    printf("%zu ROMs in %.2fs on %u threads: %zu passed, %zu failed, %zu new, %zu missing, %zu errors\n", corpus.size(),
+           elapsed.count(), jobs, counts[RESULT_PASS], counts[RESULT_FAIL], counts[RESULT_NEW], counts[RESULT_MISSING],
+           counts[RESULT_ERROR]);
+    return counts[RESULT_FAIL] == 0 && counts[RESULT_MISSING] == 0 && counts[RESULT_ERROR] == 0 ? 0 : 1;
+}
@@ -0,0 +1,260 @@
+#include "chip8.h"
+#include "frame-recorder.h"
+#include "input-replay.h"
+#include "metrics.h"
+#include "program-reader.h"
+#include "rom-archive.h"
+#include "rom-database.h"
+#include "translation-cache.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+
+// Headless runner for batch jobs. Runs a ROM, or every ROM of an archive,
+// for a number of frames and prints a hash of the final screen:
+//   chip8-run [--frames N] [--ipf N] [--db roms.db] <rom.ch8>
+//   chip8-run [--frames N] [--ipf N] [--db roms.db] --archive <roms.c8pk> [--hash H | --index N]
+// With --record, every run is captured to a .c8v stream. For a whole archive
+// the value is used as a prefix for one file per ROM. --seed and --keys make
+// a run reproducible, the screen hash matches chip8-regress goldens.
+// --compiled runs on a program from chip8-translate built as a shared object.
+// Built with CHIP8_COMPILED_PROGRAM, the translated program is linked in.
+// --cache keeps the predecoded engine's tables in a directory across runs.
+// --metrics exports counters to a file or unix:<socket> every --metrics-interval ms.
+// --screenshot saves the final screen as a PPM, --scale and --filter pick
+// the size and the scaler; like --record it is a prefix for archives.
+#ifdef CHIP8_COMPILED_PROGRAM
+extern "C" const CompiledProgram *chip8_compiled_program();
+#endif
+
+struct RunOptions {
+    uint32_t Frames;
+    uint32_t InstructionsPerFrame;      // 0 picks the database or default value
+    RomDatabase Database;
+    std::string Record;
+    bool RecordPerRom;
+    std::string Screenshot;
+    int Scale;
+    E_SCALER Filter;
+    std::string Keys;
+    bool Seeded;
+    uint32_t Seed;
+    std::string Cache;
+    MetricsExporter *Exporter;
+};
+
+static MetricsInstance Metrics;
+
+static bool Run(CHIP8 &chp, ProgramReader &pr, const char *name, const RunOptions &options) {
+    RomSettings settings;
+    if (!options.Database.Find(pr.Hash, settings)) {
+        settings = RomDatabase::Defaults();
+    }
+    chp.Quirks = settings.Quirks;
+    if (!pr.Fits(settings.Quirks.Platform))
+        return false;
+    if (options.Seeded)
+        chp.Seed(options.Seed);
+    memset(chp.Keys, 0, sizeof(chp.Keys));
+
+    InputReplay replay;
+    if (!options.Keys.empty())
+        replay.Load(options.Keys);
+
+    TranslationCache cache(options.Cache);
+    if (!options.Cache.empty() && !cache.Load(pr.Hash, chp) && !cache.Error.empty())
+        std::cout << "Ignoring cached tables: " << cache.Error << std::endl;
+
+    FrameRecorder recorder;
+    if (!options.Record.empty())
+        recorder.Start(options.RecordPerRom ? options.Record + name + ".c8v" : options.Record);
+
+    if (options.Exporter)
+        options.Exporter->SetLabel(Metrics, name);
+
+    // Screenshots are taken at the resolution the program is in, phosphor
+    // needs every frame to build up its fades and starts over on a switch
+    std::unique_ptr<FrameScaler> scaler;
+    std::vector<uint32_t> shot;
+    uint64_t rows[HIRES_HEIGHT * HIRES_WIDTH / 64];
+    const bool fades = !options.Screenshot.empty() && options.Filter == SCALER_PHOSPHOR;
+    auto take = [&]() {
+        if (!scaler || scaler->Width() != chp.screen.Width() * options.Scale) {
+            scaler.reset(new FrameScaler(options.Filter, options.Scale, chp.screen.Width(), chp.screen.Height()));
+            shot.resize(scaler->Width() * scaler->Height());
+        }
+        for (int i = 0; i < chp.screen.Size(); ++i) {
+            rows[i] = chp.screen.Rows[0][i] | chp.screen.Rows[1][i];
+        }
+        scaler->Scale(rows, shot.data());
+    };
+
+    const uint32_t ipf = options.InstructionsPerFrame != 0 ? options.InstructionsPerFrame : settings.InstructionsPerFrame;
+    for (uint32_t frame = 0; frame < options.Frames; ++frame) {
+        replay.Apply(frame, chp);
+        Metrics.Ran(chp.Run(ipf), ipf);
+        Metrics.Frame();
+        recorder.Capture(chp.screen);
+        if (fades)
+            take();
+    }
+    recorder.Stop();
+    if (!options.Cache.empty())
+        cache.Store(pr.Hash, chp);
+
+    if (!options.Screenshot.empty()) {
+        if (!fades || !scaler)
+            take();
+        const std::string file = options.RecordPerRom ? options.Screenshot + name + ".ppm" : options.Screenshot;
+        if (!SavePPM(file, shot.data(), scaler->Width(), scaler->Height()))
+            std::cout << "Could not write " << file << std::endl;
+    }
+    printf("%016llx %016llx %s\n", static_cast<unsigned long long>(pr.Hash),
+           static_cast<unsigned long long>(chp.screen.Hash()), name);
+    return true;
+}
+
+static void RunEntry(CHIP8 &chp, const RomArchive &archive, const ArchiveEntry &entry, const RunOptions &options) {
+    const auto started = std::chrono::steady_clock::now();
+    ProgramReader pr;
+    chp.ClearMemory();
+    if (!pr.LoadInto(archive, entry, chp))
+        return;
+    chp.Init();
+    Metrics.Loaded(std::chrono::steady_clock::now() - started);
+    Run(chp, pr, archive.Name(entry), options);
+}
+
+int main(int argc, char **argv) {
+    RunOptions options;
+    options.Frames = 600;
+    options.InstructionsPerFrame = 0;
+    options.RecordPerRom = false;
+    options.Scale = 4;
+    options.Filter = SCALER_NEAREST;
+    options.Seeded = false;
+    options.Seed = 0;
+    options.Exporter = NULL;
+
+    std::string archiveFile, romFile, hash, compiledFile, metricsTarget;
+    uint32_t metricsInterval = 1000;
+    long index = -1;
+
+    for (int i = 1; i < argc; ++i) {
+        const bool hasValue = i + 1 < argc;
+        if (!strcmp(argv[i], "--frames") && hasValue)
+            options.Frames = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--ipf") && hasValue)
+            options.InstructionsPerFrame = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--db") && hasValue)
+            options.Database.Load(argv[++i]);
+        else if (!strcmp(argv[i], "--seed") && hasValue) {
+            options.Seeded = true;
+            options.Seed = strtoul(argv[++i], NULL, 0);
+        }
+        else if (!strcmp(argv[i], "--keys") && hasValue)
+            options.Keys = argv[++i];
+        else if (!strcmp(argv[i], "--record") && hasValue)
+            options.Record = argv[++i];
+        else if (!strcmp(argv[i], "--screenshot") && hasValue)
+            options.Screenshot = argv[++i];
+        else if (!strcmp(argv[i], "--scale") && hasValue)
+            options.Scale = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--filter") && hasValue) {
+            if (!ParseScaler(argv[++i], options.Filter)) {
+                std::cout << "Unknown filter " << argv[i] << ", use nearest, scale2x, epx, scale3x or phosphor" << std::endl;
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--cache") && hasValue)
+            options.Cache = argv[++i];
+        else if (!strcmp(argv[i], "--metrics") && hasValue)
+            metricsTarget = argv[++i];
+        else if (!strcmp(argv[i], "--metrics-interval") && hasValue)
+            metricsInterval = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--compiled") && hasValue)
+            compiledFile = argv[++i];
+        else if (!strcmp(argv[i], "--archive") && hasValue)
+            archiveFile = argv[++i];
+        else if (!strcmp(argv[i], "--hash") && hasValue)
+            hash = argv[++i];
+        else if (!strcmp(argv[i], "--index") && hasValue)
+            index = strtol(argv[++i], NULL, 10);
+        else if (argv[i][0] != '-')
+            romFile = argv[i];
+        else {
+            std::cout << "Unknown option " << argv[i] << std::endl;
+            return 1;
+        }
+    }
+
+    CHIP8 chp;
+    chp.History.Enabled = false;
+#ifdef CHIP8_COMPILED_PROGRAM
+    chp.Compiled.Attach(chip8_compiled_program());
+#endif
+    if (!compiledFile.empty() && !chp.Compiled.Load(compiledFile)) {
+        std::cout << chp.Compiled.Error << std::endl;
+        return 1;
+    }
+
+    MetricsExporter exporter;
+    if (!metricsTarget.empty()) {
+        if (!exporter.Start(metricsTarget, metricsInterval)) {
+            std::cout << exporter.Error << std::endl;
+            return 1;
+        }
+        Metrics.Machine = &chp;
+        exporter.Add(Metrics, "");
+        options.Exporter = &exporter;
+    }
+
+    if (archiveFile.empty()) {
+        if (romFile.empty()) {
+            std::cout << "Usage: " << argv[0] << " [--frames N] [--ipf N] [--db file] [--record file] [--screenshot file] [--scale N] [--filter name] [--seed N] [--keys file] [--compiled lib] [--cache dir] [--metrics file | unix:path] <rom> | --archive <file> [--hash H | --index N]" << std::endl;
+            return 1;
+        }
+
+        const auto started = std::chrono::steady_clock::now();
+        ProgramReader pr;
+        chp.ClearMemory();
+        if (!pr.LoadInto(romFile, chp))
+            return 1;
+        chp.Init();
+        Metrics.Loaded(std::chrono::steady_clock::now() - started);
+        return Run(chp, pr, romFile.c_str(), options) ? 0 : 1;
+    }
+
+    RomArchive archive;
+    if (!archive.Open(archiveFile)) {
+        std::cout << archive.Error << std::endl;
+        return 1;
+    }
+
+    if (!hash.empty()) {
+        const ArchiveEntry *entry = archive.Find(strtoull(hash.c_str(), NULL, 16));
+        if (!entry) {
+            std::cout << "No ROM with hash " << hash << " in " << archiveFile << std::endl;
+            return 1;
+        }
+        RunEntry(chp, archive, *entry, options);
+    }
+    else if (index >= 0) {
+        if (static_cast<size_t>(index) >= archive.Count()) {
+            std::cout << "Index " << index << " out of range" << std::endl;
+            return 1;
+        }
+        RunEntry(chp, archive, archive.Entry(index), options);
+    }
+    else {
+        options.RecordPerRom = true;
+        for (size_t i = 0; i < archive.Count(); ++i) {
+            RunEntry(chp, archive, archive.Entry(i), options);
+        }
+    }
+    return 0;
+}
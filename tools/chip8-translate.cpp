@@ -0,0 +1,382 @@
+#include "chip8.h"
+#include "compiled-engine.h"
+#include "program-analysis.h"
+#include "program-reader.h"
+#include "rom-database.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+
+// Translates a ROM ahead of time into C++ for the compiled engine:
+//   chip8-translate [--entry addr] [--db roms.db] <rom> <out.cpp>
+// Every basic block the control flow recovery finds becomes straight-line
+// code with the registers in locals, blocks branch to each other directly
+// with gotos. Computed jumps, Fx0A and anything outside the recovered code
+// leave the generated function and run on the interpreter. Build the output
+// into a shared object and load it with --compiled, or link it into
+// chip8-run with CHIP8_COMPILED_PROGRAM defined, see chip8_compile_rom() in
+// CMakeLists.txt. The database picks the platform, SUPER-CHIP instructions
+// are recovered and left to the interpreter.
+struct Translation {
+    FILE *Out;
+    std::map<uint16_t, uint16_t> Index;     // Block start to block number
+    uint32_t Compiled;
+    uint32_t Fallbacks;
+    CHIP8_QUIRKS Quirks;
+};
+
+static void Jump(Translation &t, uint32_t target) {
+    if (target < MEMORY_SIZE && t.Index.count(target))
+        fprintf(t.Out, "goto E_%03x;", target);
+    else
+        fprintf(t.Out, "{ pc = 0x%03x; goto leave; }", target);
+}
+
+static void Branch(Translation &t, const char *condition, uint16_t address) {
+    fprintf(t.Out, "    if (%s) ", condition);
+    Jump(t, address + 4);
+    fprintf(t.Out, "\n    ");
+    Jump(t, address + 2);
+    fprintf(t.Out, "\n");
+}
+
+static void Fallback(Translation &t, uint16_t address) {
+    fprintf(t.Out, "    pc = 0x%03x; goto leave;\n", address);
+    ++t.Fallbacks;
+}
+
+static void FlushTimers(Translation &t) {
+    fprintf(t.Out, "    CompiledCountDown(ctx, n - counted); counted = n;\n");
+}
+
+// Writes through I may land on compiled code, let the engine revalidate first
+static void CheckWrite(Translation &t, uint16_t next) {
+    fprintf(t.Out, "    if (*ctx.CodeGeneration != ctx.Generation) { pc = 0x%03x; goto leave; }\n", next);
+}
+
+// Returns false once the instruction ended the block
+static bool Emit(Translation &t, uint16_t address, uint16_t opcode) {
+    const unsigned X = (opcode & 0x0F00) >> 8;
+    const unsigned Y = (opcode & 0x00F0) >> 4;
+    const unsigned N = opcode & 0x000F;
+    const unsigned NN = opcode & 0x00FF;
+    const unsigned NNN = opcode & 0x0FFF;
+    const uint16_t next = address + 2;
+    char condition[64];
+
+    std::string text;
+    Disassemble(opcode, text, t.Quirks);
+    fprintf(t.Out, "    // %03x  %04x  %s\n", address, opcode, text.c_str());
+
+    // Mirrors CHIP8::Execute, including the order VF is written in
+    switch (opcode & 0xF000) {
+    case 0x0000:
+        if (opcode == 0x00E0) {
+            fprintf(t.Out, "    ++n; ctx.Clear(*ctx.Chip);\n");
+            break;
+        }
+        if (opcode == 0x00EE) {
+            fprintf(t.Out, "    ++n; pc = ctx.Stack[sp]; sp = (sp - 1) & STACK_MASK; pc += 2; goto dispatch;\n");
+            ++t.Compiled;
+            return false;
+        }
+        Fallback(t, address);
+        return false;
+    case 0x1000:
+        fprintf(t.Out, "    ++n; ");
+        Jump(t, NNN);
+        fprintf(t.Out, "\n");
+        ++t.Compiled;
+        return false;
+    case 0x2000:
+        fprintf(t.Out, "    ++n; sp = (sp + 1) & STACK_MASK; ctx.Stack[sp] = 0x%03x; ", address);
+        Jump(t, NNN);
+        fprintf(t.Out, "\n");
+        ++t.Compiled;
+        return false;
+    case 0x3000:
+    case 0x4000:
+        fprintf(t.Out, "    ++n;\n");
+        snprintf(condition, sizeof(condition), "v[%u] %s 0x%02x", X, (opcode & 0xF000) == 0x3000 ? "==" : "!=", NN);
+        Branch(t, condition, address);
+        ++t.Compiled;
+        return false;
+    case 0x5000:
+    case 0x9000:
+        fprintf(t.Out, "    ++n;\n");
+        snprintf(condition, sizeof(condition), "v[%u] %s v[%u]", X, (opcode & 0xF000) == 0x5000 ? "==" : "!=", Y);
+        Branch(t, condition, address);
+        ++t.Compiled;
+        return false;
+    case 0x6000:
+        fprintf(t.Out, "    ++n; v[%u] = 0x%02x;\n", X, NN);
+        break;
+    case 0x7000:
+        fprintf(t.Out, "    ++n; v[%u] += 0x%02x;\n", X, NN);
+        break;
+    case 0x8000:
+        switch (N) {
+        case 0x0: fprintf(t.Out, "    ++n; v[%u] = v[%u];\n", X, Y); break;
+        case 0x1: fprintf(t.Out, "    ++n; v[%u] |= v[%u];\n", X, Y); break;
+        case 0x2: fprintf(t.Out, "    ++n; v[%u] &= v[%u];\n", X, Y); break;
+        case 0x3: fprintf(t.Out, "    ++n; v[%u] ^= v[%u];\n", X, Y); break;
+        case 0x4:
+            fprintf(t.Out, "    ++n; { const uint16_t r = v[%u] + v[%u]; v[15] = (r & 0xFF00) ? 1 : 0; v[%u] = r & 0xFF; }\n", X, Y, X);
+            break;
+        case 0x5:
+            fprintf(t.Out, "    ++n; v[15] = v[%u] > v[%u] ? 0 : 1; v[%u] = v[%u] - v[%u];\n", Y, X, X, X, Y);
+            break;
+        case 0x6:
+            fprintf(t.Out, "    ++n; v[15] = v[%u] & 0x01; v[%u] = (ctx.ShiftUsesVY ? v[%u] : v[%u]) >> 1;\n", X, X, Y, X);
+            break;
+        case 0x7:
+            fprintf(t.Out, "    ++n; v[15] = v[%u] < v[%u] ? 0 : 1; v[%u] = v[%u] - v[%u];\n", Y, X, X, Y, X);
+            break;
+        case 0xE:
+            fprintf(t.Out, "    ++n;\n");
+            fprintf(t.Out, "    if (ctx.ShiftUsesVY) { v[15] = v[%u] & 0x80; v[%u] = v[%u] = v[%u] << 1; }\n", Y, X, Y, Y);
+            fprintf(t.Out, "    else { v[15] = v[%u] & 0x80; v[%u] = v[%u] << 1; }\n", X, X, X);
+            break;
+        default:
+            Fallback(t, address);
+            return false;
+        }
+        break;
+    case 0xA000:
+        fprintf(t.Out, "    ++n; i = 0x%03x;\n", NNN);
+        break;
+    case 0xC000:
+        fprintf(t.Out, "    ++n; v[%u] = ctx.Random(*ctx.Chip) & 0x%02x;\n", X, NN);
+        break;
+    case 0xD000:
+        // The sprite code lives in the core, hand it the registers it reads
+        fprintf(t.Out, "    ++n; ctx.V[%u] = v[%u]; ctx.V[%u] = v[%u]; ctx.V[15] = v[15]; *ctx.I = i;\n", X, X, Y, Y);
+        fprintf(t.Out, "    ctx.Draw(*ctx.Chip, %u, %u, %u); v[15] = ctx.V[15];\n", X, Y, N);
+        break;
+    case 0xE000:
+        if (NN != 0x9E && NN != 0xA1) {
+            Fallback(t, address);
+            return false;
+        }
+        fprintf(t.Out, "    ++n;\n");
+        snprintf(condition, sizeof(condition), "%sctx.Keys[v[%u] & 0x0F]", NN == 0x9E ? "" : "!", X);
+        Branch(t, condition, address);
+        ++t.Compiled;
+        return false;
+    case 0xF000:
+        switch (NN) {
+        case 0x07:
+            fprintf(t.Out, "    ++n;\n");
+            FlushTimers(t);
+            fprintf(t.Out, "    v[%u] = *ctx.Delay;\n", X);
+            break;
+        case 0x15:
+        case 0x18:
+            fprintf(t.Out, "    ++n;\n");
+            FlushTimers(t);
+            fprintf(t.Out, "    *ctx.%s = v[%u];\n", NN == 0x15 ? "Delay" : "Sound", X);
+            break;
+        case 0x1E:
+            fprintf(t.Out, "    ++n; { const uint16_t r = i + v[%u]; v[15] = (r & 0xFF00) ? 1 : 0; i = r & 0xFF; }\n", X);
+            break;
+        case 0x29:
+            fprintf(t.Out, "    ++n; i = v[%u] * 5;\n", X);
+            break;
+        case 0x33:
+            fprintf(t.Out, "    ++n;\n");
+            fprintf(t.Out, "    ctx.Memory[i & MEMORY_MASK] = v[%u] / 100;\n", X);
+            fprintf(t.Out, "    ctx.Memory[(i + 1) & MEMORY_MASK] = (v[%u] / 10) %% 10;\n", X);
+            fprintf(t.Out, "    ctx.Memory[(i + 2) & MEMORY_MASK] = v[%u] %% 10;\n", X);
+            fprintf(t.Out, "    ctx.NotifyWrite(*ctx.Chip, i & MEMORY_MASK, 3);\n");
+            CheckWrite(t, next);
+            break;
+        case 0x55:
+            fprintf(t.Out, "    ++n;\n");
+            for (unsigned k = 0; k <= X; ++k) {
+                fprintf(t.Out, "    ctx.Memory[(i + %u) & MEMORY_MASK] = v[%u];\n", k, k);
+            }
+            fprintf(t.Out, "    ctx.NotifyWrite(*ctx.Chip, i & MEMORY_MASK, %u);\n", X + 1);
+            fprintf(t.Out, "    if (ctx.LoadStoreIncrementsI) i += %u;\n", X + 1);
+            CheckWrite(t, next);
+            break;
+        case 0x65:
+            fprintf(t.Out, "    ++n;\n");
+            for (unsigned k = 0; k <= X; ++k) {
+                fprintf(t.Out, "    v[%u] = ctx.Memory[(i + %u) & MEMORY_MASK];\n", k, k);
+            }
+            fprintf(t.Out, "    if (ctx.LoadStoreIncrementsI) i += %u;\n", X + 1);
+            break;
+        default:
+            // Fx0A blocks the machine, the interpreter owns that state
+            Fallback(t, address);
+            return false;
+        }
+        break;
+    default:
+        // Bnnn, the target is only known at run time
+        Fallback(t, address);
+        return false;
+    }
+
+    ++t.Compiled;
+    return true;
+}
+
+static bool Translate(const ProgramReader &pr, CHIP8 &chp, const ProgramAnalysis &analysis,
+                      const char *name, Translation &t) {
+    FILE *out = t.Out;
+    const uint16_t imageEnd = PROGRAM_START + pr.Size;
+
+    // Only blocks made entirely of ROM bytes can be checked against the image
+    std::vector<const BasicBlock *> blocks;
+    for (const auto &entry : analysis.Blocks) {
+        const BasicBlock &block = entry.second;
+        if (block.Start >= PROGRAM_START && block.End <= imageEnd) {
+            t.Index[block.Start] = static_cast<uint16_t>(blocks.size());
+            blocks.push_back(&block);
+        }
+    }
+    if (blocks.empty()) {
+        std::cout << "No code found in " << name << std::endl;
+        return false;
+    }
+
+    fprintf(out, "// Generated by chip8-translate from %s, do not edit\n", name);
+    fprintf(out, "#include \"compiled-engine.h\"\n#include <cstring>\n\n");
+
+    fprintf(out, "static const uint8_t Image[%u] = {", static_cast<unsigned>(pr.Size));
+    for (size_t i = 0; i < pr.Size; ++i) {
+        fprintf(out, "%s0x%02x,", i % 16 == 0 ? "\n    " : " ", chp.memory[PROGRAM_START + i]);
+    }
+    fprintf(out, "\n};\n\n");
+
+    fprintf(out, "static const CompiledBlock Blocks[%u] = {\n", static_cast<unsigned>(blocks.size()));
+    for (const BasicBlock *block : blocks) {
+        fprintf(out, "    { 0x%03x, 0x%03x },\n", block->Start, block->End);
+    }
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "static uint32_t Run(CompiledContext &ctx, uint32_t budget) {\n");
+    fprintf(out, "    uint8_t v[16];\n    memcpy(v, ctx.V, sizeof(v));\n");
+    fprintf(out, "    uint16_t i = *ctx.I;\n    uint16_t pc = *ctx.PC;\n    uint8_t sp = *ctx.SP;\n");
+    fprintf(out, "    uint32_t n = 0, counted = 0;\n    goto dispatch;\n\n");
+
+    fprintf(out, "dispatch:\n    switch (pc) {\n");
+    for (const BasicBlock *block : blocks) {
+        fprintf(out, "    case 0x%03x: goto E_%03x;\n", block->Start, block->Start);
+    }
+    fprintf(out, "    default: goto leave;\n    }\n");
+
+    for (const BasicBlock *block : blocks) {
+        const uint16_t index = t.Index[block->Start];
+        fprintf(out, "\nE_%03x:\n", block->Start);
+        fprintf(out, "    if (!ctx.Live[%u] || budget - n < %u) { pc = 0x%03x; goto leave; }\n", index,
+                (block->End - block->Start) / 2, block->Start);
+
+        bool open = true;
+        for (uint16_t address = block->Start; open && address < block->End; address += 2) {
+            open = Emit(t, address, chp.memory[address] << 8 | chp.memory[address + 1]);
+        }
+        if (open) {
+            // Fell through into the next leader, or off the end of the code
+            fprintf(out, "    ");
+            if (block->Successors.empty())
+                fprintf(out, "{ pc = 0x%03x; goto leave; }", block->End);
+            else
+                Jump(t, block->End);
+            fprintf(out, "\n");
+        }
+    }
+
+    fprintf(out, "\nleave:\n");
+    fprintf(out, "    CompiledCountDown(ctx, n - counted);\n");
+    fprintf(out, "    memcpy(ctx.V, v, sizeof(v));\n    *ctx.I = i;\n    *ctx.PC = pc;\n    *ctx.SP = sp;\n");
+    fprintf(out, "    return n;\n}\n\n");
+
+    fprintf(out, "static const CompiledProgram Program = {\n");
+    fprintf(out, "    COMPILED_ABI_VERSION, 0x%016llxULL, Image, sizeof(Image), Blocks, %u, &Run\n};\n\n",
+            static_cast<unsigned long long>(pr.Hash), static_cast<unsigned>(blocks.size()));
+    fprintf(out, "extern \"C\" COMPILED_EXPORT const CompiledProgram *chip8_compiled_program() {\n");
+    fprintf(out, "    return &Program;\n}\n");
+    return true;
+}
+
+int main(int argc, char **argv) {
+    uint16_t entry = PROGRAM_START;
+    std::string romFile, outFile;
+    RomDatabase database;
+
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--entry") && i + 1 < argc)
+            entry = static_cast<uint16_t>(strtoul(argv[++i], NULL, 16)) & MEMORY_MASK;
+        else if (!strcmp(argv[i], "--db") && i + 1 < argc) {
+            if (!database.Load(argv[++i])) {
+                std::cout << "Could not read " << argv[i] << std::endl;
+                return 1;
+            }
+        }
+        else if (argv[i][0] != '-' && romFile.empty())
+            romFile = argv[i];
+        else if (argv[i][0] != '-' && outFile.empty())
+            outFile = argv[i];
+        else {
+            std::cout << "Unknown option " << argv[i] << std::endl;
+            return 1;
+        }
+    }
+
+    if (romFile.empty() || outFile.empty()) {
+        std::cout << "Usage: " << argv[0] << " [--entry addr] [--db roms.db] <rom> <out.cpp>" << std::endl;
+        return 1;
+    }
+
+    std::unique_ptr<CHIP8> chp(new CHIP8());
+    ProgramReader pr;
+    chp->ClearMemory();
+    if (!pr.LoadInto(romFile, *chp)) {
+        std::cout << pr.Error << std::endl;
+        return 1;
+    }
+    chp->Init();
+
+    RomSettings settings;
+    if (!database.Find(pr.Hash, settings))
+        settings = RomDatabase::Defaults();
+    chp->Quirks = settings.Quirks;
+    if (!pr.Fits(chp->Quirks.Platform))
+        return 1;
+    if (chp->Quirks.Platform == PLATFORM_XOCHIP) {
+        // The compiled engine assumes 12 bit addresses
+        std::cout << romFile << " is an XO-CHIP program, it stays on the interpreter" << std::endl;
+        return 1;
+    }
+
+    ProgramAnalysis analysis;
+    analysis.Analyze(*chp, entry);
+
+    FILE *out = fopen(outFile.c_str(), "w");
+    if (!out) {
+        std::cout << "Could not write " << outFile << std::endl;
+        return 1;
+    }
+
+    Translation t;
+    t.Out = out;
+    t.Compiled = 0;
+    t.Fallbacks = 0;
+    t.Quirks = chp->Quirks;
+    const bool translated = Translate(pr, *chp, analysis, romFile.c_str(), t);
+    const bool written = fclose(out) == 0;
+    if (!translated || !written) {
+        remove(outFile.c_str());
+        return 1;
+    }
+
+    printf("%s: %zu blocks, %u instructions compiled, %u left to the interpreter\n", romFile.c_str(),
+           t.Index.size(), t.Compiled, t.Fallbacks);
+    return 0;
+}
@@ -0,0 +1,67 @@
+#include "rom-archive.h"
+#include "mem.h"
+#include <experimental/filesystem>
+#include <fstream>
+#include <iostream>
+
+namespace fs = std::experimental::filesystem;
+
+// Packs ROM files, or every file in the given directories, into one archive:
+//   rom-pack <out.c8pk> <file|directory>...
+static bool AddFile(RomArchiveBuilder &builder, const fs::path &path) {
+    std::ifstream file(path.string().c_str(), std::ios::binary | std::ios::ate);
+    if (!file) {
+        std::cout << "Could not open " << path.string() << std::endl;
+        return false;
+    }
+
+    std::streamoff size = file.tellg();
+    if (size <= 0 || size > XO_MEMORY_SIZE - PROGRAM_START) {
+        std::cout << "Skipping " << path.string() << ", does not fit in memory" << std::endl;
+        return false;
+    }
+
+    std::vector<uint8_t> data(static_cast<size_t>(size));
+    file.seekg(0);
+    if (!file.read(reinterpret_cast<char *>(data.data()), data.size())) {
+        std::cout << "Could not read " << path.string() << std::endl;
+        return false;
+    }
+
+    if (!builder.Add(path.stem().string(), data)) {
+        std::cout << "Skipping " << path.string() << ", duplicate content" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        std::cout << "Usage: " << argv[0] << " <out.c8pk> <file|directory>..." << std::endl;
+        return 1;
+    }
+
+    RomArchiveBuilder builder;
+    for (int i = 2; i < argc; ++i) {
+        std::error_code error;
+        fs::path path(argv[i]);
+
+        if (!fs::is_directory(path, error)) {
+            AddFile(builder, path);
+            continue;
+        }
+
+        for (fs::recursive_directory_iterator it(path, error), end; !error && it != end; it.increment(error)) {
+            if (fs::is_regular_file(it->status()))
+                AddFile(builder, it->path());
+        }
+    }
+
+    if (!builder.Write(argv[1])) {
+        std::cout << "Could not write archive " << argv[1] << std::endl;
+        return 1;
+    }
+
+    std::cout << "Packed " << builder.Count() << " ROMs into " << argv[1] << std::endl;
+    return 0;
+}